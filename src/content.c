@@ -86,26 +86,27 @@ int _find(exword_t *device, char *root, char *id, admini_t *ini)
 int _upload_file(exword_t *device, char *dir, char* name, char *key)
 {
 	int length, rsp;
-	char *ext, *buffer;
+	char *ext;
 	char *filename;
+	struct file_stream fs;
 	filename = mkpath(PATH_SEP, dir, name, NULL);
-	rsp = read_file(filename, &buffer, &length);
+	ext = strrchr(filename, '.');
+	if (ext == NULL || (strcmp(ext, ".txt") != 0 &&
+			    strcmp(ext, ".bmp") != 0 &&
+			    strcmp(ext, ".htm") != 0 &&
+			    strcmp(ext, ".TXT") != 0 &&
+			    strcmp(ext, ".BMP") != 0 &&
+			    strcmp(ext, ".HTM") != 0)) {
+		key = NULL;
+	}
+	rsp = open_read_stream(&fs, filename, key, &length);
 	if (rsp != 0) {
 		free(filename);
 		return 0;
 	}
-	ext = strrchr(filename, '.');
-	if (ext != NULL && (strcmp(ext, ".txt") == 0 ||
-			    strcmp(ext, ".bmp") == 0 ||
-			    strcmp(ext, ".htm") == 0 ||
-			    strcmp(ext, ".TXT") == 0 ||
-			    strcmp(ext, ".BMP") == 0 ||
-			    strcmp(ext, ".HTM") == 0)) {
-		crypt_data(buffer, length, key);
-	}
-	rsp = exword_send_file(device, name, buffer, length);
+	rsp = exword_send_stream(device, name, length, read_stream, &fs);
+	close_stream(&fs);
 	free(filename);
-	free(buffer);
 	return (rsp == EXWORD_SUCCESS);
 }
 
@@ -113,25 +114,28 @@ int _download_file(exword_t *device, char *dir, char* name, char *key)
 {
 	char *filename;
 	int length, rsp;
-	char *buffer, *ext;
+	char *ext;
+	struct file_stream fs;
 	filename = mkpath(PATH_SEP, dir, name, NULL);
 	ext = strrchr(filename, '.');
-	rsp = exword_get_file(device, name, &buffer, &length);
-	if (rsp != EXWORD_SUCCESS) {
+	if (ext == NULL || (strcmp(ext, ".htm") != 0 &&
+			    strcmp(ext, ".bmp") != 0 &&
+			    strcmp(ext, ".txt") != 0 &&
+			    strcmp(ext, ".TXT") != 0 &&
+			    strcmp(ext, ".BMP") != 0 &&
+			    strcmp(ext, ".HTM") != 0)) {
+		key = NULL;
+	}
+	rsp = open_write_stream(&fs, filename, key);
+	if (rsp != 0) {
 		free(filename);
 		return 0;
 	}
-	if (ext != NULL && (strcmp(ext, ".htm") == 0 ||
-			    strcmp(ext, ".bmp") == 0 ||
-			    strcmp(ext, ".txt") == 0 ||
-			    strcmp(ext, ".TXT") == 0 ||
-			    strcmp(ext, ".BMP") == 0 ||
-			    strcmp(ext, ".HTM") == 0)) {
-		crypt_data(buffer, length, key);
-	}
-	rsp = write_file(filename, buffer, length);
+	rsp = exword_get_stream(device, name, write_stream, &fs, &length);
+	if (rsp == EXWORD_SUCCESS && commit_stream(&fs) != 0)
+		rsp = EXWORD_ERROR_OTHER;
+	close_stream(&fs);
 	free(filename);
-	free(buffer);
 	return (rsp == EXWORD_SUCCESS);
 }
 
@@ -128,6 +128,65 @@ buf_t *buf_reuse(buf_t *p)
 	return p;
 }
 
+/* Make room for at least data_size more bytes at the end of the buffer.
+ * The allocation at least doubles each time so that a buffer built up by
+ * many appends is copied only O(log n) times. */
+int buf_grow(buf_t *p, size_t data_size)
+{
+	size_t total, new_size;
+
+	if (!p)
+		return -1;
+	if (p->data_avail + p->tail_avail >= data_size)
+		return 0;
+	total = buf_total_size(p);
+	new_size = total + data_size - p->data_avail - p->tail_avail;
+	if (new_size < total * 2)
+		new_size = total * 2;
+	buf_resize(p, new_size);
+	if (buf_total_size(p) != new_size)
+		return -1;
+	return 0;
+}
+
+/* Like buf_reuse but keeps headroom bytes free in front of the data so
+ * headers can later be prepended with buf_reserve_begin without moving
+ * the data. */
+buf_t *buf_reuse_headroom(buf_t *p, size_t headroom)
+{
+	if (!p)
+		return NULL;
+	if (buf_total_size(p) < headroom) {
+		buf_resize(p, headroom);
+		if (buf_total_size(p) < headroom)
+			return NULL;
+	}
+	buf_reuse(p);
+	p->head_avail = headroom;
+	p->data_avail -= headroom;
+	p->data = p->buffer + p->head_avail;
+	return p;
+}
+
+/* Exchanges the storage of p with the *size bytes at *buffer, of which
+ * the first data_size become the data of p. The old storage is returned
+ * in *buffer and *size, so received data can be taken over without
+ * copying it. */
+void buf_exchange(buf_t *p, uint8_t **buffer, size_t *size, size_t data_size)
+{
+	uint8_t *old = p->buffer;
+	size_t old_size = buf_total_size(p);
+
+	p->buffer = *buffer;
+	p->data = p->buffer;
+	p->head_avail = 0;
+	p->data_avail = *size - data_size;
+	p->tail_avail = 0;
+	p->data_size = data_size;
+	*buffer = old;
+	*size = old_size;
+}
+
 void *buf_reserve_begin(buf_t *p, size_t data_size)
 {
 	if (!p)
@@ -184,7 +243,7 @@ void *buf_reserve_end(buf_t *p, size_t data_size)
 	return t;
 }
 
-void buf_insert_begin(buf_t *p, uint8_t *data, size_t data_size)
+void buf_insert_begin(buf_t *p, const uint8_t *data, size_t data_size)
 {
 	uint8_t *dest;
 
@@ -193,7 +252,7 @@ void buf_insert_begin(buf_t *p, uint8_t *data, size_t data_size)
 	memcpy(dest, data, data_size);
 }
 
-void buf_insert_end(buf_t *p, uint8_t *data, size_t data_size)
+void buf_insert_end(buf_t *p, const uint8_t *data, size_t data_size)
 {
 	uint8_t *dest;
 
@@ -231,21 +290,24 @@ void buf_remove_end(buf_t *p, size_t data_size)
 
 void buf_dump(buf_t *p, const char *label)
 {
+	static const char hex[] = "0123456789ABCDEF";
+	char line[26 * 3 + 1];
 	int i, n;
 
 	if (!p || !label)
 		return;
 
+	/* One call per line of 26 bytes */
 	n = 0;
 	for (i = 0; i < p->data_size; ++i) {
-		if (n == 0)
-			log_debug("%s%s:", log_debug_prefix, label);
-		log_debug(" %02X", p->data[i]);
-		if (n >= 25 || i == p->data_size - 1) {
-			log_debug("\n");
+		line[n++] = ' ';
+		line[n++] = hex[p->data[i] >> 4];
+		line[n++] = hex[p->data[i] & 0xf];
+		if (n == sizeof(line) - 1 || i == p->data_size - 1) {
+			line[n] = '\0';
+			log_debug("%s%s:%s\n", log_debug_prefix, label, line);
 			n = 0;
-		} else
-			n++;
+		}
 	}
 }
 
@@ -39,11 +39,14 @@ typedef struct {
 buf_t *buf_new(size_t default_size);
 size_t buf_total_size(buf_t *p);
 void buf_resize(buf_t *p, size_t new_size);
+int buf_grow(buf_t *p, size_t data_size);
 buf_t *buf_reuse(buf_t *p);
+buf_t *buf_reuse_headroom(buf_t *p, size_t headroom);
+void buf_exchange(buf_t *p, uint8_t **buffer, size_t *size, size_t data_size);
 void *buf_reserve_begin(buf_t *p, size_t data_size);
 void *buf_reserve_end(buf_t *p, size_t data_size);
-void buf_insert_begin(buf_t *p, uint8_t *data, size_t data_size);
-void buf_insert_end(buf_t *p, uint8_t *data, size_t data_size);
+void buf_insert_begin(buf_t *p, const uint8_t *data, size_t data_size);
+void buf_insert_end(buf_t *p, const uint8_t *data, size_t data_size);
 void buf_remove_begin(buf_t *p, size_t data_size);
 void buf_remove_end(buf_t *p, size_t data_size);
 void buf_dump(buf_t *p, const char *label);
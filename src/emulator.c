@@ -0,0 +1,1375 @@
+/* emulator.c - software EX-word device used as an OBEX transport
+ *
+ * Copyright (C) 2010-2018 - Brian Johnson <brijohn@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ */
+
+/* The emulator answers the requests described in protocol.txt from a
+ * host directory. Each storage root is a sub directory of it:
+ *
+ *   <dir>/_INTERNAL_00	internal memory, created if missing
+ *   <dir>/_SD_00	SD card, only present if the directory exists
+ *   <dir>/<root>.key	authentication key of a storage root
+ *   <dir>/userid	last user id set
+ *
+ * The following environment variables change its behaviour:
+ *
+ *   EXWORD_EMULATOR_MODEL	model, sub model and capability strings
+ *				separated by spaces (see models.txt)
+ *   EXWORD_EMULATOR_FAULTS	comma separated list of faults to inject:
+ *				drop=n       drop every nth answer
+ *				drop_echo=n  drop every nth sequence echo
+ *				delay=us     delay each answer
+ *				unplug=n     disappear at the nth request
+ *				pad=n        add n description headers to
+ *				             each answer to a GET
+ *				cut=n        send only the first half of
+ *				             every nth answer
+ */
+
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <iconv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "obex.h"
+
+#if defined(__MINGW32__)
+# define mkdir(path, mode) _mkdir(path)
+#endif
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+#define EMU_DEFAULT_MODEL	"gy131,ON,0100 gy999 CY118"
+#define EMU_ADMINI_SIZE		180
+#define EMU_MAX_READS		8
+#define EMU_PAD_SIZE		64	/* Value bytes of a padding header */
+
+#define EMU_MODE_LIBRARY	0
+#define EMU_MODE_TEXT		1
+#define EMU_MODE_CD		2
+
+#define EMU_ROOT_INTERNAL	0
+#define EMU_ROOT_SD		1
+#define EMU_ROOTS		2
+
+static const char *emu_roots[EMU_ROOTS] = { "_INTERNAL_00", "_SD_00" };
+static const uint64_t emu_capacity[EMU_ROOTS] = {
+	100ULL * 1024 * 1024,
+	2048ULL * 1024 * 1024
+};
+
+enum emu_cmd {
+	EMU_FILE = 0,
+	EMU_MODEL,
+	EMU_LIST,
+	EMU_REMOVE,
+	EMU_CAP,
+	EMU_SDFORMAT,
+	EMU_USERID,
+	EMU_UNLOCK,
+	EMU_LOCK,
+	EMU_CNAME,
+	EMU_CRYPTKEY,
+	EMU_AUTHCHALLENGE,
+	EMU_AUTHINFO,
+};
+
+static const char *emu_cmds[] = {
+	NULL, "_Model", "_List", "_Remove", "_Cap", "_SdFormat", "_UserId",
+	"_Unlock", "_Lock", "_CName", "_CryptKey", "_AuthChallenge",
+	"_AuthInfo", NULL
+};
+
+struct emu_request {
+	const uint8_t *name;	/* UTF-16BE name, NULL if not sent */
+	unsigned int name_len;
+	const uint8_t *body;
+	unsigned int body_len;
+	const uint8_t *param;	/* CRYPTKEY or AUTHINFO value */
+	unsigned int param_len;
+};
+
+struct emulator {
+	char *base;		/* Host directory holding the storage roots */
+	int root;		/* Current storage root, -1 at the top level */
+	char *cwd;		/* Host directory of the current path */
+	int mode;
+	uint8_t locale;
+	uint16_t mtu;		/* Largest packet the host reads */
+	int authenticated;
+	int unlocked;
+	char cname_id[32];
+	char cname_name[132];
+	uint8_t cryptkey[16];
+	int have_cryptkey;
+	uint8_t model[64];
+	unsigned int model_len;
+	int cap24;		/* Answer _Cap in the 24 byte format */
+
+	struct obex_xfer *tx;	/* Submitted transfers */
+	struct obex_xfer *rx[EMU_MAX_READS];	/* Reads, oldest first */
+	int rx_count;
+	int last_seq;
+	uint8_t echo;
+	int echo_pending;
+	buf_t *reply;		/* Last answer, sent again for a repeated seq */
+	unsigned int reply_offset;
+	unsigned int reply_end;	/* Bytes of the answer that get sent */
+	int reply_pending;
+	int unplugged;
+
+	int put_active;		/* PUT spanning several packets */
+	enum emu_cmd put_cmd;
+	int put_fd;
+	buf_t *put_data;
+	int get_active;		/* GET spanning several packets */
+	int get_fd;
+	buf_t *get_data;
+	uint32_t get_len;
+	uint32_t get_sent;
+
+	unsigned int frames;	/* Requests seen, drives fault injection */
+	unsigned int drop;
+	unsigned int drop_echo;
+	unsigned int delay;
+	unsigned int unplug;
+	unsigned int pad;
+	unsigned int cut;
+};
+
+static char * emu_path(const char *dir, const char *name)
+{
+	char *path = malloc(strlen(dir) + strlen(name) + 2);
+	if (path != NULL)
+		sprintf(path, "%s/%s", dir, name);
+	return path;
+}
+
+static int emu_is_dir(const char *path)
+{
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static char * emu_iconv(const char *to, const char *from, const uint8_t *src,
+			size_t len, size_t *outlen)
+{
+	iconv_t cd;
+	char *in = (char *)src, *out, *dst;
+	size_t left = len, room = len * 2 + 4;
+
+	cd = iconv_open(to, from);
+	if (cd == (iconv_t) -1)
+		return NULL;
+	dst = out = malloc(room);
+	if (dst != NULL && iconv(cd, &in, &left, &out, &room) == (size_t) -1) {
+		free(dst);
+		dst = NULL;
+	}
+	iconv_close(cd);
+	if (dst != NULL) {
+		*outlen = out - dst;
+		memset(out, 0, room < 2 ? room : 2);
+	}
+	return dst;
+}
+
+/* Converts a string sent by the host to UTF-8 */
+static char * emu_string(const uint8_t *str, unsigned int len, int unicode)
+{
+	char *out;
+	size_t outlen;
+	if (unicode)
+		return emu_iconv("UTF-8", "UTF-16BE", str, len & ~1, &outlen);
+	out = malloc(len + 1);
+	if (out != NULL) {
+		memcpy(out, str, len);
+		out[len] = '\0';
+	}
+	return out;
+}
+
+/* Converts a name sent by the host to a host file name */
+static char * emu_name(const uint8_t *name, unsigned int len, int unicode)
+{
+	char *str = emu_string(name, len, unicode);
+	if (str == NULL)
+		return NULL;
+	if (strchr(str, '/') || strchr(str, '\\') ||
+	    strcmp(str, ".") == 0 || strcmp(str, "..") == 0) {
+		free(str);
+		return NULL;
+	}
+	return str;
+}
+
+static enum emu_cmd emu_lookup_cmd(const char *name)
+{
+	int i;
+	for (i = 1; emu_cmds[i] != NULL; i++) {
+		if (strcmp(name, emu_cmds[i]) == 0)
+			return i;
+	}
+	return EMU_FILE;
+}
+
+static int emu_read_file(const char *path, uint8_t *buffer, int size)
+{
+	int fd, len;
+	fd = open(path, O_RDONLY | O_BINARY);
+	if (fd < 0)
+		return -1;
+	len = read(fd, buffer, size);
+	close(fd);
+	return len;
+}
+
+static int emu_write_file(const char *path, const uint8_t *buffer, int size)
+{
+	int fd, len;
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+	if (fd < 0)
+		return -1;
+	len = write(fd, buffer, size);
+	close(fd);
+	return len == size ? 0 : -1;
+}
+
+static int emu_remove_tree(const char *path)
+{
+	DIR *dir;
+	struct dirent *entry;
+	struct stat st;
+	char *child;
+	int ret = 0;
+
+	if (lstat(path, &st) < 0)
+		return -1;
+	if (!S_ISDIR(st.st_mode))
+		return unlink(path);
+	dir = opendir(path);
+	if (dir == NULL)
+		return -1;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		child = emu_path(path, entry->d_name);
+		if (child == NULL || emu_remove_tree(child) < 0)
+			ret = -1;
+		free(child);
+	}
+	closedir(dir);
+	if (ret == 0)
+		ret = rmdir(path);
+	return ret;
+}
+
+static uint64_t emu_used(const char *path)
+{
+	DIR *dir;
+	struct dirent *entry;
+	struct stat st;
+	char *child;
+	uint64_t used = 0;
+
+	dir = opendir(path);
+	if (dir == NULL)
+		return 0;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		child = emu_path(path, entry->d_name);
+		if (child != NULL && lstat(child, &st) == 0) {
+			if (S_ISDIR(st.st_mode))
+				used += emu_used(child);
+			else
+				used += st.st_size;
+		}
+		free(child);
+	}
+	closedir(dir);
+	return used;
+}
+
+static const char * emu_admini_name(struct emulator *emu)
+{
+	if (emu->mode == EMU_MODE_CD)
+		return "sound.inf";
+	switch (emu->locale) {
+	case 0x40:
+		return "adminikr.inf";
+	case 0x60:
+		return "adminicn.inf";
+	case 0x80:
+		return "adminide.inf";
+	case 0xa0:
+		return "adminies.inf";
+	case 0xc0:
+		return "adminifr.inf";
+	case 0xe0:
+		return "adminiru.inf";
+	default:
+		return "admini.inf";
+	}
+}
+
+/* Adds or removes (key == NULL) the add-on id from the admini file */
+static int emu_admini_update(struct emulator *emu, const char *id,
+			     const uint8_t *key, const char *name)
+{
+	char *root, *path;
+	uint8_t *data;
+	struct stat st;
+	int len = 0, i, j, ret;
+
+	root = emu_path(emu->base, emu_roots[emu->root]);
+	path = root ? emu_path(root, emu_admini_name(emu)) : NULL;
+	free(root);
+	if (path == NULL)
+		return -1;
+	if (stat(path, &st) < 0)
+		st.st_size = 0;
+	data = malloc(st.st_size + EMU_ADMINI_SIZE);
+	if (data == NULL) {
+		free(path);
+		return -1;
+	}
+	if (st.st_size > 0)
+		len = emu_read_file(path, data, st.st_size);
+	if (len < 0)
+		len = 0;
+	len -= len % EMU_ADMINI_SIZE;
+	for (i = j = 0; i < len; i += EMU_ADMINI_SIZE) {
+		if (strncmp((char *)data + i, id, 32) == 0)
+			continue;
+		memmove(data + j, data + i, EMU_ADMINI_SIZE);
+		j += EMU_ADMINI_SIZE;
+	}
+	if (key != NULL) {
+		memset(data + j, 0, EMU_ADMINI_SIZE);
+		strncpy((char *)data + j, id, 31);
+		memcpy(data + j + 32, key, 16);
+		strncpy((char *)data + j + 48, name, 131);
+		j += EMU_ADMINI_SIZE;
+	}
+	if (j == 0)
+		ret = (unlink(path) < 0 && errno != ENOENT) ? -1 : 0;
+	else
+		ret = emu_write_file(path, data, j);
+	free(data);
+	free(path);
+	return ret;
+}
+
+static void emu_end_transfer(struct emulator *emu)
+{
+	if (emu->put_fd >= 0)
+		close(emu->put_fd);
+	if (emu->get_fd >= 0)
+		close(emu->get_fd);
+	emu->put_fd = emu->get_fd = -1;
+	emu->put_active = emu->get_active = 0;
+}
+
+static void emu_add_uint(buf_t *msg, uint8_t hi, uint32_t value)
+{
+	uint8_t *hdr = buf_reserve_end(msg, 5);
+	hdr[0] = hi;
+	value = htonl(value);
+	memcpy(hdr + 1, &value, 4);
+}
+
+/* Headers the host does not look for, returns the bytes added */
+static unsigned int emu_add_padding(struct emulator *emu, unsigned int room)
+{
+	unsigned int i, used = 0;
+	uint8_t *hdr;
+	for (i = 0; i < emu->pad && room - used > 2 * (EMU_PAD_SIZE + 3); i++) {
+		hdr = buf_reserve_end(emu->reply, EMU_PAD_SIZE + 3);
+		hdr[0] = OBEX_HDR_DESCRIPTION;
+		hdr[1] = (EMU_PAD_SIZE + 3) >> 8;
+		hdr[2] = (EMU_PAD_SIZE + 3) & 0xff;
+		memset(hdr + 3, i + 1, EMU_PAD_SIZE);
+		used += EMU_PAD_SIZE + 3;
+	}
+	return used;
+}
+
+static int emu_parse(const uint8_t *data, int len, struct emu_request *req)
+{
+	unsigned int hlen;
+	uint8_t hi;
+
+	memset(req, 0, sizeof(struct emu_request));
+	while (len > 0) {
+		hi = data[0];
+		switch (hi & OBEX_HDR_TYPE_MASK) {
+		case OBEX_HDR_TYPE_UINT8:
+			hlen = 2;
+			break;
+		case OBEX_HDR_TYPE_UINT32:
+			hlen = 5;
+			break;
+		default:
+			if (len < 3)
+				return -1;
+			hlen = (data[1] << 8) | data[2];
+			if (hlen < 3)
+				return -1;
+			break;
+		}
+		if (hlen > len)
+			return -1;
+		switch (hi) {
+		case OBEX_HDR_NAME:
+			req->name = data + 3;
+			req->name_len = hlen - 3;
+			break;
+		case OBEX_HDR_BODY:
+		case OBEX_HDR_BODY_END:
+			req->body = data + 3;
+			req->body_len = hlen - 3;
+			break;
+		case OBEX_HDR_CRYPTKEY:
+		case OBEX_HDR_AUTHINFO:
+			req->param = data + 3;
+			req->param_len = hlen - 3;
+			break;
+		}
+		data += hlen;
+		len -= hlen;
+	}
+	return 0;
+}
+
+static uint8_t emu_connect(struct emulator *emu, const uint8_t *data, int len)
+{
+	uint8_t nonhdr[8] = { 0x10, 0x00, 0x40, 0x06, 0x40, 0x00, 0x00, 0x00 };
+	uint8_t version;
+
+	if (len < sizeof(struct obex_connect_hdr))
+		return OBEX_RSP_BAD_REQUEST | OBEX_FINAL;
+	version = data[0];
+	emu->mtu = (data[2] << 8) | data[3];
+	if (emu->mtu < OBEX_MINIMUM_MTU)
+		emu->mtu = OBEX_MINIMUM_MTU;
+	emu->locale = data[6];
+	if (version == 0xf0)
+		emu->mode = EMU_MODE_CD;
+	else if (version == emu->locale)
+		emu->mode = EMU_MODE_TEXT;
+	else
+		emu->mode = EMU_MODE_LIBRARY;
+	emu->authenticated = (emu->mode != EMU_MODE_LIBRARY);
+	nonhdr[6] = emu->locale;
+	buf_insert_end(emu->reply, nonhdr, sizeof(nonhdr));
+	return OBEX_RSP_SUCCESS | OBEX_FINAL;
+}
+
+static uint8_t emu_setpath(struct emulator *emu, const uint8_t *data, int len)
+{
+	struct emu_request req;
+	char *path, *p, *name, *dir;
+	int create, root = -1;
+	uint8_t rsp = OBEX_RSP_SUCCESS | OBEX_FINAL;
+
+	if (len < 2 || emu_parse(data + 2, len - 2, &req) < 0)
+		return OBEX_RSP_BAD_REQUEST | OBEX_FINAL;
+	create = !(data[0] & 0x02);
+	if (req.name == NULL || req.name_len == 0) {
+		free(emu->cwd);
+		emu->cwd = NULL;
+		emu->root = -1;
+		return rsp;
+	}
+	path = emu_string(req.name, req.name_len, 1);
+	if (path == NULL)
+		return OBEX_RSP_BAD_REQUEST | OBEX_FINAL;
+	dir = NULL;
+	for (p = path; p != NULL && rsp == (OBEX_RSP_SUCCESS | OBEX_FINAL); ) {
+		name = p;
+		p = strchr(p, '\\');
+		if (p != NULL)
+			*p++ = '\0';
+		if (*name == '\0')
+			continue;
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+			rsp = OBEX_RSP_NOT_FOUND | OBEX_FINAL;
+			break;
+		}
+		if (dir == NULL) {
+			for (root = 0; root < EMU_ROOTS; root++) {
+				if (strcmp(name, emu_roots[root]) == 0)
+					break;
+			}
+			if (root >= EMU_ROOTS) {
+				rsp = OBEX_RSP_NOT_FOUND | OBEX_FINAL;
+				break;
+			}
+			dir = emu_path(emu->base, name);
+			if (dir == NULL || !emu_is_dir(dir))
+				rsp = OBEX_RSP_NOT_FOUND | OBEX_FINAL;
+		} else {
+			char *next = emu_path(dir, name);
+			free(dir);
+			dir = next;
+			if (dir == NULL || (!emu_is_dir(dir) && (!create || mkdir(dir, 0755) < 0)))
+				rsp = OBEX_RSP_NOT_FOUND | OBEX_FINAL;
+		}
+	}
+	free(path);
+	if (dir == NULL && rsp == (OBEX_RSP_SUCCESS | OBEX_FINAL))
+		rsp = OBEX_RSP_NOT_FOUND | OBEX_FINAL;
+	if (rsp != (OBEX_RSP_SUCCESS | OBEX_FINAL)) {
+		free(dir);
+		return rsp;
+	}
+	free(emu->cwd);
+	emu->cwd = dir;
+	emu->root = root;
+	return rsp;
+}
+
+static int emu_list_entry(buf_t *msg, const char *name, int is_dir)
+{
+	const uint8_t *p;
+	char *unicode = NULL;
+	uint8_t *entry;
+	size_t len = strlen(name) + 1;
+	uint8_t flags = is_dir ? 1 : 0;
+
+	for (p = (const uint8_t *)name; *p; p++) {
+		if (*p >= 0x80)
+			break;
+	}
+	if (*p) {
+		unicode = emu_iconv("UTF-16BE", "UTF-8", (const uint8_t *)name, len - 1, &len);
+		if (unicode == NULL)
+			return -1;
+		len += 2;
+		flags |= 2;
+		name = unicode;
+	}
+	entry = buf_reserve_end(msg, len + 3);
+	entry[0] = (len + 3) >> 8;
+	entry[1] = (len + 3) & 0xff;
+	entry[2] = flags;
+	memcpy(entry + 3, name, len);
+	free(unicode);
+	return 0;
+}
+
+static uint8_t emu_list(struct emulator *emu, buf_t *msg)
+{
+	DIR *dir;
+	struct dirent *entry;
+	char *path;
+	uint16_t count = 0;
+	int i;
+
+	buf_reserve_end(msg, 2);
+	if (emu->root < 0) {
+		for (i = 0; i < EMU_ROOTS; i++) {
+			path = emu_path(emu->base, emu_roots[i]);
+			if (path != NULL && emu_is_dir(path) &&
+			    emu_list_entry(msg, emu_roots[i], 1) == 0)
+				count++;
+			free(path);
+		}
+	} else {
+		dir = opendir(emu->cwd);
+		if (dir == NULL)
+			return OBEX_RSP_NOT_FOUND | OBEX_FINAL;
+		while ((entry = readdir(dir)) != NULL) {
+			if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+				continue;
+			path = emu_path(emu->cwd, entry->d_name);
+			if (path != NULL && emu_list_entry(msg, entry->d_name, emu_is_dir(path)) == 0)
+				count++;
+			free(path);
+		}
+		closedir(dir);
+	}
+	msg->data[0] = count >> 8;
+	msg->data[1] = count & 0xff;
+	/* Listing also unlocks the commands that need authentication */
+	emu->authenticated = 1;
+	return OBEX_RSP_SUCCESS | OBEX_FINAL;
+}
+
+static uint8_t emu_capacity_info(struct emulator *emu, buf_t *msg)
+{
+	uint64_t total, used, free_space;
+	uint32_t v[6];
+	char *path;
+
+	if (emu->root < 0)
+		return OBEX_RSP_NOT_FOUND | OBEX_FINAL;
+	path = emu_path(emu->base, emu_roots[emu->root]);
+	if (path == NULL)
+		return OBEX_RSP_INTERNAL_SERVER_ERROR | OBEX_FINAL;
+	used = emu_used(path);
+	free(path);
+	total = emu_capacity[emu->root];
+	free_space = used < total ? total - used : 0;
+	if (emu->cap24) {
+		v[0] = v[1] = 0;
+		v[2] = htonl(total >> 32);
+		v[3] = htonl(total & 0xffffffff);
+		v[4] = htonl(free_space >> 32);
+		v[5] = htonl(free_space & 0xffffffff);
+		buf_insert_end(msg, (uint8_t *)v, 24);
+	} else {
+		v[0] = htonl(total);
+		v[1] = htonl(free_space);
+		buf_insert_end(msg, (uint8_t *)v, 8);
+	}
+	return OBEX_RSP_SUCCESS | OBEX_FINAL;
+}
+
+static uint8_t emu_cryptkey(struct emulator *emu, const uint8_t *b, unsigned int len, buf_t *msg)
+{
+	int i;
+	if (len < 28)
+		return OBEX_RSP_BAD_REQUEST | OBEX_FINAL;
+	for (i = 0; i < 12; i++)
+		emu->cryptkey[i] = b[i] + ((i >= 2 && i < 10) ? b[i + 14] : 0);
+	memcpy(emu->cryptkey + 12, b + 24, 4);
+	emu->have_cryptkey = 1;
+	buf_insert_end(msg, emu->cryptkey, 12);
+	return OBEX_RSP_SUCCESS | OBEX_FINAL;
+}
+
+static char * emu_key_path(struct emulator *emu)
+{
+	char name[32];
+	sprintf(name, "%s.key", emu_roots[emu->root < 0 ? EMU_ROOT_INTERNAL : emu->root]);
+	return emu_path(emu->base, name);
+}
+
+/* Registers a new user, this removes every installed add-on */
+static uint8_t emu_authinfo(struct emulator *emu, const uint8_t *b, unsigned int len, buf_t *msg)
+{
+	uint8_t key[20];
+	uint8_t *data;
+	char *path, *root, *dir;
+	int i, size;
+
+	if (len < 40)
+		return OBEX_RSP_BAD_REQUEST | OBEX_FINAL;
+	for (i = 0; i < 20; i++)
+		key[i] = b[i] ^ b[i + 20] ^ (0x5a + 7 * i);
+	path = emu_key_path(emu);
+	if (path == NULL || emu_write_file(path, key, 20) < 0) {
+		free(path);
+		return OBEX_RSP_INTERNAL_SERVER_ERROR | OBEX_FINAL;
+	}
+	free(path);
+	if (emu->root >= 0) {
+		root = emu_path(emu->base, emu_roots[emu->root]);
+		path = root ? emu_path(root, emu_admini_name(emu)) : NULL;
+		data = malloc(64 * EMU_ADMINI_SIZE);
+		size = (path && data) ? emu_read_file(path, data, 64 * EMU_ADMINI_SIZE) : -1;
+		for (i = 0; i + EMU_ADMINI_SIZE <= size; i += EMU_ADMINI_SIZE) {
+			data[i + 31] = '\0';
+			dir = emu_name(data + i, strlen((char *)data + i), 0);
+			if (dir != NULL && *dir) {
+				char *tree = emu_path(root, dir);
+				if (tree != NULL)
+					emu_remove_tree(tree);
+				free(tree);
+			}
+			free(dir);
+		}
+		if (path != NULL)
+			unlink(path);
+		free(data);
+		free(path);
+		free(root);
+	}
+	emu->authenticated = 1;
+	buf_insert_end(msg, key, 20);
+	return OBEX_RSP_SUCCESS | OBEX_FINAL;
+}
+
+static uint8_t emu_authchallenge(struct emulator *emu, const uint8_t *b, unsigned int len)
+{
+	uint8_t key[20];
+	char *path;
+	int size;
+
+	if (len != 20)
+		return OBEX_RSP_BAD_REQUEST | OBEX_FINAL;
+	path = emu_key_path(emu);
+	if (path == NULL)
+		return OBEX_RSP_INTERNAL_SERVER_ERROR | OBEX_FINAL;
+	size = emu_read_file(path, key, 20);
+	free(path);
+	/* A storage root without a key accepts any user */
+	if (size == 20 && memcmp(key, b, 20) != 0)
+		return OBEX_RSP_FORBIDDEN | OBEX_FINAL;
+	emu->authenticated = 1;
+	return OBEX_RSP_SUCCESS | OBEX_FINAL;
+}
+
+static uint8_t emu_remove(struct emulator *emu, const uint8_t *b, unsigned int len)
+{
+	struct stat st;
+	char *name, *path;
+	uint8_t rsp = OBEX_RSP_SUCCESS | OBEX_FINAL;
+
+	if (emu->root < 0)
+		return OBEX_RSP_NOT_FOUND | OBEX_FINAL;
+	/* Dataplus 5 models send the name as UTF-16 in text mode */
+	if (len >= 2 && b[0] == 0)
+		name = emu_name(b, len, 1);
+	else
+		name = emu_name(b, strnlen((const char *)b, len), 0);
+	if (name == NULL)
+		return OBEX_RSP_BAD_REQUEST | OBEX_FINAL;
+	path = emu_path(emu->cwd, name);
+	if (path == NULL || lstat(path, &st) < 0) {
+		rsp = OBEX_RSP_NOT_FOUND | OBEX_FINAL;
+	} else if (S_ISDIR(st.st_mode)) {
+		if (emu->unlocked && strcmp(name, emu->cname_id) == 0) {
+			if (emu_remove_tree(path) < 0 ||
+			    emu_admini_update(emu, name, NULL, NULL) < 0)
+				rsp = OBEX_RSP_INTERNAL_SERVER_ERROR | OBEX_FINAL;
+		} else if (rmdir(path) < 0) {
+			rsp = OBEX_RSP_FORBIDDEN | OBEX_FINAL;
+		}
+	} else if (unlink(path) < 0) {
+		rsp = OBEX_RSP_FORBIDDEN | OBEX_FINAL;
+	}
+	free(path);
+	free(name);
+	return rsp;
+}
+
+static uint8_t emu_sdformat(struct emulator *emu)
+{
+	DIR *dir;
+	struct dirent *entry;
+	char *sd, *path;
+	uint8_t rsp = OBEX_RSP_SUCCESS | OBEX_FINAL;
+
+	sd = emu_path(emu->base, emu_roots[EMU_ROOT_SD]);
+	if (sd == NULL || (dir = opendir(sd)) == NULL) {
+		free(sd);
+		return OBEX_RSP_NOT_FOUND | OBEX_FINAL;
+	}
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		path = emu_path(sd, entry->d_name);
+		if (path == NULL || emu_remove_tree(path) < 0)
+			rsp = OBEX_RSP_INTERNAL_SERVER_ERROR | OBEX_FINAL;
+		free(path);
+	}
+	closedir(dir);
+	if (emu->root == EMU_ROOT_SD) {
+		free(emu->cwd);
+		emu->cwd = sd;
+	} else {
+		free(sd);
+	}
+	return rsp;
+}
+
+static uint8_t emu_lock(struct emulator *emu)
+{
+	char *root, *path;
+	uint8_t rsp = OBEX_RSP_SUCCESS | OBEX_FINAL;
+
+	/* Locking after an add-on was copied registers it */
+	if (emu->unlocked && emu->have_cryptkey && emu->cname_id[0] && emu->root >= 0) {
+		root = emu_path(emu->base, emu_roots[emu->root]);
+		path = root ? emu_path(root, emu->cname_id) : NULL;
+		if (path != NULL && emu_is_dir(path) &&
+		    emu_admini_update(emu, emu->cname_id, emu->cryptkey, emu->cname_name) < 0)
+			rsp = OBEX_RSP_INTERNAL_SERVER_ERROR | OBEX_FINAL;
+		free(path);
+		free(root);
+	}
+	emu->unlocked = 0;
+	emu->have_cryptkey = 0;
+	emu->cname_id[0] = '\0';
+	return rsp;
+}
+
+static uint8_t emu_put_cmd(struct emulator *emu)
+{
+	const uint8_t *body = emu->put_data->data;
+	unsigned int len = emu->put_data->data_size;
+	unsigned int id_len;
+	char *path;
+
+	switch (emu->put_cmd) {
+	case EMU_REMOVE:
+		return emu_remove(emu, body, len);
+	case EMU_SDFORMAT:
+		return emu_sdformat(emu);
+	case EMU_USERID:
+		path = emu_path(emu->base, "userid");
+		if (path == NULL || emu_write_file(path, body, len) < 0) {
+			free(path);
+			return OBEX_RSP_INTERNAL_SERVER_ERROR | OBEX_FINAL;
+		}
+		free(path);
+		return OBEX_RSP_SUCCESS | OBEX_FINAL;
+	case EMU_UNLOCK:
+		emu->unlocked = 1;
+		emu->have_cryptkey = 0;
+		emu->cname_id[0] = '\0';
+		return OBEX_RSP_SUCCESS | OBEX_FINAL;
+	case EMU_LOCK:
+		return emu_lock(emu);
+	case EMU_CNAME:
+		if (!emu->unlocked)
+			return OBEX_RSP_FORBIDDEN | OBEX_FINAL;
+		id_len = strnlen((const char *)body, len);
+		if (id_len == 0 || id_len >= sizeof(emu->cname_id) || id_len >= len)
+			return OBEX_RSP_BAD_REQUEST | OBEX_FINAL;
+		memcpy(emu->cname_id, body, id_len + 1);
+		len -= id_len + 1;
+		body += id_len + 1;
+		len = strnlen((const char *)body, len);
+		if (len >= sizeof(emu->cname_name))
+			len = sizeof(emu->cname_name) - 1;
+		memcpy(emu->cname_name, body, len);
+		emu->cname_name[len] = '\0';
+		return OBEX_RSP_SUCCESS | OBEX_FINAL;
+	case EMU_AUTHCHALLENGE:
+		return emu_authchallenge(emu, body, len);
+	default:
+		return OBEX_RSP_BAD_REQUEST | OBEX_FINAL;
+	}
+}
+
+static uint8_t emu_put(struct emulator *emu, int final, const uint8_t *data, int len)
+{
+	struct emu_request req;
+	char *name, *path;
+
+	if (emu_parse(data, len, &req) < 0)
+		return OBEX_RSP_BAD_REQUEST | OBEX_FINAL;
+	if (req.name != NULL) {
+		emu_end_transfer(emu);
+		name = emu_name(req.name, req.name_len, 1);
+		if (name == NULL)
+			return OBEX_RSP_BAD_REQUEST | OBEX_FINAL;
+		emu->put_cmd = emu_lookup_cmd(name);
+		if (emu->put_cmd == EMU_FILE) {
+			if (emu->root < 0) {
+				free(name);
+				return OBEX_RSP_NOT_FOUND | OBEX_FINAL;
+			}
+			if (!emu->authenticated) {
+				free(name);
+				return OBEX_RSP_FORBIDDEN | OBEX_FINAL;
+			}
+			path = emu_path(emu->cwd, name);
+			emu->put_fd = path ? open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644) : -1;
+			free(path);
+			if (emu->put_fd < 0) {
+				free(name);
+				return OBEX_RSP_FORBIDDEN | OBEX_FINAL;
+			}
+		} else if (!emu->authenticated && emu->put_cmd != EMU_AUTHCHALLENGE &&
+			   emu->put_cmd != EMU_USERID) {
+			free(name);
+			return OBEX_RSP_FORBIDDEN | OBEX_FINAL;
+		}
+		free(name);
+		buf_reuse(emu->put_data);
+		emu->put_active = 1;
+	} else if (!emu->put_active) {
+		return OBEX_RSP_BAD_REQUEST | OBEX_FINAL;
+	}
+
+	if (req.body_len) {
+		if (emu->put_cmd == EMU_FILE) {
+			if (write(emu->put_fd, req.body, req.body_len) != (ssize_t)req.body_len) {
+				emu_end_transfer(emu);
+				return OBEX_RSP_DATABASE_FULL | OBEX_FINAL;
+			}
+		} else {
+			buf_insert_end(emu->put_data, req.body, req.body_len);
+		}
+	}
+	if (!final)
+		return OBEX_RSP_CONTINUE | OBEX_FINAL;
+
+	emu_end_transfer(emu);
+	if (emu->put_cmd == EMU_FILE)
+		return OBEX_RSP_SUCCESS | OBEX_FINAL;
+	return emu_put_cmd(emu);
+}
+
+/* Sends the next part of the object being retrieved */
+static uint8_t emu_get_next(struct emulator *emu)
+{
+	unsigned int room = emu->mtu - sizeof(struct obex_rsp_hdr) - 3;
+	unsigned int left, n;
+	uint8_t *body;
+	int final, ret;
+
+	if (emu->get_sent == 0) {
+		emu_add_uint(emu->reply, OBEX_HDR_LENGTH, emu->get_len);
+		room -= 5;
+	}
+	room -= emu_add_padding(emu, room);
+	left = emu->get_len - emu->get_sent;
+	final = left <= room;
+	n = final ? left : room;
+	body = buf_reserve_end(emu->reply, n + 3);
+	body[0] = final ? OBEX_HDR_BODY_END : OBEX_HDR_BODY;
+	body[1] = (n + 3) >> 8;
+	body[2] = (n + 3) & 0xff;
+	if (emu->get_fd >= 0) {
+		for (left = 0; left < n; left += ret) {
+			ret = read(emu->get_fd, body + 3 + left, n - left);
+			if (ret <= 0) {
+				emu_end_transfer(emu);
+				buf_reuse(emu->reply);
+				buf_reserve_end(emu->reply, sizeof(struct obex_rsp_hdr));
+				return OBEX_RSP_INTERNAL_SERVER_ERROR | OBEX_FINAL;
+			}
+		}
+	} else {
+		memcpy(body + 3, emu->get_data->data + emu->get_sent, n);
+	}
+	emu->get_sent += n;
+	if (!final)
+		return OBEX_RSP_CONTINUE | OBEX_FINAL;
+	emu_end_transfer(emu);
+	return OBEX_RSP_SUCCESS | OBEX_FINAL;
+}
+
+static uint8_t emu_get(struct emulator *emu, const uint8_t *data, int len)
+{
+	struct emu_request req;
+	struct stat st;
+	enum emu_cmd cmd;
+	char *name, *path;
+	uint8_t rsp;
+
+	if (emu_parse(data, len, &req) < 0)
+		return OBEX_RSP_BAD_REQUEST | OBEX_FINAL;
+	if (req.name == NULL) {
+		if (!emu->get_active)
+			return OBEX_RSP_BAD_REQUEST | OBEX_FINAL;
+		return emu_get_next(emu);
+	}
+	emu_end_transfer(emu);
+	name = emu_name(req.name, req.name_len, 1);
+	if (name == NULL)
+		return OBEX_RSP_BAD_REQUEST | OBEX_FINAL;
+	cmd = emu_lookup_cmd(name);
+	buf_reuse(emu->get_data);
+	if (!emu->authenticated && (cmd == EMU_FILE || cmd == EMU_CAP || cmd == EMU_CRYPTKEY)) {
+		free(name);
+		return OBEX_RSP_FORBIDDEN | OBEX_FINAL;
+	}
+	switch (cmd) {
+	case EMU_MODEL:
+		buf_insert_end(emu->get_data, emu->model, emu->model_len);
+		rsp = OBEX_RSP_SUCCESS | OBEX_FINAL;
+		break;
+	case EMU_LIST:
+		rsp = emu_list(emu, emu->get_data);
+		break;
+	case EMU_CAP:
+		rsp = emu_capacity_info(emu, emu->get_data);
+		break;
+	case EMU_CRYPTKEY:
+		rsp = emu_cryptkey(emu, req.param, req.param_len, emu->get_data);
+		break;
+	case EMU_AUTHINFO:
+		rsp = emu_authinfo(emu, req.param, req.param_len, emu->get_data);
+		break;
+	case EMU_FILE:
+		rsp = OBEX_RSP_NOT_FOUND | OBEX_FINAL;
+		if (emu->root < 0)
+			break;
+		path = emu_path(emu->cwd, name);
+		if (path != NULL && stat(path, &st) == 0 && S_ISREG(st.st_mode))
+			emu->get_fd = open(path, O_RDONLY | O_BINARY);
+		free(path);
+		if (emu->get_fd < 0)
+			break;
+		emu->get_len = st.st_size;
+		rsp = OBEX_RSP_SUCCESS | OBEX_FINAL;
+		break;
+	default:
+		rsp = OBEX_RSP_BAD_REQUEST | OBEX_FINAL;
+		break;
+	}
+	free(name);
+	if (rsp != (OBEX_RSP_SUCCESS | OBEX_FINAL))
+		return rsp;
+	if (emu->get_fd < 0)
+		emu->get_len = emu->get_data->data_size;
+	emu->get_sent = 0;
+	emu->get_active = 1;
+	return emu_get_next(emu);
+}
+
+static void emu_queue_answer(struct emulator *emu, uint8_t seq)
+{
+	emu->echo = seq;
+	emu->echo_pending = 1;
+	emu->reply_pending = 1;
+	emu->reply_offset = 0;
+	emu->reply_end = emu->reply->data_size;
+	if (emu->cut && emu->frames % emu->cut == 0)
+		emu->reply_end /= 2;
+	if (emu->drop && emu->frames % emu->drop == 0)
+		emu->echo_pending = emu->reply_pending = 0;
+	if (emu->drop_echo && emu->frames % emu->drop_echo == 0)
+		emu->echo_pending = 0;
+}
+
+static void emu_frame(struct obex_transport *trans, struct emulator *emu,
+		      const uint8_t *frame, int length)
+{
+	const uint8_t *data = frame + sizeof(struct obex_common_hdr);
+	int len = length - sizeof(struct obex_common_hdr);
+	uint8_t seq, opcode, rsp;
+
+	if (length < sizeof(struct obex_common_hdr) ||
+	    ((frame[2] << 8) | frame[3]) + 1 != length)
+		return;
+	seq = frame[0];
+	opcode = frame[1];
+	emu->frames++;
+	if (emu->unplug && emu->frames >= emu->unplug) {
+		emu->unplugged = 1;
+		trans->link_lost = 1;
+		return;
+	}
+	/* A repeated request is answered again without running it twice */
+	if (emu->last_seq == seq) {
+		emu_queue_answer(emu, seq);
+		return;
+	}
+	emu->last_seq = seq;
+
+	buf_reuse(emu->reply);
+	buf_reserve_end(emu->reply, sizeof(struct obex_rsp_hdr));
+	switch (opcode & ~OBEX_FINAL) {
+	case OBEX_CMD_CONNECT:
+		emu_end_transfer(emu);
+		rsp = emu_connect(emu, data, len);
+		break;
+	case OBEX_CMD_DISCONNECT:
+		emu_end_transfer(emu);
+		rsp = OBEX_RSP_SUCCESS | OBEX_FINAL;
+		break;
+	case OBEX_CMD_SETPATH:
+		emu_end_transfer(emu);
+		rsp = emu_setpath(emu, data, len);
+		break;
+	case OBEX_CMD_PUT:
+		rsp = emu_put(emu, opcode & OBEX_FINAL, data, len);
+		break;
+	case OBEX_CMD_GET:
+		rsp = emu_get(emu, data, len);
+		break;
+	default:
+		rsp = OBEX_RSP_NOT_IMPLEMENTED | OBEX_FINAL;
+		break;
+	}
+	emu->reply->data[0] = rsp;
+	emu->reply->data[1] = emu->reply->data_size >> 8;
+	emu->reply->data[2] = emu->reply->data_size & 0xff;
+	emu_queue_answer(emu, seq);
+}
+
+static void emu_complete(struct obex_xfer *xfer, int status, int actual_length)
+{
+	xfer->status = status;
+	xfer->actual_length = actual_length;
+	xfer->completed = 1;
+	if (xfer->callback)
+		xfer->callback(xfer);
+}
+
+static struct obex_xfer * emu_pop_read(struct emulator *emu)
+{
+	struct obex_xfer *xfer = emu->rx[0];
+	emu->rx_count--;
+	memmove(emu->rx, emu->rx + 1, emu->rx_count * sizeof(emu->rx[0]));
+	return xfer;
+}
+
+static void emu_deliver(struct emulator *emu, struct obex_xfer *xfer)
+{
+	unsigned int n;
+	if (emu->echo_pending) {
+		emu->echo_pending = 0;
+		xfer->buffer[0] = emu->echo;
+		emu_complete(xfer, OBEX_XFER_OK, 1);
+		return;
+	}
+	if (emu->delay && emu->reply_offset == 0)
+		usleep(emu->delay);
+	n = emu->reply_end - emu->reply_offset;
+	if (n > xfer->length)
+		n = xfer->length;
+	memcpy(xfer->buffer, emu->reply->data + emu->reply_offset, n);
+	emu->reply_offset += n;
+	if (emu->reply_offset >= emu->reply_end)
+		emu->reply_pending = 0;
+	emu_complete(xfer, OBEX_XFER_OK, n);
+}
+
+/* Copies up to max characters of str into the zeroed field dst */
+static void emu_copy_field(uint8_t *dst, const char *str, size_t max)
+{
+	size_t len = strlen(str);
+	memcpy(dst, str, len < max ? len : max);
+}
+
+static void emu_parse_model(struct emulator *emu, const char *str)
+{
+	char token[32];
+	unsigned int pos = 23;
+	int i = 0, n;
+
+	memset(emu->model, 0, sizeof(emu->model));
+	emu->cap24 = 0;
+	while (sscanf(str, "%31s%n", token, &n) == 1) {
+		str += n;
+		if (i == 0) {
+			emu_copy_field(emu->model, token, 13);
+		} else if (i == 1) {
+			emu_copy_field(emu->model + 14, token, 5);
+		} else if (pos + strlen(token) + 1 <= sizeof(emu->model)) {
+			strcpy((char *)emu->model + pos, token);
+			pos += strlen(token) + 1;
+			/* Dataplus 5 and later report 64 bit capacities */
+			if (strncmp(token, "CY", 2) == 0)
+				emu->cap24 = 1;
+		}
+		i++;
+	}
+	emu->model_len = pos;
+}
+
+static void emu_parse_faults(struct emulator *emu, const char *str)
+{
+	unsigned int value;
+	char name[16];
+	int n;
+
+	while (sscanf(str, " %15[a-z_]=%u%n", name, &value, &n) == 2) {
+		if (strcmp(name, "drop") == 0)
+			emu->drop = value;
+		else if (strcmp(name, "drop_echo") == 0)
+			emu->drop_echo = value;
+		else if (strcmp(name, "delay") == 0)
+			emu->delay = value;
+		else if (strcmp(name, "unplug") == 0)
+			emu->unplug = value;
+		else if (strcmp(name, "pad") == 0)
+			emu->pad = value;
+		else if (strcmp(name, "cut") == 0)
+			emu->cut = value;
+		str += n;
+		if (*str != ',')
+			break;
+		str++;
+	}
+}
+
+static int emu_open(struct obex_transport *trans, void *args)
+{
+	struct emulator *emu;
+	const char *env;
+	char *path;
+
+	if (args == NULL || !emu_is_dir(args))
+		return OBEX_XFER_NO_DEVICE;
+	emu = malloc(sizeof(struct emulator));
+	if (emu == NULL)
+		return OBEX_XFER_ERROR;
+	memset(emu, 0, sizeof(struct emulator));
+	emu->base = strdup(args);
+	emu->reply = buf_new(OBEX_DEFAULT_MTU);
+	emu->put_data = buf_new(64);
+	emu->get_data = buf_new(OBEX_DEFAULT_MTU);
+	path = emu->base ? emu_path(emu->base, emu_roots[EMU_ROOT_INTERNAL]) : NULL;
+	if (path == NULL || emu->reply == NULL || emu->put_data == NULL ||
+	    emu->get_data == NULL || (!emu_is_dir(path) && mkdir(path, 0755) < 0)) {
+		free(path);
+		buf_free(emu->reply);
+		buf_free(emu->put_data);
+		buf_free(emu->get_data);
+		free(emu->base);
+		free(emu);
+		return OBEX_XFER_ERROR;
+	}
+	free(path);
+	emu->root = -1;
+	emu->mtu = OBEX_DEFAULT_MTU;
+	emu->last_seq = -1;
+	emu->put_fd = emu->get_fd = -1;
+	env = getenv("EXWORD_EMULATOR_MODEL");
+	emu_parse_model(emu, env ? env : EMU_DEFAULT_MODEL);
+	env = getenv("EXWORD_EMULATOR_FAULTS");
+	if (env != NULL)
+		emu_parse_faults(emu, env);
+	trans->data = emu;
+	trans->link_lost = 0;
+	return 0;
+}
+
+static void emu_close(struct obex_transport *trans)
+{
+	struct emulator *emu = trans->data;
+	if (emu == NULL)
+		return;
+	emu_end_transfer(emu);
+	buf_free(emu->reply);
+	buf_free(emu->put_data);
+	buf_free(emu->get_data);
+	free(emu->cwd);
+	free(emu->base);
+	free(emu);
+	trans->data = NULL;
+}
+
+static int emu_write(struct obex_transport *trans, struct obex_xfer *xfer)
+{
+	struct emulator *emu = trans->data;
+	if (emu->unplugged)
+		return OBEX_XFER_NO_DEVICE;
+	if (emu->tx != NULL)
+		return OBEX_XFER_ERROR;
+	xfer->completed = 0;
+	xfer->actual_length = 0;
+	emu->tx = xfer;
+	return 0;
+}
+
+static int emu_read(struct obex_transport *trans, struct obex_xfer *xfer)
+{
+	struct emulator *emu = trans->data;
+	if (emu->unplugged)
+		return OBEX_XFER_NO_DEVICE;
+	if (emu->rx_count >= EMU_MAX_READS)
+		return OBEX_XFER_ERROR;
+	xfer->completed = 0;
+	xfer->actual_length = 0;
+	emu->rx[emu->rx_count++] = xfer;
+	return 0;
+}
+
+static int emu_cancel(struct obex_transport *trans, struct obex_xfer *xfer)
+{
+	struct emulator *emu = trans->data;
+	int i;
+	if (emu->tx == xfer) {
+		emu->tx = NULL;
+	} else {
+		for (i = 0; i < emu->rx_count && emu->rx[i] != xfer; i++)
+			;
+		if (i == emu->rx_count)
+			return 0;
+		emu->rx_count--;
+		memmove(emu->rx + i, emu->rx + i + 1, (emu->rx_count - i) * sizeof(emu->rx[0]));
+	}
+	emu_complete(xfer, OBEX_XFER_CANCELLED, 0);
+	return 0;
+}
+
+static void emu_release(struct obex_transport *trans, struct obex_xfer *xfer)
+{
+}
+
+static int emu_handle_events(struct obex_transport *trans, struct timeval *tv, int *completed)
+{
+	struct emulator *emu = trans->data;
+	struct obex_xfer *xfer;
+	int progress;
+
+	do {
+		progress = 0;
+		/* Like the device a new packet is only taken once the
+		   answer to the previous one has been read */
+		if (emu->tx != NULL && !emu->echo_pending && !emu->reply_pending) {
+			xfer = emu->tx;
+			emu->tx = NULL;
+			emu_frame(trans, emu, xfer->buffer, xfer->length);
+			emu_complete(xfer, OBEX_XFER_OK, xfer->length);
+			progress = 1;
+		}
+		if (emu->rx_count > 0 && (emu->echo_pending || emu->reply_pending)) {
+			xfer = emu_pop_read(emu);
+			emu_deliver(emu, xfer);
+			progress = 1;
+		}
+		if (completed != NULL && *completed)
+			return 0;
+	} while (progress);
+
+	/* Nothing more will arrive, a read somebody waits for times out
+	   at once instead of waiting for the timeout of a real device. */
+	if (completed != NULL && emu->rx_count > 0) {
+		xfer = emu_pop_read(emu);
+		emu_complete(xfer, emu->unplugged ? OBEX_XFER_NO_DEVICE : OBEX_XFER_TIMEOUT, 0);
+	} else if (completed != NULL && emu->tx != NULL) {
+		xfer = emu->tx;
+		emu->tx = NULL;
+		emu_complete(xfer, OBEX_XFER_TIMEOUT, 0);
+	}
+	return 0;
+}
+
+static int emu_get_pollfds(struct obex_transport *trans, struct obex_pollfd *fds, int nfds)
+{
+	return 0;
+}
+
+static int emu_get_timeout(struct obex_transport *trans, struct timeval *tv)
+{
+	return 0;
+}
+
+const struct obex_transport_ops emulator_transport_ops = {
+	.open = emu_open,
+	.close = emu_close,
+	.write = emu_write,
+	.read = emu_read,
+	.cancel = emu_cancel,
+	.release = emu_release,
+	.handle_events = emu_handle_events,
+	.get_pollfds = emu_get_pollfds,
+	.get_timeout = emu_get_timeout,
+};
@@ -0,0 +1,155 @@
+/* exword-trace.c - displays trace files written by libexword
+ *
+ * Copyright (C) 2010-2018 - Brian Johnson <brijohn@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+
+static const char *event_names[] = {
+	NULL,
+	"request",
+	"done",
+	"retry",
+	"pipeline-off",
+	"answer-lost",
+	"send",
+	"send-ahead",
+	"receive",
+	"seq-ok",
+	"seq-mismatch",
+	"seq-error",
+};
+
+static const char * opcode_name(uint8_t opcode)
+{
+	switch (opcode & 0x7f) {
+	case 0x00: return "connect";
+	case 0x01: return "disconnect";
+	case 0x02: return "put";
+	case 0x03: return "get";
+	case 0x05: return "setpath";
+	default: return "unknown";
+	}
+}
+
+static void print_record(struct obex_trace_rec *rec)
+{
+	const char *name = "unknown";
+	int32_t value = rec->value;
+
+	if (rec->event < sizeof(event_names) / sizeof(event_names[0]) && event_names[rec->event])
+		name = event_names[rec->event];
+	printf("%6"PRIu64".%06"PRIu64" %-13s", rec->time / 1000000, rec->time % 1000000, name);
+	switch (rec->event) {
+	case OBEX_TRACE_REQUEST_START:
+		printf(" seq %3u %s\n", rec->seq, opcode_name(rec->code));
+		break;
+	case OBEX_TRACE_REQUEST_DONE:
+		if (value < 0)
+			printf(" %s error %d\n", opcode_name(rec->code), value);
+		else
+			printf(" %s rsp 0x%02x\n", opcode_name(rec->code), value);
+		break;
+	case OBEX_TRACE_RETRY:
+	case OBEX_TRACE_SEQ_ERROR:
+		printf(" seq %3u error %d\n", rec->seq, value);
+		break;
+	case OBEX_TRACE_PIPELINE_OFF:
+		if (value < 0)
+			printf(" seq %3u error %d\n", rec->seq, value);
+		else
+			printf(" seq %3u rsp 0x%02x\n", rec->seq, value);
+		break;
+	case OBEX_TRACE_PACKET_SEND:
+		printf(" seq %3u %s len %u attempt %u\n", rec->seq,
+		       opcode_name(rec->code), rec->value, rec->flags);
+		break;
+	case OBEX_TRACE_PACKET_AHEAD:
+		printf(" seq %3u %s len %u\n", rec->seq, opcode_name(rec->code), rec->value);
+		break;
+	case OBEX_TRACE_PACKET_RECEIVE:
+		printf(" rsp 0x%02x len %u\n", rec->code, rec->value);
+		break;
+	case OBEX_TRACE_SEQ_MISMATCH:
+		printf(" seq %3u got %u\n", rec->seq, rec->code);
+		break;
+	case OBEX_TRACE_SEQ_OK:
+	case OBEX_TRACE_ANSWER_LOST:
+		printf(" seq %3u\n", rec->seq);
+		break;
+	default:
+		printf(" event %u seq %u code 0x%02x flags %u value %u\n",
+		       rec->event, rec->seq, rec->code, rec->flags, rec->value);
+		break;
+	}
+}
+
+int main(int argc, const char **argv)
+{
+	struct obex_trace_hdr hdr;
+	struct obex_trace_rec rec;
+	uint8_t *stamp = (uint8_t *)&rec.time;
+	uint64_t time;
+	uint32_t i, records;
+	FILE *fp;
+	int j;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <tracefile>\n", argv[0]);
+		return 1;
+	}
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    memcmp(hdr.magic, OBEX_TRACE_MAGIC, sizeof(hdr.magic)) != 0) {
+		fprintf(stderr, "%s: not a trace file\n", argv[1]);
+		fclose(fp);
+		return 1;
+	}
+	if (ntohs(hdr.version) != OBEX_TRACE_VERSION) {
+		fprintf(stderr, "%s: unsupported version %u\n", argv[1], ntohs(hdr.version));
+		fclose(fp);
+		return 1;
+	}
+	records = ntohl(hdr.records);
+	if (ntohl(hdr.lost))
+		printf("%u older events were overwritten\n", ntohl(hdr.lost));
+	for (i = 0; i < records; i++) {
+		if (fread(&rec, sizeof(rec), 1, fp) != 1) {
+			fprintf(stderr, "%s: truncated after %u events\n", argv[1], i);
+			fclose(fp);
+			return 1;
+		}
+		time = 0;
+		for (j = 0; j < 8; j++)
+			time = time << 8 | stamp[j];
+		rec.time = time;
+		rec.value = ntohl(rec.value);
+		print_record(&rec);
+	}
+	fclose(fp);
+	return 0;
+}
@@ -20,14 +20,20 @@
  */
 
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <iconv.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "obex.h"
 #include "exword.h"
+#include "probes.h"
 
 /**
  * @page Protocol
@@ -58,6 +64,19 @@
  * This page details the functions used to send commands to the device.
  */
 
+/** @defgroup async Asynchronous commands
+ * This page details the functions used to send commands to the device
+ * without waiting for the answer. These are thread-offloaded commands:
+ * each returns once the command is queued, the commands of a handle run
+ * one after the other on its worker thread, blocking it as the device
+ * commands do. Completion is reported by calling a \ref complete_cb from
+ * \ref exword_handle_events, in the thread calling it.\n\n
+ * The first of these calls starts the worker of the handle, switching
+ * it to the thread-safe mode of \ref exword_set_threaded. Several threads
+ * may make that call at once, but no other function may be called for
+ * the handle meanwhile.
+ */
+
 static const char Model[] = {0,'_',0,'M',0,'o',0,'d',0,'e',0,'l',0,0};
 static const char List[] = {0,'_',0,'L',0,'i',0,'s',0,'t',0,0};
 static const char Remove[] = {0,'_',0,'R',0,'e',0,'m',0,'o',0,'v',0,'e',0,0};
@@ -77,12 +96,41 @@ static const char AuthInfo[] = {0,'_',0,'A', 0, 'u', 0, 't', 0, 'h', 0, 'I', 0,
  * Structure representing an exword device handle.
  */
 /// @cond exclude
+typedef int (*exword_run_t)(exword_t *self, void **arg);
+
+/* Call of a public function made on behalf of another thread */
+struct exword_cmd {
+	struct exword_cmd *next;
+	exword_run_t run;
+	void *arg[4];
+	int result;
+	int done;
+
+	/* Calls of the _async functions only */
+	complete_cb callback;
+	void *userdata;
+	char *copy[2];		/* String arguments, owned by the call */
+	union {
+		exword_device_t device;
+		exword_userid_t userid;
+		exword_authchallenge_t challenge;
+	} in;			/* Arguments passed by value */
+	exword_completion_t out;
+};
+
 struct exword_t {
 	obex_t *obex_ctx;
 
 
 	int debug;
 	int status;
+	uint16_t options;	/* Options of the last connect */
+	uint16_t mtu;		/* Receive packet size, 0 for the default */
+	int retries;		/* Resends of a lost packet */
+	int pipelining;		/* Send packets before the previous answer */
+	exword_stat_t stats[EXWORD_STAT_MAX];	/* Kept across connections */
+	struct obex_trace *trace;	/* Event ring, kept across connections */
+	exword_device_t device;	/* Device to connect to, any if port and serial are empty */
 
 	file_cb put_file_cb;
 	file_cb get_file_cb;
@@ -94,11 +142,63 @@ struct exword_t {
 
 	disconnect_cb disconnect_callback;
 	void * disconnect_data;
-	struct libusb_transfer *int_urb;
-	char int_buffer[16];
+
+	/* Thread-safe mode, see exword_set_threaded */
+	int threaded;
+	pthread_t worker;
+	struct exword_cmd *queue;	/* Submitted calls, newest first */
+	int stop;			/* Worker exits once the queue is empty */
+	int wake_pipe[2];		/* Readable while calls are submitted */
+	pthread_mutex_t lock;		/* Protects sleeping and waking of callers */
+	pthread_cond_t done;		/* Callers wait for their call */
+	struct exword_cmd *completed;	/* Finished _async calls, newest first */
+	int event_pipe[2];		/* Readable while calls are completed */
 };
 /// @endcond
 
+/* Application callback of the library wide hotplug notification */
+static struct {
+	hotplug_cb callback;
+	void *userdata;
+} hotplug;
+
+static const char * const stat_names[EXWORD_STAT_MAX] = {
+	"connect", "disconnect", "setpath", "get", "put", "_Remove", "_Model",
+	"_Cap", "_List", "_SdFormat", "_UserId", "_CryptKey", "_CName",
+	"_Unlock", "_Lock", "_AuthChallenge", "_AuthInfo"
+};
+
+/* Runs a request and adds its counters to the statistics of class cls */
+static int exword_request(exword_t *self, obex_object_t *obj, int cls)
+{
+	struct obex_stats *counters = &self->obex_ctx->stats;
+	exword_stat_t *stat = &self->stats[cls];
+	int rsp, i;
+
+	PROBE2(command_start, stat_names[cls], cls);
+	rsp = obex_request(self->obex_ctx, obj);
+	PROBE4(command_done, stat_names[cls], cls, rsp, counters->total);
+
+	stat->requests++;
+	if (rsp != OBEX_RSP_SUCCESS)
+		stat->errors++;
+	stat->packets_tx += counters->packets_tx;
+	stat->packets_rx += counters->packets_rx;
+	stat->bytes_tx += counters->bytes_tx;
+	stat->bytes_rx += counters->bytes_rx;
+	stat->retries += counters->retries;
+	stat->usb_time += counters->usb_time;
+	stat->seq_wait += counters->seq_wait;
+	stat->device_time += counters->device_time;
+	stat->host_time += counters->host_time;
+	stat->total_time += counters->total;
+	for (i = 0; i < EXWORD_STAT_BUCKETS - 1; i++) {
+		if (counters->total < (128ULL << i))
+			break;
+	}
+	stat->histogram[i]++;
+	return rsp;
+}
 
 static int obex_to_exword_error(exword_t *self, int obex_rsp)
 {
@@ -120,10 +220,9 @@ static int obex_to_exword_error(exword_t *self, int obex_rsp)
 		self->status |= 0x80;
 		if (!(self->status & 0x07))
 			self->status |= EXWORD_DISCONNECT_ERROR;
-		libusb_cancel_transfer(self->int_urb);
 		obj = obex_object_new(self->obex_ctx, OBEX_CMD_DISCONNECT);
 		if (obj != NULL) {
-			obex_request(self->obex_ctx, obj);
+			exword_request(self, obj, EXWORD_STAT_DISCONNECT);
 			obex_object_delete(self->obex_ctx, obj);
 		}
 		return EXWORD_ERROR_INTERNAL;
@@ -303,20 +402,62 @@ void send_disconnect_event(exword_t *self, int reason) {
 	}
 }
 
-void exword_handle_interrupt(struct libusb_transfer *transfer)
+/* Handles transport events and reports a lost device */
+static void exword_check_link(exword_t *self)
 {
-	exword_t *self = (exword_t *)transfer->user_data;
-	switch(transfer->status) {
-	case LIBUSB_TRANSFER_TIMED_OUT:
-	case LIBUSB_TRANSFER_COMPLETED:
-		libusb_submit_transfer(transfer);
-		break;
-	case LIBUSB_TRANSFER_NO_DEVICE:
-	case LIBUSB_TRANSFER_ERROR:
-		if (!(self->status & 0x07))
+	struct timeval tv = {0, 0};
+	if (exword_is_connected(self)) {
+		obex_handle_events(self->obex_ctx, &tv);
+		if (obex_link_lost(self->obex_ctx) && !(self->status & 0x07))
 			self->status |= EXWORD_DISCONNECT_UNPLUGGED;
-		break;
 	}
+	if (self->status & 0x07) {
+		send_disconnect_event(self, (self->status & 0x07));
+		exword_disconnect(self);
+		self->status &= ~0x07;
+	}
+}
+
+/* Returns the descriptors the transport waits on in an allocated array
+   with room for extra entries after them, their number is stored in n */
+static struct pollfd * exword_transport_fds(exword_t *self, int extra, int *n)
+{
+	struct obex_pollfd *list = NULL;
+	struct pollfd *fds;
+	int i, count = 0;
+
+	if (exword_is_connected(self))
+		count = obex_get_pollfds(self->obex_ctx, NULL, 0);
+	if (count > 0) {
+		list = malloc(count * sizeof(struct obex_pollfd));
+		if (list == NULL)
+			return NULL;
+		i = obex_get_pollfds(self->obex_ctx, list, count);
+		if (i < count)
+			count = i;
+	}
+	if (count < 0)
+		count = 0;
+	fds = calloc(count + extra + 1, sizeof(struct pollfd));
+	if (fds != NULL) {
+		for (i = 0; i < count; i++) {
+			fds[i].fd = list[i].fd;
+			fds[i].events = list[i].events;
+		}
+		*n = count;
+	}
+	free(list);
+	return fds;
+}
+
+/* Milliseconds until the transport needs its events handled, -1 if it
+   only waits for its descriptors */
+static int exword_transport_timeout(exword_t *self)
+{
+	struct timeval tv;
+	if (!exword_is_connected(self) || obex_get_timeout(self->obex_ctx, &tv) <= 0)
+		return -1;
+	return tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
 }
 
 static void exword_handle_callbacks(obex_t *self, obex_object_t *object, void *userdata)
@@ -324,8 +465,6 @@ static void exword_handle_callbacks(obex_t *self, obex_object_t *object, void *u
 	exword_t *exword = (exword_t*)userdata;
 	char *tx_buffer = self->tx_msg->data;
 	int len;
-	struct list_head *pos;
-	struct obex_header_element *h;
 	struct obex_unicode_hdr * hdr;
 	if (!exword)
 		return;
@@ -362,17 +501,8 @@ static void exword_handle_callbacks(obex_t *self, obex_object_t *object, void *u
 			}
 		}
 		if (exword->cb_filename) {
-			if (object->rx_body)
-				exword->cb_transferred = object->rx_body->data_size;
-			if (!list_empty(&object->rx_headerq)) {
-				list_for_each(pos, &object->rx_headerq) {
-					h = list_entry(pos, struct obex_header_element, link);
-					if (h->hi == OBEX_HDR_LENGTH)
-						exword->cb_filelength = ntohl(*((uint32_t*) h->buf->data));
-					if (h->hi == OBEX_HDR_BODY)
-						exword->cb_transferred = h->length;
-				}
-			}
+			exword->cb_transferred = object->rx_body_len;
+			exword->cb_filelength = object->hinted_body_len;
 			exword->get_file_cb(exword->cb_filename,
 					    exword->cb_transferred,
 					    exword->cb_filelength,
@@ -382,249 +512,1112 @@ static void exword_handle_callbacks(obex_t *self, obex_object_t *object, void *u
 }
 
 
-/** @ingroup device
- * Init exword library.
- * This function initializes exword library.
- * @returns device handle
- */
-exword_t * exword_init()
-{
-	exword_t *self = malloc(sizeof(exword_t));
+/* Thread-safe mode. Every public function called for a threaded handle
+   is run by its worker thread: the caller pushes a exword_cmd to the
+   queue and sleeps until the worker has run it. The queue is a lock-free
+   stack the worker empties at once and reverses, so several threads can
+   submit while the worker is busy. */
 
-	if (self == NULL)
-		return NULL;
+#define ARG(x)	((void *)(intptr_t)(x))
 
-	memset(self, 0, sizeof(exword_t));
+static int exword_forwarded(exword_t *self)
+{
+	return __atomic_load_n(&self->threaded, __ATOMIC_ACQUIRE) &&
+	       !pthread_equal(pthread_self(), self->worker);
+}
 
-	self->status = 0x80;
+static int exword_pipe(int fds[2])
+{
+	int i;
+	if (pipe(fds) < 0)
+		return -1;
+	for (i = 0; i < 2; i++) {
+		fcntl(fds[i], F_SETFL, O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+	return 0;
+}
 
-	return self;
+/* Makes the read end of a pipe readable, a full pipe is already */
+static void exword_signal(int fd)
+{
+	while (write(fd, "", 1) < 0 && errno == EINTR)
+		;
 }
 
-/** @ingroup device
- * Deinit exword library.
- * This function disconnect if currently connected and clean up free library resources.
- * @param self device handle
- */
-void exword_deinit(exword_t *self)
+static void exword_drain(int fd)
 {
-	if (exword_is_connected(self))
-		exword_disconnect(self);
+	char buf[64];
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+}
 
-	free(self->cb_filename);
-	free(self);
+static void exword_queue_push(struct exword_cmd **queue, struct exword_cmd *cmd)
+{
+	struct exword_cmd *head = __atomic_load_n(queue, __ATOMIC_RELAXED);
+	do {
+		cmd->next = head;
+	} while (!__atomic_compare_exchange_n(queue, &head, cmd, 1,
+					      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 }
 
-/** @ingroup device
- * Checks if device is connected.
- * This function checks the connected status of the device.
- * @param self device handle
- * @returns true if connected, otherwise false.
- */
-int exword_is_connected(exword_t * self)
+/* Takes all queued calls, oldest first */
+static struct exword_cmd * exword_queue_take(struct exword_cmd **queue)
 {
-	return !(self->status & 0x80);
+	struct exword_cmd *cmd, *next, *fifo = NULL;
+	cmd = __atomic_exchange_n(queue, NULL, __ATOMIC_ACQUIRE);
+	while (cmd != NULL) {
+		next = cmd->next;
+		cmd->next = fifo;
+		fifo = cmd;
+		cmd = next;
+	}
+	return fifo;
 }
 
-/** @ingroup cmd
- * Connects to device.
- * This function will connect to the device using the specified mode
- * and region.
- * @param self device handle
- * @param options bit mask of mode and region
- * @returns response code.
- */
-int exword_connect(exword_t *self, uint16_t options)
+static int exword_call(exword_t *self, exword_run_t run, void *a0, void *a1, void *a2, void *a3)
 {
-	ssize_t ret;
-	uint8_t ver, locale;
+	struct exword_cmd cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.run = run;
+	cmd.arg[0] = a0;
+	cmd.arg[1] = a1;
+	cmd.arg[2] = a2;
+	cmd.arg[3] = a3;
+	exword_queue_push(&self->queue, &cmd);
+	exword_signal(self->wake_pipe[1]);
+	pthread_mutex_lock(&self->lock);
+	while (!cmd.done)
+		pthread_cond_wait(&self->done, &self->lock);
+	pthread_mutex_unlock(&self->lock);
+	return cmd.result;
+}
 
-	if (exword_is_connected(self))
-		goto error;
+/* Sleeps until a call is submitted. Meanwhile the events of the
+   transport are handled, so a device unplugged while idle is noticed. */
+static void exword_idle(exword_t *self)
+{
+	struct pollfd wake, *fds;
+	int i, n, ret;
 
-	locale = options & 0xff;
-	if (options & EXWORD_MODE_TEXT)
-		ver = locale;
-	else if (options & EXWORD_MODE_CD)
-		ver = 0xf0;
-	else
-		ver = locale - 0x0f;
+	fds = exword_transport_fds(self, 1, &n);
+	if (fds == NULL) {
+		fds = &wake;
+		n = 0;
+	}
+	fds[n].fd = self->wake_pipe[0];
+	fds[n].events = POLLIN;
+	ret = poll(fds, n + 1, exword_transport_timeout(self));
+	exword_drain(self->wake_pipe[0]);
+	for (i = 0; i < n && fds[i].revents == 0; i++)
+		;
+	if (ret == 0 || (ret > 0 && i < n))
+		exword_check_link(self);
+	if (fds != &wake)
+		free(fds);
+}
 
-	self->int_urb = libusb_alloc_transfer(0);
-	if (self->int_urb == NULL)
-		goto error;
+static void * exword_worker(void *data)
+{
+	exword_t *self = data;
+	struct exword_cmd *cmd, *next;
+
+	/* Waits until exword_start_worker has recorded the thread */
+	pthread_mutex_lock(&self->lock);
+	pthread_mutex_unlock(&self->lock);
+	for (;;) {
+		cmd = exword_queue_take(&self->queue);
+		if (cmd == NULL) {
+			if (__atomic_load_n(&self->stop, __ATOMIC_ACQUIRE))
+				break;
+			exword_idle(self);
+			continue;
+		}
+		for (; cmd != NULL; cmd = next) {
+			/* The caller may return as soon as done is set */
+			next = cmd->next;
+			cmd->result = cmd->run(self, cmd->arg);
+			if (cmd->callback) {
+				cmd->out.result = cmd->result;
+				exword_queue_push(&self->completed, cmd);
+				exword_signal(self->event_pipe[1]);
+				continue;
+			}
+			pthread_mutex_lock(&self->lock);
+			cmd->done = 1;
+			pthread_cond_broadcast(&self->done);
+			pthread_mutex_unlock(&self->lock);
+		}
+	}
+	return NULL;
+}
 
-	self->obex_ctx = obex_init(0x07cf, 0x6101);
-	if (self->obex_ctx == NULL)
-		goto free_transfer;
+static int run_is_connected(exword_t *self, void **arg)
+{
+	return exword_is_connected(self);
+}
 
-	self->obex_ctx->debug = self->debug;
+static int run_connect(exword_t *self, void **arg)
+{
+	return exword_connect(self, (intptr_t)arg[0]);
+}
 
-	obex_set_connect_info(self->obex_ctx, ver, locale);
-	obex_register_callback(self->obex_ctx, exword_handle_callbacks, self);
+static int run_connect_device(exword_t *self, void **arg)
+{
+	return exword_connect_device(self, arg[0], (intptr_t)arg[1]);
+}
 
-	libusb_fill_interrupt_transfer(self->int_urb, self->obex_ctx->usb_dev,
-				       self->obex_ctx->interrupt_endpoint_address,
-				       self->int_buffer, 16, exword_handle_interrupt,
-				       self, 3000);
+static int run_disconnect(exword_t *self, void **arg)
+{
+	return exword_disconnect(self);
+}
 
+static int run_set_debug(exword_t *self, void **arg)
+{
+	exword_set_debug(self, (intptr_t)arg[0]);
+	return 0;
+}
 
-	obex_object_t *obj = obex_object_new(self->obex_ctx, OBEX_CMD_CONNECT);
-	if (obj == NULL)
-		goto free_context;
+static int run_get_debug(exword_t *self, void **arg)
+{
+	return exword_get_debug(self);
+}
 
-	ret = obex_request(self->obex_ctx, obj);
-	obex_object_delete(self->obex_ctx, obj);
-	if (ret != OBEX_RSP_SUCCESS)
-		goto free_context;
+static int run_set_mtu(exword_t *self, void **arg)
+{
+	return exword_set_mtu(self, (intptr_t)arg[0]);
+}
 
-	libusb_submit_transfer(self->int_urb);
-	self->status = 0x00;
+static int run_get_mtu(exword_t *self, void **arg)
+{
+	return exword_get_mtu(self);
+}
 
-	return EXWORD_SUCCESS;
+static int run_set_retries(exword_t *self, void **arg)
+{
+	return exword_set_retries(self, (intptr_t)arg[0]);
+}
 
-free_context:
-	obex_cleanup(self->obex_ctx);
-	self->obex_ctx = NULL;
-free_transfer:
-	libusb_free_transfer(self->int_urb);
-error:
-	return EXWORD_ERROR_OTHER;
+static int run_get_retries(exword_t *self, void **arg)
+{
+	return exword_get_retries(self);
 }
 
-/** @ingroup cmd
- * Disconnects from device.
- * This function disconnects from the currently connected device.
- * @param self device handle
- * @return response code
- */
-int exword_disconnect(exword_t *self)
+static int run_set_pipelining(exword_t *self, void **arg)
 {
-	if (exword_is_connected(self)) {
-		self->status |= 0x80;
-		if (!(self->status & 0x07))
-			self->status |= EXWORD_DISCONNECT_NORMAL;
-		obex_object_t *obj = obex_object_new(self->obex_ctx, OBEX_CMD_DISCONNECT);
-		if (obj == NULL)
-			return EXWORD_ERROR_NO_MEM;
-		libusb_cancel_transfer(self->int_urb);
-		obex_request(self->obex_ctx, obj);
-		obex_object_delete(self->obex_ctx, obj);
-		libusb_free_transfer(self->int_urb);
-		obex_cleanup(self->obex_ctx);
-		self->obex_ctx = NULL;
+	exword_set_pipelining(self, (intptr_t)arg[0]);
+	return 0;
+}
 
-	}
-	return EXWORD_SUCCESS;
+static int run_get_pipelining(exword_t *self, void **arg)
+{
+	return exword_get_pipelining(self);
 }
 
-/** @ingroup misc
- * Sets the debug message level.
- * This function sets the debug level for the currently opened device.
- * @param self device handle
- * @param level debug level (0-5)
- */
-void exword_set_debug(exword_t *self, int level)
+static int run_register_xfer_callbacks(exword_t *self, void **arg)
 {
-	self->debug = level;
-	if (self->obex_ctx)
-		self->obex_ctx->debug = self->debug;
+	exword_register_xfer_callbacks(self, arg[0], arg[1], arg[2], arg[3]);
+	return 0;
 }
 
-/** @ingroup misc
- * Gets the debug message level.
- * This function gets the debug level for the currently opened device.
- * @param self device handle
- * @return current debug level
- */
-int exword_get_debug(exword_t *self)
+static int run_register_xfer_get_callback(exword_t *self, void **arg)
 {
-	return self->debug;
+	exword_register_xfer_get_callback(self, arg[0], arg[1]);
+	return 0;
 }
 
-/** @ingroup misc
- * Registers callback functions for sending and recieving files.
- * These functions will be invoked during file transfers after each
- * chunk of the file is transferred.\n\n
- * To remove a callback use NULL for function pointer
- * @param self device handle
- * @param get pointer to function for reporting download transfer progress
- * @param get_data pointer passed to the get callback function
- * @param put pointer to function for reporting upload transfer progress
- * @param put_data pointer passed to the put callback function
- */
-void exword_register_xfer_callbacks(exword_t *self, file_cb get, void *get_data, file_cb put, void *put_data)
+static int run_register_xfer_put_callback(exword_t *self, void **arg)
 {
-	self->put_file_cb = put;
-	self->get_file_cb = get;
-	self->get_cb_userdata = get_data;
-	self->put_cb_userdata = put_data;
+	exword_register_xfer_put_callback(self, arg[0], arg[1]);
+	return 0;
 }
 
-/** @ingroup misc
- * Registers callback function for recieving files.
- * This function will be invoked during file transfers after each
- * chunk of the file is transferred.\n\n
- * To remove a callback use NULL for function pointer
- * @param self device handle
- * @param callback pointer to function for reporting download transfer progress
- * @param userdata pointer containing user data to be passed to the callback function
- */
-void exword_register_xfer_get_callback(exword_t *self, file_cb callback, void *userdata)
+static int run_register_disconnect_callback(exword_t *self, void **arg)
 {
-	self->get_file_cb = callback;
-	self->get_cb_userdata = userdata;
+	exword_register_disconnect_callback(self, arg[0], arg[1]);
+	return 0;
 }
 
-/** @ingroup misc
- * Registers callback function for sending files.
- * This function will be invoked during file transfers after each
- * chunk of the file is transferred.\n\n
- * To remove a callback use NULL for function pointer
- * @param self device handle
- * @param callback pointer to function for reporting upload transfer progress
- * @param userdata pointer containing user data to be passed to the callback function
- */
-void exword_register_xfer_put_callback(exword_t *self, file_cb callback, void *userdata)
+static int run_poll_disconnect(exword_t *self, void **arg)
 {
-	self->put_file_cb = callback;
-	self->put_cb_userdata = userdata;
+	exword_poll_disconnect(self);
+	return 0;
 }
 
-/** @ingroup device
- * Registers callback function for disconnect notifications.
- * The registered function will be invoked during a disconnect
- * event.\n\n
- * To remove a callback use NULL for function pointer
- * @param self device handle
- * @param disconnect pointer to disconnect notification function
- * @param userdata pointer passed to callback function
- */
-void exword_register_disconnect_callback(exword_t *self, disconnect_cb disconnect, void *userdata)
+static int run_send_file(exword_t *self, void **arg)
 {
-	self->disconnect_callback = disconnect;
-	self->disconnect_data = userdata;
+	return exword_send_file(self, arg[0], arg[1], (intptr_t)arg[2]);
 }
 
-/** @ingroup misc
- * Checks for pending disconnect event.
- * This function should be called periodically from
- * your main loop to check for a disconnect event.\n\n
- * If it is not called no disconnect notification will be
- * sent to the application.
- * @param self device handle
- */
-void exword_poll_disconnect(exword_t *self)
+static int run_send_stream(exword_t *self, void **arg)
 {
-	struct timeval tv = {0, 0};
-	if (exword_is_connected(self)) {
-		libusb_handle_events_timeout(self->obex_ctx->usb_ctx, &tv);
-	}
-	if (self->status & 0x07) {
-		send_disconnect_event(self, (self->status & 0x07));
+	return exword_send_stream(self, arg[0], (intptr_t)arg[1], arg[2], arg[3]);
+}
+
+static int run_get_file(exword_t *self, void **arg)
+{
+	return exword_get_file(self, arg[0], arg[1], arg[2]);
+}
+
+static int run_get_file_into(exword_t *self, void **arg)
+{
+	return exword_get_file_into(self, arg[0], arg[1], (intptr_t)arg[2], arg[3]);
+}
+
+static int run_get_stream(exword_t *self, void **arg)
+{
+	return exword_get_stream(self, arg[0], arg[1], arg[2], arg[3]);
+}
+
+static int run_calibrate(exword_t *self, void **arg)
+{
+	return exword_calibrate(self, arg[0], arg[1], arg[2]);
+}
+
+static int run_remove_file(exword_t *self, void **arg)
+{
+	return exword_remove_file(self, arg[0], (intptr_t)arg[1]);
+}
+
+static int run_sd_format(exword_t *self, void **arg)
+{
+	return exword_sd_format(self);
+}
+
+static int run_setpath(exword_t *self, void **arg)
+{
+	return exword_setpath(self, arg[0], (intptr_t)arg[1]);
+}
+
+static int run_get_model(exword_t *self, void **arg)
+{
+	return exword_get_model(self, arg[0]);
+}
+
+static int run_get_capacity(exword_t *self, void **arg)
+{
+	return exword_get_capacity(self, arg[0]);
+}
+
+static int run_list(exword_t *self, void **arg)
+{
+	return exword_list(self, arg[0], arg[1]);
+}
+
+static int run_userid(exword_t *self, void **arg)
+{
+	return exword_userid(self, *(exword_userid_t *)arg[0]);
+}
+
+static int run_cryptkey(exword_t *self, void **arg)
+{
+	return exword_cryptkey(self, arg[0]);
+}
+
+static int run_cname(exword_t *self, void **arg)
+{
+	return exword_cname(self, arg[0], arg[1]);
+}
+
+static int run_unlock(exword_t *self, void **arg)
+{
+	return exword_unlock(self);
+}
+
+static int run_lock(exword_t *self, void **arg)
+{
+	return exword_lock(self);
+}
+
+static int run_authchallenge(exword_t *self, void **arg)
+{
+	return exword_authchallenge(self, *(exword_authchallenge_t *)arg[0]);
+}
+
+static int run_authinfo(exword_t *self, void **arg)
+{
+	return exword_authinfo(self, arg[0]);
+}
+
+static int run_get_stats(exword_t *self, void **arg)
+{
+	return exword_get_stats(self, (intptr_t)arg[0], arg[1]);
+}
+
+static int run_reset_stats(exword_t *self, void **arg)
+{
+	exword_reset_stats(self);
+	return 0;
+}
+
+static int run_set_trace(exword_t *self, void **arg)
+{
+	return exword_set_trace(self, (uintptr_t)arg[0]);
+}
+
+static int run_write_trace(exword_t *self, void **arg)
+{
+	return exword_write_trace(self, arg[0]);
+}
+
+static void exword_async_free(struct exword_cmd *cmd)
+{
+	free(cmd->copy[0]);
+	free(cmd->copy[1]);
+	free(cmd);
+}
+
+/* Allocates an asynchronous call of run, copying the strings s0 and s1 */
+static struct exword_cmd * exword_async_new(exword_run_t run, complete_cb callback, void *userdata,
+					    const char *s0, const char *s1)
+{
+	struct exword_cmd *cmd = calloc(1, sizeof(struct exword_cmd));
+	if (cmd == NULL)
+		return NULL;
+	cmd->run = run;
+	cmd->callback = callback;
+	cmd->userdata = userdata;
+	if (s0 != NULL && (cmd->copy[0] = strdup(s0)) == NULL)
+		goto error;
+	if (s1 != NULL && (cmd->copy[1] = strdup(s1)) == NULL)
+		goto error;
+	return cmd;
+error:
+	exword_async_free(cmd);
+	return NULL;
+}
+
+static int exword_start_worker(exword_t *self);
+
+/* Queues cmd for the worker, starting it first if needed. The lock makes
+   threads submitting at once start a single worker. */
+static int exword_submit(exword_t *self, struct exword_cmd *cmd)
+{
+	int rsp = EXWORD_SUCCESS;
+	if (!__atomic_load_n(&self->threaded, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&self->lock);
+		if (!self->threaded)
+			rsp = exword_start_worker(self);
+		pthread_mutex_unlock(&self->lock);
+		if (rsp != EXWORD_SUCCESS) {
+			exword_async_free(cmd);
+			return rsp;
+		}
+	}
+	exword_queue_push(&self->queue, cmd);
+	exword_signal(self->wake_pipe[1]);
+	return EXWORD_SUCCESS;
+}
+
+/* Calls the completion function of each finished _async call */
+static void exword_dispatch(exword_t *self)
+{
+	struct exword_cmd *cmd, *next;
+	exword_drain(self->event_pipe[0]);
+	for (cmd = exword_queue_take(&self->completed); cmd != NULL; cmd = next) {
+		next = cmd->next;
+		cmd->callback(self, &cmd->out, cmd->userdata);
+		exword_async_free(cmd);
+	}
+}
+
+/* Called with self->lock held, which the worker waits for before it
+   looks at self->worker */
+static int exword_start_worker(exword_t *self)
+{
+	if (exword_pipe(self->wake_pipe) < 0)
+		return EXWORD_ERROR_OTHER;
+	if (exword_pipe(self->event_pipe) < 0)
+		goto close_wake;
+	self->stop = 0;
+	if (pthread_create(&self->worker, NULL, exword_worker, self) != 0)
+		goto close_event;
+	__atomic_store_n(&self->threaded, 1, __ATOMIC_RELEASE);
+	return EXWORD_SUCCESS;
+
+close_event:
+	close(self->event_pipe[0]);
+	close(self->event_pipe[1]);
+close_wake:
+	close(self->wake_pipe[0]);
+	close(self->wake_pipe[1]);
+	return EXWORD_ERROR_OTHER;
+}
+
+/** @ingroup device
+ * Enables thread-safe mode.
+ * In thread-safe mode the handle owns a worker thread that runs every
+ * function called for it, in the order the calls were made. Any thread
+ * may call functions for the handle at the same time, each call waits
+ * for its own completion. Transfer and disconnect callbacks are invoked
+ * from the worker thread and may call functions for the handle. While
+ * idle the worker waits on the device too, so an unplugged device is
+ * reported without calling \ref exword_poll_disconnect. The first
+ * \ref async command enables this mode too.\n\n
+ * This function itself must not be called while other threads use the
+ * handle. \ref exword_deinit stops the worker. When the worker is
+ * stopped queued commands are finished first, and the completion
+ * functions of \ref async commands still pending are called before
+ * this function returns. They must not send further commands.
+ * @param self device handle
+ * @param enable 1 to start the worker, 0 to stop it
+ * @return response code
+ */
+int exword_set_threaded(exword_t *self, int enable)
+{
+	int rsp = EXWORD_SUCCESS;
+	if (enable && !self->threaded) {
+		pthread_mutex_lock(&self->lock);
+		rsp = exword_start_worker(self);
+		pthread_mutex_unlock(&self->lock);
+	} else if (!enable && self->threaded) {
+		if (pthread_equal(pthread_self(), self->worker))
+			return EXWORD_ERROR_OTHER;
+		__atomic_store_n(&self->stop, 1, __ATOMIC_RELEASE);
+		exword_signal(self->wake_pipe[1]);
+		pthread_join(self->worker, NULL);
+		__atomic_store_n(&self->threaded, 0, __ATOMIC_RELEASE);
+		exword_dispatch(self);
+		close(self->event_pipe[0]);
+		close(self->event_pipe[1]);
+		close(self->wake_pipe[0]);
+		close(self->wake_pipe[1]);
+	}
+	return rsp;
+}
+
+/** @ingroup device
+ * Init exword library.
+ * This function initializes exword library.
+ * @returns device handle
+ */
+exword_t * exword_init()
+{
+	exword_t *self = malloc(sizeof(exword_t));
+
+	if (self == NULL)
+		return NULL;
+
+	memset(self, 0, sizeof(exword_t));
+
+	self->status = 0x80;
+	self->retries = OBEX_DEFAULT_RETRIES;
+	pthread_mutex_init(&self->lock, NULL);
+	pthread_cond_init(&self->done, NULL);
+
+	return self;
+}
+
+/** @ingroup device
+ * Deinit exword library.
+ * This function disconnect if currently connected and clean up free library resources.
+ * @param self device handle
+ */
+void exword_deinit(exword_t *self)
+{
+	exword_set_threaded(self, 0);
+	if (exword_is_connected(self))
 		exword_disconnect(self);
-		self->status &= ~0x07;
+
+	pthread_cond_destroy(&self->done);
+	pthread_mutex_destroy(&self->lock);
+	free(self->cb_filename);
+	free(self->trace);
+	free(self);
+}
+
+/** @ingroup device
+ * Checks if device is connected.
+ * This function checks the connected status of the device.
+ * @param self device handle
+ * @returns true if connected, otherwise false.
+ */
+int exword_is_connected(exword_t * self)
+{
+	if (exword_forwarded(self))
+		return exword_call(self, run_is_connected, NULL, NULL, NULL, NULL);
+	return !(self->status & 0x80);
+}
+
+static void exword_device_from_id(exword_device_t *device, const struct usb_device_id *id)
+{
+	device->bus = id->bus;
+	device->address = id->address;
+	strcpy(device->port, id->port);
+	strcpy(device->serial, id->serial);
+}
+
+/** @ingroup device
+ * Lists attached devices.
+ * This function returns the identity of each attached dictionary, used
+ * to pick one with \ref exword_connect_device. Devices already in use
+ * by another handle are listed too. If EXWORD_EMULATOR or EXWORD_REPLAY
+ * is set the software device is listed as the only one, with bus 0 and
+ * port "0".
+ * @param[out] devices array of devices (free with \ref exword_free_devices)
+ * @param[out] count number of devices
+ * @return response code
+ */
+int exword_list_devices(exword_device_t **devices, uint16_t *count)
+{
+	struct usb_device_id *ids;
+	int i, n;
+
+	*devices = NULL;
+	*count = 0;
+	if (getenv("EXWORD_EMULATOR") || getenv("EXWORD_REPLAY")) {
+		*devices = calloc(1, sizeof(exword_device_t));
+		if (*devices == NULL)
+			return EXWORD_ERROR_NO_MEM;
+		strcpy((*devices)->port, "0");
+		*count = 1;
+		return EXWORD_SUCCESS;
+	}
+	n = usb_list_devices(0x07cf, 0x6101, &ids);
+	if (n < 0)
+		return EXWORD_ERROR_OTHER;
+	*devices = calloc(n + 1, sizeof(exword_device_t));
+	if (*devices == NULL) {
+		free(ids);
+		return EXWORD_ERROR_NO_MEM;
+	}
+	for (i = 0; i < n; i++)
+		exword_device_from_id(&(*devices)[i], &ids[i]);
+	free(ids);
+	*count = n;
+	return EXWORD_SUCCESS;
+}
+
+/** @ingroup device
+ * Frees device list.
+ * This function frees the list returned by \ref exword_list_devices.
+ * @param devices device list
+ */
+void exword_free_devices(exword_device_t *devices)
+{
+	free(devices);
+}
+
+static void exword_hotplug_notify(const struct usb_device_id *id, int arrived, void *data)
+{
+	exword_device_t device;
+	memset(&device, 0, sizeof(device));
+	exword_device_from_id(&device, id);
+	hotplug.callback(&device, arrived, hotplug.userdata);
+}
+
+/** @ingroup device
+ * Registers hotplug callback.
+ * This function registers a function called for each dictionary that is
+ * attached or removed, starting with the ones already attached. The
+ * device passed can be given to \ref exword_connect_device right away.
+ * Notifications are only sent from \ref exword_poll_hotplug.\n\n
+ * While a callback is registered the library keeps the attached devices
+ * in one libusb context shared by all handles, so connecting does not
+ * scan the bus. Only usb devices are reported, and only on platforms
+ * where libusb supports hotplug.
+ * @param callback function to call or NULL to stop notifications
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_register_hotplug_callback(hotplug_cb callback, void *userdata)
+{
+	usb_hotplug_stop();
+	hotplug.callback = callback;
+	hotplug.userdata = userdata;
+	if (callback == NULL)
+		return EXWORD_SUCCESS;
+	if (usb_hotplug_start(0x07cf, 0x6101, exword_hotplug_notify, NULL) < 0) {
+		hotplug.callback = NULL;
+		return EXWORD_ERROR_OTHER;
+	}
+	return EXWORD_SUCCESS;
+}
+
+/** @ingroup device
+ * Checks for pending hotplug events.
+ * This function waits up to timeout milliseconds for devices to be
+ * attached or removed and calls the function registered with
+ * \ref exword_register_hotplug_callback for each of them. It should be
+ * called from one thread only.
+ * @param timeout time to wait in milliseconds, 0 to only check
+ * @return response code
+ */
+int exword_poll_hotplug(int timeout)
+{
+	struct timeval tv;
+	if (hotplug.callback == NULL)
+		return EXWORD_ERROR_OTHER;
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	return usb_hotplug_poll(&tv) < 0 ? EXWORD_ERROR_OTHER : EXWORD_SUCCESS;
+}
+
+/* Connects to the device selected in self->device */
+static int exword_open(exword_t *self, uint16_t options)
+{
+	struct usb_transport_args args = { 0x07cf, 0x6101, NULL, NULL };
+	char *emulator, *replay, *capture;
+	ssize_t ret;
+	uint8_t ver, locale;
+
+	if (exword_is_connected(self))
+		goto error;
+
+	locale = options & 0xff;
+	if (options & EXWORD_MODE_TEXT)
+		ver = locale;
+	else if (options & EXWORD_MODE_CD)
+		ver = 0xf0;
+	else
+		ver = locale - 0x0f;
+
+	if (self->device.port[0])
+		args.port = self->device.port;
+	if (self->device.serial[0])
+		args.serial = self->device.serial;
+	emulator = getenv("EXWORD_EMULATOR");
+	replay = getenv("EXWORD_REPLAY");
+	if (replay != NULL)
+		self->obex_ctx = obex_init(&replay_transport_ops, replay);
+	else if (emulator != NULL)
+		self->obex_ctx = obex_init(&emulator_transport_ops, emulator);
+	else
+		self->obex_ctx = obex_init(&usb_transport_ops, &args);
+	if (self->obex_ctx == NULL)
+		goto error;
+
+	capture = getenv("EXWORD_CAPTURE");
+	if (capture != NULL && obex_capture_open(self->obex_ctx, capture) < 0)
+		goto free_context;
+
+	self->obex_ctx->debug = self->debug;
+	if (self->mtu)
+		obex_set_mtu(self->obex_ctx, self->mtu);
+	obex_set_retries(self->obex_ctx, self->retries);
+	obex_set_pipelining(self->obex_ctx, self->pipelining);
+	self->obex_ctx->trace = self->trace;
+
+	obex_set_connect_info(self->obex_ctx, ver, locale);
+	obex_register_callback(self->obex_ctx, exword_handle_callbacks, self);
+
+
+	obex_object_t *obj = obex_object_new(self->obex_ctx, OBEX_CMD_CONNECT);
+	if (obj == NULL)
+		goto free_context;
+
+	ret = exword_request(self, obj, EXWORD_STAT_CONNECT);
+	obex_object_delete(self->obex_ctx, obj);
+	if (ret != OBEX_RSP_SUCCESS)
+		goto free_context;
+
+	self->status = 0x00;
+	self->options = options;
+
+	return EXWORD_SUCCESS;
+
+free_context:
+	obex_cleanup(self->obex_ctx);
+	self->obex_ctx = NULL;
+error:
+	return EXWORD_ERROR_OTHER;
+}
+
+/** @ingroup cmd
+ * Connects to device.
+ * This function will connect to the device using the specified mode
+ * and region. The first attached device not in use by another handle is
+ * used, see \ref exword_connect_device to choose one.\n\n
+ * If the environment variable EXWORD_EMULATOR is set to a directory a
+ * software device backed by that directory is used instead of the usb
+ * device.\n\n
+ * If EXWORD_REPLAY is set to a file written through EXWORD_CAPTURE the
+ * recorded session is played back instead, with the recorded timing
+ * if EXWORD_REPLAY_TIMING is set too. Setting EXWORD_CAPTURE records
+ * every packet exchanged with the device to the named file.
+ * @param self device handle
+ * @param options bit mask of mode and region
+ * @returns response code.
+ */
+int exword_connect(exword_t *self, uint16_t options)
+{
+	if (exword_forwarded(self))
+		return exword_call(self, run_connect, ARG(options), NULL, NULL, NULL);
+	if (exword_is_connected(self))
+		return EXWORD_ERROR_OTHER;
+	memset(&self->device, 0, sizeof(exword_device_t));
+	return exword_open(self, options);
+}
+
+/** @ingroup cmd
+ * Connects to a specific device.
+ * This function works like \ref exword_connect but only connects to the
+ * device with the port and serial number of device, an empty port or
+ * serial number matches any device. Each handle can be connected to a different
+ * device, handles may be used from different threads at the same time
+ * as long as each is used by one thread only. All usb handles share one
+ * libusb context, so a thread waiting for its own device may complete
+ * transfers of other handles. The library only marks those completed and
+ * records them in the capture file of their handle under its lock.
+ * @param self device handle
+ * @param device device as returned by \ref exword_list_devices
+ * @param options bit mask of mode and region
+ * @returns response code.
+ */
+int exword_connect_device(exword_t *self, const exword_device_t *device, uint16_t options)
+{
+	if (exword_forwarded(self))
+		return exword_call(self, run_connect_device, (void *)device, ARG(options), NULL, NULL);
+	if (exword_is_connected(self))
+		return EXWORD_ERROR_OTHER;
+	self->device = *device;
+	self->device.port[sizeof(self->device.port) - 1] = '\0';
+	self->device.serial[sizeof(self->device.serial) - 1] = '\0';
+	return exword_open(self, options);
+}
+
+/** @ingroup cmd
+ * Disconnects from device.
+ * This function disconnects from the currently connected device.
+ * @param self device handle
+ * @return response code
+ */
+int exword_disconnect(exword_t *self)
+{
+	if (exword_forwarded(self))
+		return exword_call(self, run_disconnect, NULL, NULL, NULL, NULL);
+	if (exword_is_connected(self)) {
+		self->status |= 0x80;
+		if (!(self->status & 0x07))
+			self->status |= EXWORD_DISCONNECT_NORMAL;
+		obex_object_t *obj = obex_object_new(self->obex_ctx, OBEX_CMD_DISCONNECT);
+		if (obj == NULL)
+			return EXWORD_ERROR_NO_MEM;
+		exword_request(self, obj, EXWORD_STAT_DISCONNECT);
+		obex_object_delete(self->obex_ctx, obj);
+		obex_cleanup(self->obex_ctx);
+		self->obex_ctx = NULL;
+
+	}
+	return EXWORD_SUCCESS;
+}
+
+/** @ingroup misc
+ * Sets the debug message level.
+ * This function sets the debug level for the currently opened device.
+ * @param self device handle
+ * @param level debug level (0-5)
+ */
+void exword_set_debug(exword_t *self, int level)
+{
+	if (exword_forwarded(self)) {
+		exword_call(self, run_set_debug, ARG(level), NULL, NULL, NULL);
+		return;
+	}
+	self->debug = level;
+	if (self->obex_ctx)
+		self->obex_ctx->debug = self->debug;
+}
+
+/** @ingroup misc
+ * Gets the debug message level.
+ * This function gets the debug level for the currently opened device.
+ * @param self device handle
+ * @return current debug level
+ */
+int exword_get_debug(exword_t *self)
+{
+	if (exword_forwarded(self))
+		return exword_call(self, run_get_debug, NULL, NULL, NULL, NULL);
+	return self->debug;
+}
+
+/** @ingroup misc
+ * Sets the packet size.
+ * This function sets the largest packet the device is asked to send. It
+ * takes effect on the next connect. Larger packets speed up downloads
+ * on devices that support them, see \ref exword_calibrate for finding the
+ * best size of a model.
+ * @param self device handle
+ * @param mtu packet size (255-65535) or 0 for the default
+ * @return response code
+ */
+int exword_set_mtu(exword_t *self, uint16_t mtu)
+{
+	if (exword_forwarded(self))
+		return exword_call(self, run_set_mtu, ARG(mtu), NULL, NULL, NULL);
+	if (mtu != 0 && mtu < OBEX_MINIMUM_MTU)
+		return EXWORD_ERROR_OTHER;
+	self->mtu = mtu;
+	return EXWORD_SUCCESS;
+}
+
+/** @ingroup misc
+ * Gets the packet size.
+ * @param self device handle
+ * @return packet size set by \ref exword_set_mtu or the default
+ */
+uint16_t exword_get_mtu(exword_t *self)
+{
+	if (exword_forwarded(self))
+		return exword_call(self, run_get_mtu, NULL, NULL, NULL, NULL);
+	return self->mtu ? self->mtu : OBEX_DEFAULT_MTU;
+}
+
+/** @ingroup misc
+ * Sets the number of retries.
+ * This function sets how often a packet is sent again when it, its
+ * sequence echo or its response got lost, before the request fails.
+ * The packet is resent with the same sequence number.\n\n
+ * Retransmission is opt-in, it is off (0) by default, and it is
+ * unverified on hardware. Only the emulator is known to recognize a
+ * repeated sequence number and skip running the request twice. A real
+ * device may run a resent packet it already executed again, for
+ * example appending a file block twice, so by default a lost packet
+ * still fails the request.
+ * @param self device handle
+ * @param retries number of resends per packet
+ * @return response code
+ */
+int exword_set_retries(exword_t *self, int retries)
+{
+	if (exword_forwarded(self))
+		return exword_call(self, run_set_retries, ARG(retries), NULL, NULL, NULL);
+	if (retries < 0)
+		return EXWORD_ERROR_OTHER;
+	self->retries = retries;
+	if (self->obex_ctx)
+		obex_set_retries(self->obex_ctx, retries);
+	return EXWORD_SUCCESS;
+}
+
+/** @ingroup misc
+ * Gets the number of retries.
+ * @param self device handle
+ * @return number of resends set by \ref exword_set_retries
+ */
+int exword_get_retries(exword_t *self)
+{
+	if (exword_forwarded(self))
+		return exword_call(self, run_get_retries, NULL, NULL, NULL, NULL);
+	return self->retries;
+}
+
+/** @ingroup misc
+ * Enables pipelining (experimental).
+ * When enabled a request made of several packets, such as the upload of
+ * a large file, sends each packet before the answer to the previous one
+ * has been read. Answers are matched by sequence number. If the device
+ * stalls or refuses a packet sent early, the connection falls back to
+ * lock-step until pipelining is enabled again. Takes effect immediately
+ * and on the next connect.
+ * @param self device handle
+ * @param enable non-zero to enable pipelining
+ */
+void exword_set_pipelining(exword_t *self, int enable)
+{
+	if (exword_forwarded(self)) {
+		exword_call(self, run_set_pipelining, ARG(enable), NULL, NULL, NULL);
+		return;
+	}
+	self->pipelining = enable != 0;
+	if (self->obex_ctx)
+		obex_set_pipelining(self->obex_ctx, self->pipelining);
+}
+
+/** @ingroup misc
+ * Gets pipelining state.
+ * @param self device handle
+ * @return 1 if pipelining is in use, 0 if it is disabled or the device
+ * made the connection fall back to lock-step
+ */
+int exword_get_pipelining(exword_t *self)
+{
+	if (exword_forwarded(self))
+		return exword_call(self, run_get_pipelining, NULL, NULL, NULL, NULL);
+	if (self->obex_ctx)
+		return self->obex_ctx->pipeline;
+	return self->pipelining;
+}
+
+/** @ingroup misc
+ * Registers callback functions for sending and recieving files.
+ * These functions will be invoked during file transfers after each
+ * chunk of the file is transferred.\n\n
+ * To remove a callback use NULL for function pointer
+ * @param self device handle
+ * @param get pointer to function for reporting download transfer progress
+ * @param get_data pointer passed to the get callback function
+ * @param put pointer to function for reporting upload transfer progress
+ * @param put_data pointer passed to the put callback function
+ */
+void exword_register_xfer_callbacks(exword_t *self, file_cb get, void *get_data, file_cb put, void *put_data)
+{
+	if (exword_forwarded(self)) {
+		exword_call(self, run_register_xfer_callbacks, (void *)get, get_data, (void *)put, put_data);
+		return;
+	}
+	self->put_file_cb = put;
+	self->get_file_cb = get;
+	self->get_cb_userdata = get_data;
+	self->put_cb_userdata = put_data;
+}
+
+/** @ingroup misc
+ * Registers callback function for recieving files.
+ * This function will be invoked during file transfers after each
+ * chunk of the file is transferred.\n\n
+ * To remove a callback use NULL for function pointer
+ * @param self device handle
+ * @param callback pointer to function for reporting download transfer progress
+ * @param userdata pointer containing user data to be passed to the callback function
+ */
+void exword_register_xfer_get_callback(exword_t *self, file_cb callback, void *userdata)
+{
+	if (exword_forwarded(self)) {
+		exword_call(self, run_register_xfer_get_callback, (void *)callback, userdata, NULL, NULL);
+		return;
+	}
+	self->get_file_cb = callback;
+	self->get_cb_userdata = userdata;
+}
+
+/** @ingroup misc
+ * Registers callback function for sending files.
+ * This function will be invoked during file transfers after each
+ * chunk of the file is transferred.\n\n
+ * To remove a callback use NULL for function pointer
+ * @param self device handle
+ * @param callback pointer to function for reporting upload transfer progress
+ * @param userdata pointer containing user data to be passed to the callback function
+ */
+void exword_register_xfer_put_callback(exword_t *self, file_cb callback, void *userdata)
+{
+	if (exword_forwarded(self)) {
+		exword_call(self, run_register_xfer_put_callback, (void *)callback, userdata, NULL, NULL);
+		return;
+	}
+	self->put_file_cb = callback;
+	self->put_cb_userdata = userdata;
+}
+
+/** @ingroup device
+ * Registers callback function for disconnect notifications.
+ * The registered function will be invoked during a disconnect
+ * event.\n\n
+ * To remove a callback use NULL for function pointer
+ * @param self device handle
+ * @param disconnect pointer to disconnect notification function
+ * @param userdata pointer passed to callback function
+ */
+void exword_register_disconnect_callback(exword_t *self, disconnect_cb disconnect, void *userdata)
+{
+	if (exword_forwarded(self)) {
+		exword_call(self, run_register_disconnect_callback, (void *)disconnect, userdata, NULL, NULL);
+		return;
+	}
+	self->disconnect_callback = disconnect;
+	self->disconnect_data = userdata;
+}
+
+/** @ingroup misc
+ * Checks for pending disconnect event.
+ * This function should be called periodically from
+ * your main loop to check for a disconnect event.\n\n
+ * If it is not called no disconnect notification will be
+ * sent to the application. Event loops can instead wait on the
+ * descriptors of \ref exword_get_pollfds and call
+ * \ref exword_handle_events.
+ * @param self device handle
+ */
+void exword_poll_disconnect(exword_t *self)
+{
+	if (exword_forwarded(self)) {
+		exword_call(self, run_poll_disconnect, NULL, NULL, NULL, NULL);
+		return;
+	}
+	exword_check_link(self);
+}
+
+/** @ingroup device
+ * Gets the descriptors to wait on.
+ * This function returns the file descriptors an event loop should poll
+ * for the handle, with the poll(2) events of interest. Once one is ready,
+ * or the time of \ref exword_get_timeout has passed,
+ * \ref exword_handle_events should be called.\n\n
+ * The descriptors of a usb device are those of the libusb context shared
+ * by all handles connected to usb devices. Events on them may belong to
+ * any of these handles, and \ref exword_handle_events of one handle
+ * processes the events of all, so a handle may find work done by the
+ * call of another. An event loop serving several handles calls
+ * \ref exword_handle_events for each of them. A threaded handle
+ * returns one descriptor, readable while \ref async commands are
+ * completed, its worker thread waits on the device itself.\n\n
+ * The set changes on connect, disconnect, \ref exword_set_threaded and
+ * the first \ref async command, it should be fetched again after those.
+ * @note The list is allocated by the function and must be freed with
+ * \ref exword_free_pollfds.
+ * @param[in] self device handle
+ * @param[out] fds descriptors to wait on
+ * @param[out] count number of descriptors
+ * @return response code
+ */
+int exword_get_pollfds(exword_t *self, exword_pollfd_t **fds, uint16_t *count)
+{
+	struct pollfd *list;
+	int i, n;
+	*fds = NULL;
+	*count = 0;
+	if (__atomic_load_n(&self->threaded, __ATOMIC_ACQUIRE)) {
+		*fds = malloc(sizeof(exword_pollfd_t));
+		if (*fds == NULL)
+			return EXWORD_ERROR_NO_MEM;
+		(*fds)[0].fd = self->event_pipe[0];
+		(*fds)[0].events = POLLIN;
+		*count = 1;
+		return EXWORD_SUCCESS;
+	}
+	list = exword_transport_fds(self, 0, &n);
+	if (list == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	*fds = malloc((n + 1) * sizeof(exword_pollfd_t));
+	if (*fds == NULL) {
+		free(list);
+		return EXWORD_ERROR_NO_MEM;
 	}
+	for (i = 0; i < n; i++) {
+		(*fds)[i].fd = list[i].fd;
+		(*fds)[i].events = list[i].events;
+	}
+	*count = n;
+	free(list);
+	return EXWORD_SUCCESS;
+}
+
+/** @ingroup device
+ * Free descriptor list.
+ * This function frees the list returned by \ref exword_get_pollfds.
+ * @param fds descriptor list
+ */
+void exword_free_pollfds(exword_pollfd_t *fds)
+{
+	free(fds);
+}
+
+/** @ingroup device
+ * Gets the time until events must be handled.
+ * Some transfers time out without any descriptor becoming ready. This
+ * function returns how long an event loop may wait on the descriptors
+ * of \ref exword_get_pollfds before calling \ref exword_handle_events.
+ * @param[in] self device handle
+ * @param[out] timeout time in milliseconds, -1 if there is no limit
+ * @return response code
+ */
+int exword_get_timeout(exword_t *self, int *timeout)
+{
+	*timeout = __atomic_load_n(&self->threaded, __ATOMIC_ACQUIRE) ? -1 :
+		   exword_transport_timeout(self);
+	return EXWORD_SUCCESS;
 }
 
 
@@ -642,6 +1635,8 @@ int exword_send_file(exword_t *self, char* filename, char *buffer, int len)
 	int length, rsp;
 	obex_headerdata_t hv;
 	char *unicode;
+	if (exword_forwarded(self))
+		return exword_call(self, run_send_file, filename, buffer, ARG(len), NULL);
 
 	if (self->status & 0x06)
 		return EXWORD_ERROR_INTERNAL;
@@ -662,8 +1657,69 @@ int exword_send_file(exword_t *self, char* filename, char *buffer, int len)
 	hv.bq4 = len;
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_LENGTH, hv, 0, 0);
 	hv.bs = buffer;
-	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_BODY, hv, len, 0);
-	rsp = obex_request(self->obex_ctx, obj);
+	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_BODY, hv, len, OBEX_FL_NOCOPY);
+	rsp = exword_request(self, obj, EXWORD_STAT_PUT);
+	obex_object_delete(self->obex_ctx, obj);
+	free(unicode);
+	return obex_to_exword_error(self, rsp);
+}
+
+struct exword_stream {
+	read_cb reader;
+	write_cb writer;
+	void *userdata;
+};
+
+static int exword_read_body(uint8_t *buffer, unsigned int len, void *data)
+{
+	struct exword_stream *stream = (struct exword_stream *)data;
+	return stream->reader((char *)buffer, len, stream->userdata);
+}
+
+/** @ingroup cmd
+ * Upload a file to device from a stream.
+ * This command works like \ref exword_send_file but instead of taking the
+ * whole file in memory it calls reader to fetch one packet worth of data
+ * at a time.
+ * @param self device handle
+ * @param filename name of file being sent.
+ * @param len total size of file.
+ * @param reader function called to read the file data.
+ * @param userdata data pointer passed to reader.
+ * @return response code
+ */
+int exword_send_stream(exword_t *self, char* filename, int len, read_cb reader, void *userdata)
+{
+	int length, rsp;
+	obex_headerdata_t hv;
+	char *unicode;
+	struct exword_stream stream;
+	if (exword_forwarded(self))
+		return exword_call(self, run_send_stream, filename, ARG(len), (void *)reader, userdata);
+
+	if (self->status & 0x06)
+		return EXWORD_ERROR_INTERNAL;
+
+	if (!exword_is_connected(self))
+		return EXWORD_ERROR_NOT_FOUND;
+
+	unicode = convert_from_locale("UTF-16BE", &unicode, &length, filename, strlen(filename) + 1);
+	if (unicode == NULL)
+		return EXWORD_ERROR_OTHER;
+	obex_object_t *obj = obex_object_new(self->obex_ctx, OBEX_CMD_PUT);
+	if (obj == NULL) {
+		free(unicode);
+		return EXWORD_ERROR_NO_MEM;
+	}
+	stream.reader = reader;
+	stream.writer = NULL;
+	stream.userdata = userdata;
+	hv.bs = unicode;
+	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_NAME, hv, length, 0);
+	hv.bq4 = len;
+	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_LENGTH, hv, 0, 0);
+	obex_object_add_body_reader(self->obex_ctx, obj, len, exword_read_body, &stream);
+	rsp = exword_request(self, obj, EXWORD_STAT_PUT);
 	obex_object_delete(self->obex_ctx, obj);
 	free(unicode);
 	return obex_to_exword_error(self, rsp);
@@ -683,9 +1739,9 @@ int exword_get_file(exword_t *self, char* filename, char **buffer, int *len)
 {
 	int length, rsp;
 	obex_headerdata_t hv;
-	uint8_t hi;
-	uint32_t hv_size;
 	char *unicode;
+	if (exword_forwarded(self))
+		return exword_call(self, run_get_file, filename, buffer, len, NULL);
 	*len = 0;
 	*buffer = NULL;
 
@@ -695,32 +1751,223 @@ int exword_get_file(exword_t *self, char* filename, char **buffer, int *len)
 	if (!exword_is_connected(self))
 		return EXWORD_ERROR_NOT_FOUND;
 
-	unicode = convert_from_locale("UTF-16BE", &unicode, &length, filename, strlen(filename) + 1);
-	if (unicode == NULL)
-		return EXWORD_ERROR_OTHER;
-	obex_object_t *obj = obex_object_new(self->obex_ctx, OBEX_CMD_GET);
-	if (obj == NULL) {
-		free(unicode);
-		return EXWORD_ERROR_NO_MEM;
-	}
-	hv.bs = unicode;
-	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_NAME, hv, length, 0);
-	rsp = obex_request(self->obex_ctx, obj);
-	if ((rsp & ~OBEX_FINAL) == OBEX_RSP_SUCCESS) {
-		while (obex_object_getnextheader(self->obex_ctx, obj, &hi, &hv, &hv_size)) {
-			if (hi == OBEX_HDR_LENGTH) {
-				*len = hv.bq4;
-				*buffer = malloc(*len);
-			}
-			if (hi == OBEX_HDR_BODY) {
-				memcpy(*buffer, hv.bs, *len);
-				break;
-			}
+	unicode = convert_from_locale("UTF-16BE", &unicode, &length, filename, strlen(filename) + 1);
+	if (unicode == NULL)
+		return EXWORD_ERROR_OTHER;
+	obex_object_t *obj = obex_object_new(self->obex_ctx, OBEX_CMD_GET);
+	if (obj == NULL) {
+		free(unicode);
+		return EXWORD_ERROR_NO_MEM;
+	}
+	hv.bs = unicode;
+	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_NAME, hv, length, 0);
+	/* Body is received into a buffer sized from the length header */
+	obex_object_set_body_buffer(obj, NULL, 0);
+	rsp = exword_request(self, obj, EXWORD_STAT_GET);
+	if ((rsp & ~OBEX_FINAL) == OBEX_RSP_SUCCESS)
+		*buffer = (char *)obex_object_take_body(obj, (unsigned int *)len);
+	obex_object_delete(self->obex_ctx, obj);
+	free(unicode);
+	return obex_to_exword_error(self, rsp);
+}
+
+/** @ingroup cmd
+ * Download a file from device into a buffer.
+ * This command works like \ref exword_get_file but stores the file data
+ * in the caller supplied buffer. If the file is larger than size
+ * EXWORD_ERROR_NO_MEM is returned and len is set to the size required.
+ * @param[in] self device handle
+ * @param[in] filename name of file being retrieved.
+ * @param[out] buffer location to store recieved file data, must not be NULL.
+ * @param[in] size size of buffer.
+ * @param[out] len length of recieved file.
+ * @return response code
+ */
+int exword_get_file_into(exword_t *self, char* filename, char *buffer, int size, int *len)
+{
+	int length, rsp;
+	obex_headerdata_t hv;
+	char *unicode;
+	if (exword_forwarded(self))
+		return exword_call(self, run_get_file_into, filename, buffer, ARG(size), len);
+	*len = 0;
+
+	if (buffer == NULL)
+		return EXWORD_ERROR_OTHER;
+
+	if (self->status & 0x06)
+		return EXWORD_ERROR_INTERNAL;
+
+	if (!exword_is_connected(self))
+		return EXWORD_ERROR_NOT_FOUND;
+
+	unicode = convert_from_locale("UTF-16BE", &unicode, &length, filename, strlen(filename) + 1);
+	if (unicode == NULL)
+		return EXWORD_ERROR_OTHER;
+	obex_object_t *obj = obex_object_new(self->obex_ctx, OBEX_CMD_GET);
+	if (obj == NULL) {
+		free(unicode);
+		return EXWORD_ERROR_NO_MEM;
+	}
+	hv.bs = unicode;
+	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_NAME, hv, length, 0);
+	obex_object_set_body_buffer(obj, (uint8_t *)buffer, size);
+	rsp = exword_request(self, obj, EXWORD_STAT_GET);
+	if ((rsp & ~OBEX_FINAL) == OBEX_RSP_SUCCESS) {
+		obex_object_take_body(obj, (unsigned int *)len);
+		if (obj->rx_body_dropped) {
+			obex_object_delete(self->obex_ctx, obj);
+			free(unicode);
+			return EXWORD_ERROR_NO_MEM;
+		}
+	}
+	obex_object_delete(self->obex_ctx, obj);
+	free(unicode);
+	return obex_to_exword_error(self, rsp);
+}
+
+static int exword_write_body(const uint8_t *buffer, unsigned int len, void *data)
+{
+	struct exword_stream *stream = (struct exword_stream *)data;
+	return stream->writer((const char *)buffer, len, stream->userdata);
+}
+
+/** @ingroup cmd
+ * Download a file from device to a stream.
+ * This command works like \ref exword_get_file but instead of returning the
+ * file in memory each piece is passed to writer as soon as it is received.
+ * @param[in] self device handle
+ * @param[in] filename name of file being retrieved.
+ * @param[in] writer function called with the file data.
+ * @param[in] userdata data pointer passed to writer.
+ * @param[out] len length of recieved file.
+ * @return response code
+ */
+int exword_get_stream(exword_t *self, char* filename, write_cb writer, void *userdata, int *len)
+{
+	int length, rsp;
+	obex_headerdata_t hv;
+	char *unicode;
+	struct exword_stream stream;
+	if (exword_forwarded(self))
+		return exword_call(self, run_get_stream, filename, (void *)writer, userdata, len);
+	*len = 0;
+
+	if (self->status & 0x06)
+		return EXWORD_ERROR_INTERNAL;
+
+	if (!exword_is_connected(self))
+		return EXWORD_ERROR_NOT_FOUND;
+
+	unicode = convert_from_locale("UTF-16BE", &unicode, &length, filename, strlen(filename) + 1);
+	if (unicode == NULL)
+		return EXWORD_ERROR_OTHER;
+	obex_object_t *obj = obex_object_new(self->obex_ctx, OBEX_CMD_GET);
+	if (obj == NULL) {
+		free(unicode);
+		return EXWORD_ERROR_NO_MEM;
+	}
+	stream.reader = NULL;
+	stream.writer = writer;
+	stream.userdata = userdata;
+	hv.bs = unicode;
+	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_NAME, hv, length, 0);
+	obex_object_set_body_writer(obj, exword_write_body, &stream);
+	rsp = exword_request(self, obj, EXWORD_STAT_GET);
+	if ((rsp & ~OBEX_FINAL) == OBEX_RSP_SUCCESS) {
+		*len = obj->rx_body_len;
+		if (obj->rx_body_dropped) {
+			obex_object_delete(self->obex_ctx, obj);
+			free(unicode);
+			return EXWORD_ERROR_OTHER;
+		}
+	}
+	obex_object_delete(self->obex_ctx, obj);
+	free(unicode);
+	return obex_to_exword_error(self, rsp);
+}
+
+static const uint16_t calibrate_mtu[] = { 0x1000, 0x2000, 0x4000, 0x8000, 0xffff };
+
+static int calibrate_writer(const char *buffer, int len, void *user_data)
+{
+	return 0;
+}
+
+/* Connects again to the same device with the options of the last connect
+   and changes to path */
+static int exword_reconnect(exword_t *self, uint8_t *path)
+{
+	int rsp;
+	exword_disconnect(self);
+	/* Left over after an internal error */
+	if (self->obex_ctx) {
+		obex_cleanup(self->obex_ctx);
+		self->obex_ctx = NULL;
+	}
+	rsp = exword_open(self, self->options);
+	if (rsp == EXWORD_SUCCESS)
+		rsp = exword_setpath(self, path, 0);
+	return rsp;
+}
+
+/** @ingroup cmd
+ * Find the fastest packet size.
+ * This command downloads filename once for each packet size tried and
+ * keeps the one with the highest throughput. Each size needs a new
+ * connection, made with the options of the last connect. Larger sizes are
+ * not tried once a download fails. On return the device is connected
+ * using the best size with path as current path, authentication has to be
+ * repeated.\n\n
+ * The library does not remember the result. Applications that want to
+ * reuse it store it with the model from \ref exword_get_model and pass it
+ * to \ref exword_set_mtu before later connects.
+ * @param[in] self device handle
+ * @param[in] path path holding the file
+ * @param[in] filename file to download, a few hundred kilobytes long
+ * @param[out] mtu best packet size, also set with \ref exword_set_mtu
+ *             and returned by \ref exword_get_mtu
+ * @return response code
+ */
+int exword_calibrate(exword_t *self, uint8_t *path, char *filename, uint16_t *mtu)
+{
+	struct timeval start, end;
+	double rate, best_rate = 0;
+	uint16_t best = 0, old_mtu = self->mtu;
+	int i, len, rsp, ret;
+	if (exword_forwarded(self))
+		return exword_call(self, run_calibrate, path, filename, mtu, NULL);
+
+	if (self->status & 0x06)
+		return EXWORD_ERROR_INTERNAL;
+
+	if (!exword_is_connected(self))
+		return EXWORD_ERROR_NOT_FOUND;
+
+	rsp = EXWORD_ERROR_OTHER;
+	for (i = 0; i < sizeof(calibrate_mtu) / sizeof(calibrate_mtu[0]); i++) {
+		self->mtu = calibrate_mtu[i];
+		rsp = exword_reconnect(self, path);
+		if (rsp != EXWORD_SUCCESS)
+			break;
+		gettimeofday(&start, NULL);
+		rsp = exword_get_stream(self, filename, calibrate_writer, NULL, &len);
+		gettimeofday(&end, NULL);
+		if (rsp != EXWORD_SUCCESS)
+			break;
+		rate = len / ((end.tv_sec - start.tv_sec) * 1000000.0 +
+			      (end.tv_usec - start.tv_usec) + 1);
+		if (rate > best_rate) {
+			best_rate = rate;
+			best = calibrate_mtu[i];
 		}
 	}
-	obex_object_delete(self->obex_ctx, obj);
-	free(unicode);
-	return obex_to_exword_error(self, rsp);
+	self->mtu = best ? best : old_mtu;
+	ret = exword_reconnect(self, path);
+	if (best == 0)
+		return rsp;
+	*mtu = best;
+	return ret;
 }
 
 /** @ingroup cmd
@@ -737,6 +1984,8 @@ int exword_remove_file(exword_t *self, char* filename, int convert_to_unicode)
 	int rsp, length;
 	obex_headerdata_t hv;
 	char *unicode = NULL;
+	if (exword_forwarded(self))
+		return exword_call(self, run_remove_file, filename, ARG(convert_to_unicode), NULL, NULL);
 
 	if (self->status & 0x06)
 		return EXWORD_ERROR_INTERNAL;
@@ -761,7 +2010,7 @@ int exword_remove_file(exword_t *self, char* filename, int convert_to_unicode)
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_LENGTH, hv, 0, 0);
 	hv.bs = convert_to_unicode ? unicode : filename;
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_BODY, hv, length, 0);
-	rsp = obex_request(self->obex_ctx, obj);
+	rsp = exword_request(self, obj, EXWORD_STAT_REMOVE);
 	obex_object_delete(self->obex_ctx, obj);
 	free(unicode);
 	return obex_to_exword_error(self, rsp);
@@ -777,6 +2026,8 @@ int exword_sd_format(exword_t *self)
 {
 	int rsp, len;
 	obex_headerdata_t hv;
+	if (exword_forwarded(self))
+		return exword_call(self, run_sd_format, NULL, NULL, NULL, NULL);
 
 	if (self->status & 0x06)
 		return EXWORD_ERROR_INTERNAL;
@@ -794,7 +2045,7 @@ int exword_sd_format(exword_t *self)
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_LENGTH, hv, 0, 0);
 	hv.bs = "";
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_BODY, hv, 1, 0);
-	rsp = obex_request(self->obex_ctx, obj);
+	rsp = exword_request(self, obj, EXWORD_STAT_SDFORMAT);
 	obex_object_delete(self->obex_ctx, obj);
 	return obex_to_exword_error(self, rsp);
 }
@@ -815,6 +2066,8 @@ int exword_setpath(exword_t *self, uint8_t *path, uint8_t mkdir)
 	uint8_t non_hdr[2] = {(mkdir ? 0 : 2), 0x00};
 	obex_headerdata_t hv;
 	char *unicode;
+	if (exword_forwarded(self))
+		return exword_call(self, run_setpath, path, ARG(mkdir), NULL, NULL);
 
 	if (self->status & 0x06)
 		return EXWORD_ERROR_INTERNAL;
@@ -838,7 +2091,7 @@ int exword_setpath(exword_t *self, uint8_t *path, uint8_t mkdir)
 	}
 	obex_object_set_nonhdr_data(obj, non_hdr, 2);
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_NAME, hv, len, 0);
-	rsp = obex_request(self->obex_ctx, obj);
+	rsp = exword_request(self, obj, EXWORD_STAT_SETPATH);
 	obex_object_delete(self->obex_ctx, obj);
 	free(unicode);
 	return obex_to_exword_error(self, rsp);
@@ -858,6 +2111,8 @@ int exword_get_model(exword_t *self, exword_model_t * model)
 	const uint8_t *ptr;
 	uint8_t hi;
 	uint32_t hv_size;
+	if (exword_forwarded(self))
+		return exword_call(self, run_get_model, model, NULL, NULL, NULL);
 
 	if (self->status & 0x06)
 		return EXWORD_ERROR_INTERNAL;
@@ -870,7 +2125,7 @@ int exword_get_model(exword_t *self, exword_model_t * model)
 		return EXWORD_ERROR_NO_MEM;
 	hv.bs = Model;
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_NAME, hv, 14, 0);
-	rsp = obex_request(self->obex_ctx, obj);
+	rsp = exword_request(self, obj, EXWORD_STAT_MODEL);
 	if ((rsp & ~OBEX_FINAL) == OBEX_RSP_SUCCESS) {
 		while (obex_object_getnextheader(self->obex_ctx, obj, &hi, &hv, &hv_size)) {
 			if (hi == OBEX_HDR_BODY) {
@@ -925,6 +2180,8 @@ int exword_get_capacity(exword_t *self, exword_capacity_t *cap)
 	obex_headerdata_t hv;
 	uint8_t hi;
 	uint32_t hv_size;
+	if (exword_forwarded(self))
+		return exword_call(self, run_get_capacity, cap, NULL, NULL, NULL);
 
 	if (self->status & 0x06)
 		return EXWORD_ERROR_INTERNAL;
@@ -937,7 +2194,7 @@ int exword_get_capacity(exword_t *self, exword_capacity_t *cap)
 		return EXWORD_ERROR_NO_MEM;
 	hv.bs = Cap;
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_NAME, hv, 10, 0);
-	rsp = obex_request(self->obex_ctx, obj);
+	rsp = exword_request(self, obj, EXWORD_STAT_CAPACITY);
 	if ((rsp & ~OBEX_FINAL) == OBEX_RSP_SUCCESS) {
 		while (obex_object_getnextheader(self->obex_ctx, obj, &hi, &hv, &hv_size)) {
 			if (hi == OBEX_HDR_BODY) {
@@ -972,6 +2229,8 @@ int exword_list(exword_t *self, exword_dirent_t **entries, uint16_t *count)
 	obex_headerdata_t hv;
 	uint8_t hi;
 	uint32_t hv_size;
+	if (exword_forwarded(self))
+		return exword_call(self, run_list, entries, count, NULL, NULL);
 	*count = 0;
 	*entries = NULL;
 
@@ -986,7 +2245,7 @@ int exword_list(exword_t *self, exword_dirent_t **entries, uint16_t *count)
 		return EXWORD_ERROR_NO_MEM;
 	hv.bs = List;
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_NAME, hv, 12, 0);
-	rsp = obex_request(self->obex_ctx, obj);
+	rsp = exword_request(self, obj, EXWORD_STAT_LIST);
 	if ((rsp & ~OBEX_FINAL) == OBEX_RSP_SUCCESS) {
 		while (obex_object_getnextheader(self->obex_ctx, obj, &hi, &hv, &hv_size)) {
 			if (hi == OBEX_HDR_BODY) {
@@ -1035,6 +2294,8 @@ int exword_userid(exword_t *self, exword_userid_t id)
 {
 	int rsp;
 	obex_headerdata_t hv;
+	if (exword_forwarded(self))
+		return exword_call(self, run_userid, &id, NULL, NULL, NULL);
 
 	if (self->status & 0x06)
 		return EXWORD_ERROR_INTERNAL;
@@ -1051,7 +2312,7 @@ int exword_userid(exword_t *self, exword_userid_t id)
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_LENGTH, hv, 0, 0);
 	hv.bs = id.name;
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_BODY, hv, 17, 0);
-	rsp = obex_request(self->obex_ctx, obj);
+	rsp = exword_request(self, obj, EXWORD_STAT_USERID);
 	obex_object_delete(self->obex_ctx, obj);
 	return obex_to_exword_error(self, rsp);
 }
@@ -1070,6 +2331,8 @@ int exword_cryptkey(exword_t *self, exword_cryptkey_t *key)
 	obex_headerdata_t hv;
 	uint8_t hi;
 	uint32_t hv_size;
+	if (exword_forwarded(self))
+		return exword_call(self, run_cryptkey, key, NULL, NULL, NULL);
 
 	if (self->status & 0x06)
 		return EXWORD_ERROR_INTERNAL;
@@ -1084,7 +2347,7 @@ int exword_cryptkey(exword_t *self, exword_cryptkey_t *key)
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_NAME, hv, 20, 0);
 	hv.bs = key->blk1;
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_CRYPTKEY, hv, 28, 0);
-	rsp = obex_request(self->obex_ctx, obj);
+	rsp = exword_request(self, obj, EXWORD_STAT_CRYPTKEY);
 	if ((rsp & ~OBEX_FINAL) == OBEX_RSP_SUCCESS) {
 		while (obex_object_getnextheader(self->obex_ctx, obj, &hi, &hv, &hv_size)) {
 			if (hi == OBEX_HDR_BODY) {
@@ -1113,6 +2376,8 @@ int exword_cname(exword_t *self, char *name, char* dir)
 	obex_headerdata_t hv;
 	int dir_length, name_length;
 	char *buffer;
+	if (exword_forwarded(self))
+		return exword_call(self, run_cname, name, dir, NULL, NULL);
 
 	if (self->status & 0x06)
 		return EXWORD_ERROR_INTERNAL;
@@ -1136,7 +2401,7 @@ int exword_cname(exword_t *self, char *name, char* dir)
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_LENGTH, hv, 0, 0);
 	hv.bs = buffer;
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_BODY, hv, dir_length + name_length, 0);
-	rsp = obex_request(self->obex_ctx, obj);
+	rsp = exword_request(self, obj, EXWORD_STAT_CNAME);
 	obex_object_delete(self->obex_ctx, obj);
 	free(buffer);
 	return obex_to_exword_error(self, rsp);
@@ -1152,6 +2417,8 @@ int exword_unlock(exword_t *self)
 {
 	int rsp;
 	obex_headerdata_t hv;
+	if (exword_forwarded(self))
+		return exword_call(self, run_unlock, NULL, NULL, NULL, NULL);
 
 	if (self->status & 0x06)
 		return EXWORD_ERROR_INTERNAL;
@@ -1168,7 +2435,7 @@ int exword_unlock(exword_t *self)
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_LENGTH, hv, 0, 0);
 	hv.bs = "";
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_BODY, hv, 1, 0);
-	rsp = obex_request(self->obex_ctx, obj);
+	rsp = exword_request(self, obj, EXWORD_STAT_UNLOCK);
 	obex_object_delete(self->obex_ctx, obj);
 	return obex_to_exword_error(self, rsp);
 }
@@ -1183,6 +2450,8 @@ int exword_lock(exword_t *self)
 {
 	int rsp;
 	obex_headerdata_t hv;
+	if (exword_forwarded(self))
+		return exword_call(self, run_lock, NULL, NULL, NULL, NULL);
 
 	if (self->status & 0x06)
 		return EXWORD_ERROR_INTERNAL;
@@ -1199,7 +2468,7 @@ int exword_lock(exword_t *self)
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_LENGTH, hv, 0, 0);
 	hv.bs = "";
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_BODY, hv, 1, 0);
-	rsp = obex_request(self->obex_ctx, obj);
+	rsp = exword_request(self, obj, EXWORD_STAT_LOCK);
 	obex_object_delete(self->obex_ctx, obj);
 	return obex_to_exword_error(self, rsp);
 }
@@ -1215,6 +2484,8 @@ int exword_authchallenge(exword_t *self, exword_authchallenge_t challenge)
 {
 	int rsp;
 	obex_headerdata_t hv;
+	if (exword_forwarded(self))
+		return exword_call(self, run_authchallenge, &challenge, NULL, NULL, NULL);
 
 	if (self->status & 0x06)
 		return EXWORD_ERROR_INTERNAL;
@@ -1231,7 +2502,7 @@ int exword_authchallenge(exword_t *self, exword_authchallenge_t challenge)
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_LENGTH, hv, 0, 0);
 	hv.bs = challenge.challenge;
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_BODY, hv, 20, 0);
-	rsp = obex_request(self->obex_ctx, obj);
+	rsp = exword_request(self, obj, EXWORD_STAT_AUTHCHALLENGE);
 	obex_object_delete(self->obex_ctx, obj);
 	return obex_to_exword_error(self, rsp);
 }
@@ -1250,6 +2521,8 @@ int exword_authinfo(exword_t *self, exword_authinfo_t *info)
 	obex_headerdata_t hv;
 	uint8_t hi;
 	uint32_t hv_size;
+	if (exword_forwarded(self))
+		return exword_call(self, run_authinfo, info, NULL, NULL, NULL);
 
 	if (self->status & 0x06)
 		return EXWORD_ERROR_INTERNAL;
@@ -1264,7 +2537,7 @@ int exword_authinfo(exword_t *self, exword_authinfo_t *info)
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_NAME, hv, 20, 0);
 	hv.bs = info->blk1;
 	obex_object_addheader(self->obex_ctx, obj, OBEX_HDR_AUTHINFO, hv, 40, 0);
-	rsp = obex_request(self->obex_ctx, obj);
+	rsp = exword_request(self, obj, EXWORD_STAT_AUTHINFO);
 	if ((rsp & ~OBEX_FINAL) == OBEX_RSP_SUCCESS) {
 		while (obex_object_getnextheader(self->obex_ctx, obj, &hi, &hv, &hv_size)) {
 			if (hi == OBEX_HDR_BODY) {
@@ -1277,6 +2550,579 @@ int exword_authinfo(exword_t *self, exword_authinfo_t *info)
 	return obex_to_exword_error(self, rsp);
 }
 
+/** @ingroup async
+ * Handles pending events.
+ * This function waits up to timeout milliseconds for events of the
+ * handle and processes them. For a threaded handle these are completed
+ * \ref async commands: the completion function of each is called, in
+ * the order the commands were sent, and may send further commands.
+ * Otherwise the events of the transport are handled, the disconnect
+ * notification is sent if the device went away.\n\n
+ * Event loops waiting on the descriptors of \ref exword_get_pollfds
+ * pass 0 for timeout. It returns at once if the handle has nothing to
+ * wait for, such as an unconnected handle that is not threaded. It must
+ * not be called from transfer or disconnect callbacks.
+ * @param self device handle
+ * @param timeout time to wait in milliseconds, 0 to only check or
+ * negative to wait until an event arrives
+ * @return response code
+ */
+int exword_handle_events(exword_t *self, int timeout)
+{
+	struct pollfd pfd, *fds;
+	int n, wait;
+	if (__atomic_load_n(&self->threaded, __ATOMIC_ACQUIRE)) {
+		if (pthread_equal(pthread_self(), self->worker))
+			return EXWORD_ERROR_OTHER;
+		pfd.fd = self->event_pipe[0];
+		pfd.events = POLLIN;
+		if (__atomic_load_n(&self->completed, __ATOMIC_ACQUIRE) == NULL &&
+		    poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+			return EXWORD_ERROR_OTHER;
+		exword_dispatch(self);
+		return EXWORD_SUCCESS;
+	}
+	fds = exword_transport_fds(self, 0, &n);
+	if (fds == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	if (n > 0 && timeout != 0) {
+		wait = exword_transport_timeout(self);
+		if (wait < 0 || (timeout >= 0 && timeout < wait))
+			wait = timeout;
+		if (poll(fds, n, wait) < 0 && errno != EINTR) {
+			free(fds);
+			return EXWORD_ERROR_OTHER;
+		}
+	}
+	free(fds);
+	exword_check_link(self);
+	return EXWORD_SUCCESS;
+}
+
+/** @ingroup async
+ * Connects to device without waiting.
+ * Queues \ref exword_connect and returns.
+ * @param self device handle
+ * @param options mode and region
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_connect_async(exword_t *self, uint16_t options, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_connect, callback, userdata, NULL, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->arg[0] = ARG(options);
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Connects to a chosen device without waiting.
+ * Queues \ref exword_connect_device and returns.
+ * @param self device handle
+ * @param device device to connect to
+ * @param options mode and region
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_connect_device_async(exword_t *self, const exword_device_t *device, uint16_t options, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_connect_device, callback, userdata, NULL, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->in.device = *device;
+	cmd->arg[0] = &cmd->in.device;
+	cmd->arg[1] = ARG(options);
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Disconnects from device without waiting.
+ * Queues \ref exword_disconnect and returns.
+ * @param self device handle
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_disconnect_async(exword_t *self, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_disconnect, callback, userdata, NULL, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Uploads a file without waiting.
+ * Queues \ref exword_send_file and returns.
+ * @param self device handle
+ * @param filename name of file being sent
+ * @param buffer file contents, must be kept until completion
+ * @param len length of buffer
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_send_file_async(exword_t *self, char* filename, char *buffer, int len, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_send_file, callback, userdata, filename, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->arg[0] = cmd->copy[0];
+	cmd->arg[1] = buffer;
+	cmd->arg[2] = ARG(len);
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Uploads a stream without waiting.
+ * Queues \ref exword_send_stream and returns.
+ * @param self device handle
+ * @param filename name of file being sent
+ * @param len length of file
+ * @param reader function supplying the file, called from the worker thread
+ * @param reader_data data pointer passed to reader
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_send_stream_async(exword_t *self, char* filename, int len, read_cb reader, void *reader_data, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_send_stream, callback, userdata, filename, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->arg[0] = cmd->copy[0];
+	cmd->arg[1] = ARG(len);
+	cmd->arg[2] = reader;
+	cmd->arg[3] = reader_data;
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Downloads a file without waiting.
+ * Queues \ref exword_get_file and returns. The file is passed in buffer and len of the completion.
+ * @param self device handle
+ * @param filename name of file to download
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_get_file_async(exword_t *self, char* filename, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_get_file, callback, userdata, filename, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->arg[0] = cmd->copy[0];
+	cmd->arg[1] = &cmd->out.buffer;
+	cmd->arg[2] = &cmd->out.len;
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Downloads a file into a buffer without waiting.
+ * Queues \ref exword_get_file_into and returns. The length of the file is passed in len of the completion.
+ * @param self device handle
+ * @param filename name of file to download
+ * @param buffer destination, must be kept until completion
+ * @param size size of buffer
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_get_file_into_async(exword_t *self, char* filename, char *buffer, int size, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_get_file_into, callback, userdata, filename, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->arg[0] = cmd->copy[0];
+	cmd->arg[1] = buffer;
+	cmd->arg[2] = ARG(size);
+	cmd->arg[3] = &cmd->out.len;
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Downloads a stream without waiting.
+ * Queues \ref exword_get_stream and returns. The length of the file is passed in len of the completion.
+ * @param self device handle
+ * @param filename name of file to download
+ * @param writer function receiving the file, called from the worker thread
+ * @param writer_data data pointer passed to writer
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_get_stream_async(exword_t *self, char* filename, write_cb writer, void *writer_data, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_get_stream, callback, userdata, filename, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->arg[0] = cmd->copy[0];
+	cmd->arg[1] = writer;
+	cmd->arg[2] = writer_data;
+	cmd->arg[3] = &cmd->out.len;
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Finds the fastest packet size without waiting.
+ * Queues \ref exword_calibrate and returns. The packet size chosen is passed in mtu of the completion.
+ * @param self device handle
+ * @param path path holding the file
+ * @param filename file to download
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_calibrate_async(exword_t *self, uint8_t *path, char *filename, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_calibrate, callback, userdata, (char *)path, filename);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->arg[0] = cmd->copy[0];
+	cmd->arg[1] = cmd->copy[1];
+	cmd->arg[2] = &cmd->out.mtu;
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Removes a file without waiting.
+ * Queues \ref exword_remove_file and returns.
+ * @param self device handle
+ * @param filename name of file to remove
+ * @param convert_to_unicode automatically convert filename to UTF-16 if true
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_remove_file_async(exword_t *self, char* filename, int convert_to_unicode, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_remove_file, callback, userdata, filename, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->arg[0] = cmd->copy[0];
+	cmd->arg[1] = ARG(convert_to_unicode);
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Gets model information without waiting.
+ * Queues \ref exword_get_model and returns. The model is passed in model of the completion.
+ * @param self device handle
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_get_model_async(exword_t *self, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_get_model, callback, userdata, NULL, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->arg[0] = &cmd->out.model;
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Gets storage capacity without waiting.
+ * Queues \ref exword_get_capacity and returns. The capacity is passed in capacity of the completion.
+ * @param self device handle
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_get_capacity_async(exword_t *self, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_get_capacity, callback, userdata, NULL, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->arg[0] = &cmd->out.capacity;
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Formats SD card without waiting.
+ * Queues \ref exword_sd_format and returns.
+ * @param self device handle
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_sd_format_async(exword_t *self, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_sd_format, callback, userdata, NULL, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Sets the current path without waiting.
+ * Queues \ref exword_setpath and returns.
+ * @param self device handle
+ * @param path new path
+ * @param mkdir if true create path if non existant
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_setpath_async(exword_t *self, uint8_t *path, uint8_t mkdir, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_setpath, callback, userdata, (char *)path, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->arg[0] = cmd->copy[0];
+	cmd->arg[1] = ARG(mkdir);
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Lists the current directory without waiting.
+ * Queues \ref exword_list and returns. The entries are passed in entries and count of the completion.
+ * @param self device handle
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_list_async(exword_t *self, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_list, callback, userdata, NULL, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->arg[0] = &cmd->out.entries;
+	cmd->arg[1] = &cmd->out.count;
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Sets user id without waiting.
+ * Queues \ref exword_userid and returns.
+ * @param self device handle
+ * @param id user id
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_userid_async(exword_t *self, exword_userid_t id, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_userid, callback, userdata, NULL, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->in.userid = id;
+	cmd->arg[0] = &cmd->in.userid;
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Generates a CryptKey without waiting.
+ * Queues \ref exword_cryptkey and returns. The generated key is passed in cryptkey of the completion.
+ * @param self device handle
+ * @param key input blocks of the key
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_cryptkey_async(exword_t *self, exword_cryptkey_t *key, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_cryptkey, callback, userdata, NULL, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->out.cryptkey = *key;
+	cmd->arg[0] = &cmd->out.cryptkey;
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Sets the name of a dictionary without waiting.
+ * Queues \ref exword_cname and returns.
+ * @param self device handle
+ * @param name new name
+ * @param dir dictionary directory
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_cname_async(exword_t *self, char *name, char* dir, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_cname, callback, userdata, name, dir);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->arg[0] = cmd->copy[0];
+	cmd->arg[1] = cmd->copy[1];
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Unlocks device without waiting.
+ * Queues \ref exword_unlock and returns.
+ * @param self device handle
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_unlock_async(exword_t *self, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_unlock, callback, userdata, NULL, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Locks device without waiting.
+ * Queues \ref exword_lock and returns.
+ * @param self device handle
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_lock_async(exword_t *self, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_lock, callback, userdata, NULL, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Authenticates to device without waiting.
+ * Queues \ref exword_authchallenge and returns.
+ * @param self device handle
+ * @param challenge 20 byte challenge key
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_authchallenge_async(exword_t *self, exword_authchallenge_t challenge, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_authchallenge, callback, userdata, NULL, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->in.challenge = challenge;
+	cmd->arg[0] = &cmd->in.challenge;
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup async
+ * Resets authentication info without waiting.
+ * Queues \ref exword_authinfo and returns. The new challenge key is passed in authinfo of the completion.
+ * @param self device handle
+ * @param info input blocks of the authentication info
+ * @param callback function called on completion
+ * @param userdata data pointer passed to callback
+ * @return response code
+ */
+int exword_authinfo_async(exword_t *self, exword_authinfo_t *info, complete_cb callback, void *userdata)
+{
+	struct exword_cmd *cmd = exword_async_new(run_authinfo, callback, userdata, NULL, NULL);
+	if (cmd == NULL)
+		return EXWORD_ERROR_NO_MEM;
+	cmd->out.authinfo = *info;
+	cmd->arg[0] = &cmd->out.authinfo;
+	return exword_submit(self, cmd);
+}
+
+/** @ingroup misc
+ * Gets request statistics.
+ * Statistics are collected for every request made through this handle,
+ * across connections, until \ref exword_reset_stats is called.
+ * @param self device handle
+ * @param cls request class, see \ref exword_stat_class
+ * @param[out] stat statistics of the class
+ * @return response code
+ */
+int exword_get_stats(exword_t *self, int cls, exword_stat_t *stat)
+{
+	if (exword_forwarded(self))
+		return exword_call(self, run_get_stats, ARG(cls), stat, NULL, NULL);
+	if (cls < 0 || cls >= EXWORD_STAT_MAX)
+		return EXWORD_ERROR_OTHER;
+	memcpy(stat, &self->stats[cls], sizeof(exword_stat_t));
+	return EXWORD_SUCCESS;
+}
+
+/** @ingroup misc
+ * Resets request statistics.
+ * @param self device handle
+ */
+void exword_reset_stats(exword_t *self)
+{
+	if (exword_forwarded(self)) {
+		exword_call(self, run_reset_stats, NULL, NULL, NULL, NULL);
+		return;
+	}
+	memset(self->stats, 0, sizeof(self->stats));
+}
+
+/** @ingroup misc
+ * Gets the name of a request class.
+ * @note return value is a static string and should not be freed.
+ * @param cls request class, see \ref exword_stat_class
+ * @return class name or NULL if cls is invalid
+ */
+const char * exword_stat_name(int cls)
+{
+	if (cls < 0 || cls >= EXWORD_STAT_MAX)
+		return NULL;
+	return stat_names[cls];
+}
+
+/** @ingroup misc
+ * Enables tracing.
+ * This function keeps the last records protocol events, such as packets
+ * sent and received, sequence echoes, resends and response codes, in a
+ * ring of fixed size binary records. Recording costs no formatting, so
+ * tracing can stay enabled to catch intermittent failures. The ring is
+ * kept across connections and saved with \ref exword_write_trace.
+ * Events above the level given to configure with --with-trace-level are
+ * not compiled in.
+ * @param self device handle
+ * @param records number of events kept (rounded up to a power of two)
+ * or 0 to disable tracing
+ * @return response code
+ */
+int exword_set_trace(exword_t *self, unsigned int records)
+{
+	struct obex_trace *trace = NULL;
+	if (exword_forwarded(self))
+		return exword_call(self, run_set_trace, ARG(records), NULL, NULL, NULL);
+	if (records) {
+		trace = obex_trace_new(records);
+		if (trace == NULL)
+			return EXWORD_ERROR_NO_MEM;
+	}
+	free(self->trace);
+	self->trace = trace;
+	if (self->obex_ctx)
+		self->obex_ctx->trace = trace;
+	return EXWORD_SUCCESS;
+}
+
+/** @ingroup misc
+ * Saves the trace.
+ * This function writes the events recorded since \ref exword_set_trace
+ * to a file, it can be rendered with exword-trace.
+ * @param self device handle
+ * @param filename file to write
+ * @return response code
+ */
+int exword_write_trace(exword_t *self, const char *filename)
+{
+	if (exword_forwarded(self))
+		return exword_call(self, run_write_trace, (void *)filename, NULL, NULL, NULL);
+	FILE *fp;
+	int ret;
+	if (self->trace == NULL)
+		return EXWORD_ERROR_OTHER;
+	fp = fopen(filename, "wb");
+	if (fp == NULL)
+		return EXWORD_ERROR_OTHER;
+	ret = obex_trace_write(self->trace, fp);
+	if (fclose(fp) != 0)
+		ret = -1;
+	return ret < 0 ? EXWORD_ERROR_OTHER : EXWORD_SUCCESS;
+}
 
 /** @ingroup misc
  * Converts error code to string
@@ -161,6 +161,114 @@ enum exword_disconnect {
 	EXWORD_DISCONNECT_ERROR = 4,
 };
 
+/** @ingroup misc
+ * Request classes.
+ * Statistics returned by \ref exword_get_stats are kept for each of these.
+ */
+enum exword_stat_class {
+	/** Connect requests */
+	EXWORD_STAT_CONNECT = 0,
+	/** Disconnect requests */
+	EXWORD_STAT_DISCONNECT,
+	/** Changes of the current directory */
+	EXWORD_STAT_SETPATH,
+	/** File downloads */
+	EXWORD_STAT_GET,
+	/** File uploads */
+	EXWORD_STAT_PUT,
+	/** _Remove command */
+	EXWORD_STAT_REMOVE,
+	/** _Model command */
+	EXWORD_STAT_MODEL,
+	/** _Cap command */
+	EXWORD_STAT_CAPACITY,
+	/** _List command */
+	EXWORD_STAT_LIST,
+	/** _SdFormat command */
+	EXWORD_STAT_SDFORMAT,
+	/** _UserId command */
+	EXWORD_STAT_USERID,
+	/** _CryptKey command */
+	EXWORD_STAT_CRYPTKEY,
+	/** _CName command */
+	EXWORD_STAT_CNAME,
+	/** _Unlock command */
+	EXWORD_STAT_UNLOCK,
+	/** _Lock command */
+	EXWORD_STAT_LOCK,
+	/** _AuthChallenge command */
+	EXWORD_STAT_AUTHCHALLENGE,
+	/** _AuthInfo command */
+	EXWORD_STAT_AUTHINFO,
+	/** Number of request classes */
+	EXWORD_STAT_MAX,
+};
+
+/** @ingroup misc
+ * Number of latency histogram buckets.
+ * Bucket n counts requests that took less than 128 << n microseconds
+ * (and at least 128 << (n - 1)), the last bucket counts all slower ones.
+ */
+#define EXWORD_STAT_BUCKETS 16
+
+/**
+ * Structure representing the statistics of a request class.
+ * Times are in microseconds.
+ */
+typedef struct {
+	/** Requests made */
+	uint32_t requests;
+	/** Requests not answered with success */
+	uint32_t errors;
+	/** Packets sent, resent packets included */
+	uint32_t packets_tx;
+	/** Responses received */
+	uint32_t packets_rx;
+	/** Bytes sent */
+	uint64_t bytes_tx;
+	/** Bytes received */
+	uint64_t bytes_rx;
+	/** Packets sent again after a link error */
+	uint32_t retries;
+	/** Time spent writing packets to the USB bus */
+	uint64_t usb_time;
+	/** Time between a packet written and its sequence number echoed */
+	uint64_t seq_wait;
+	/** Time between the sequence echo and the complete response */
+	uint64_t device_time;
+	/** Time spent assembling packets and parsing responses */
+	uint64_t host_time;
+	/** Total time of all requests */
+	uint64_t total_time;
+	/** Request latency histogram, see \ref EXWORD_STAT_BUCKETS */
+	uint32_t histogram[EXWORD_STAT_BUCKETS];
+} exword_stat_t;
+
+/**
+ * Structure identifying an attached device.
+ * Filled by \ref exword_list_devices and passed to \ref exword_connect_device.
+ */
+typedef struct {
+	/** USB bus number */
+	uint8_t bus;
+	/** Address on the bus, changes each time the device is plugged in */
+	uint8_t address;
+	/** Port path such as "1-4.2", the same as long as the hub port is */
+	char port[32];
+	/** Serial number, empty if the device has none */
+	char serial[64];
+} exword_device_t;
+
+/**
+ * Structure representing a file descriptor to wait on.
+ * Returned by \ref exword_get_pollfds.
+ */
+typedef struct {
+	/** File descriptor */
+	int fd;
+	/** Events to wait for, as in poll(2) */
+	short events;
+} exword_pollfd_t;
 
 /**
  * Structure representing a directory entry.
@@ -269,6 +377,28 @@ typedef struct {
  */
 typedef void (*file_cb)(char *filename, uint32_t transferred, uint32_t length, void *user_data);
 
+/** @ingroup misc
+ * Stream read function.
+ * Called to fill buffer with the next len bytes of the file being uploaded.
+ * @param buffer location to store the data
+ * @param len number of bytes requested
+ * @param user_data data pointer specified in \ref exword_send_stream
+ * @return number of bytes stored or negative value on error
+ * @see exword_send_stream
+ */
+typedef int (*read_cb)(char *buffer, int len, void *user_data);
+
+/** @ingroup misc
+ * Stream write function.
+ * Called with each piece of the file being downloaded.
+ * @param buffer received data
+ * @param len number of bytes in buffer
+ * @param user_data data pointer specified in \ref exword_get_stream
+ * @return negative value on error
+ * @see exword_get_stream
+ */
+typedef int (*write_cb)(const char *buffer, int len, void *user_data);
+
 /** @ingroup device
  * Disconnect notification function.
  * @param reason reason for disconnection
@@ -277,6 +407,52 @@ typedef void (*file_cb)(char *filename, uint32_t transferred, uint32_t length, v
  */
 typedef void (*disconnect_cb)(int reason, void *user_data);
 
+/** @ingroup device
+ * Hotplug notification function.
+ * @param device device that arrived or left
+ * @param arrived 1 if the device was attached, 0 if it was removed
+ * @param user_data data pointer specified in \ref exword_register_hotplug_callback
+ * @see exword_register_hotplug_callback
+ */
+typedef void (*hotplug_cb)(const exword_device_t *device, int arrived, void *user_data);
+
+/**
+ * Structure representing the outcome of an asynchronous command.
+ * Besides result only the fields written by the completed command are set.
+ */
+typedef struct {
+	/** Response code */
+	int result;
+	/** File read by \ref exword_get_file_async, must be freed by the application */
+	char *buffer;
+	/** Bytes read by \ref exword_get_file_async, \ref exword_get_file_into_async
+	 * or \ref exword_get_stream_async */
+	int len;
+	/** Entries read by \ref exword_list_async, must be freed with \ref exword_free_list */
+	exword_dirent_t *entries;
+	/** Number of entries */
+	uint16_t count;
+	/** Packet size chosen by \ref exword_calibrate_async, apply it with \ref exword_set_mtu */
+	uint16_t mtu;
+	/** Model read by \ref exword_get_model_async */
+	exword_model_t model;
+	/** Capacity read by \ref exword_get_capacity_async */
+	exword_capacity_t capacity;
+	/** Key generated by \ref exword_cryptkey_async */
+	exword_cryptkey_t cryptkey;
+	/** Authentication info of \ref exword_authinfo_async */
+	exword_authinfo_t authinfo;
+} exword_completion_t;
+
+/** @ingroup async
+ * Completion function.
+ * @param self device handle the command was sent to
+ * @param completion outcome of the command, only valid during the call
+ * @param user_data data pointer specified when the command was sent
+ * @see exword_handle_events
+ */
+typedef void (*complete_cb)(exword_t *self, exword_completion_t *completion, void *user_data);
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -291,19 +467,44 @@ char * exword_error_to_string(int code);
 
 exword_t * exword_init();
 void exword_deinit(exword_t *self);
+int exword_set_threaded(exword_t *self, int enable);
 int exword_is_connected(exword_t *self);
 void exword_set_debug(exword_t *self, int level);
 int exword_get_debug(exword_t *self);
+int exword_set_mtu(exword_t *self, uint16_t mtu);
+uint16_t exword_get_mtu(exword_t *self);
+int exword_set_retries(exword_t *self, int retries);
+int exword_get_retries(exword_t *self);
+void exword_set_pipelining(exword_t *self, int enable);
+int exword_get_pipelining(exword_t *self);
+int exword_get_stats(exword_t *self, int cls, exword_stat_t *stat);
+void exword_reset_stats(exword_t *self);
+const char * exword_stat_name(int cls);
+int exword_set_trace(exword_t *self, unsigned int records);
+int exword_write_trace(exword_t *self, const char *filename);
 void exword_register_xfer_callbacks(exword_t *self, file_cb get, void *get_data, file_cb put, void *put_data);
 void exword_register_xfer_get_callback(exword_t *self, file_cb callback, void *userdata);
 void exword_register_xfer_put_callback(exword_t *self, file_cb callback, void *userdata);
 void exword_register_disconnect_callback(exword_t *self, disconnect_cb disconnect, void *userdata);
 void exword_poll_disconnect(exword_t *self);
+int exword_get_pollfds(exword_t *self, exword_pollfd_t **fds, uint16_t *count);
+void exword_free_pollfds(exword_pollfd_t *fds);
+int exword_get_timeout(exword_t *self, int *timeout);
+
+int exword_list_devices(exword_device_t **devices, uint16_t *count);
+void exword_free_devices(exword_device_t *devices);
+int exword_register_hotplug_callback(hotplug_cb callback, void *userdata);
+int exword_poll_hotplug(int timeout);
 
 int exword_connect(exword_t *self, uint16_t options);
+int exword_connect_device(exword_t *self, const exword_device_t *device, uint16_t options);
 int exword_disconnect(exword_t *self);
 int exword_send_file(exword_t *self, char* filename, char *buffer, int len);
+int exword_send_stream(exword_t *self, char* filename, int len, read_cb reader, void *userdata);
 int exword_get_file(exword_t *self, char* filename, char **buffer, int *len);
+int exword_get_file_into(exword_t *self, char* filename, char *buffer, int size, int *len);
+int exword_get_stream(exword_t *self, char* filename, write_cb writer, void *userdata, int *len);
+int exword_calibrate(exword_t *self, uint8_t *path, char *filename, uint16_t *mtu);
 int exword_remove_file(exword_t *self, char* filename, int convert_to_unicode);
 int exword_get_model(exword_t *self, exword_model_t * model);
 int exword_get_capacity(exword_t *self, exword_capacity_t *cap);
@@ -319,6 +520,30 @@ int exword_lock(exword_t *self);
 int exword_authchallenge(exword_t *self, exword_authchallenge_t challenge);
 int exword_authinfo(exword_t *self, exword_authinfo_t *info);
 
+int exword_handle_events(exword_t *self, int timeout);
+int exword_connect_async(exword_t *self, uint16_t options, complete_cb callback, void *userdata);
+int exword_connect_device_async(exword_t *self, const exword_device_t *device, uint16_t options, complete_cb callback, void *userdata);
+int exword_disconnect_async(exword_t *self, complete_cb callback, void *userdata);
+int exword_send_file_async(exword_t *self, char* filename, char *buffer, int len, complete_cb callback, void *userdata);
+int exword_send_stream_async(exword_t *self, char* filename, int len, read_cb reader, void *reader_data, complete_cb callback, void *userdata);
+int exword_get_file_async(exword_t *self, char* filename, complete_cb callback, void *userdata);
+int exword_get_file_into_async(exword_t *self, char* filename, char *buffer, int size, complete_cb callback, void *userdata);
+int exword_get_stream_async(exword_t *self, char* filename, write_cb writer, void *writer_data, complete_cb callback, void *userdata);
+int exword_calibrate_async(exword_t *self, uint8_t *path, char *filename, complete_cb callback, void *userdata);
+int exword_remove_file_async(exword_t *self, char* filename, int convert_to_unicode, complete_cb callback, void *userdata);
+int exword_get_model_async(exword_t *self, complete_cb callback, void *userdata);
+int exword_get_capacity_async(exword_t *self, complete_cb callback, void *userdata);
+int exword_sd_format_async(exword_t *self, complete_cb callback, void *userdata);
+int exword_setpath_async(exword_t *self, uint8_t *path, uint8_t mkdir, complete_cb callback, void *userdata);
+int exword_list_async(exword_t *self, complete_cb callback, void *userdata);
+int exword_userid_async(exword_t *self, exword_userid_t id, complete_cb callback, void *userdata);
+int exword_cryptkey_async(exword_t *self, exword_cryptkey_t *key, complete_cb callback, void *userdata);
+int exword_cname_async(exword_t *self, char *name, char* dir, complete_cb callback, void *userdata);
+int exword_unlock_async(exword_t *self, complete_cb callback, void *userdata);
+int exword_lock_async(exword_t *self, complete_cb callback, void *userdata);
+int exword_authchallenge_async(exword_t *self, exword_authchallenge_t challenge, complete_cb callback, void *userdata);
+int exword_authinfo_async(exword_t *self, exword_authinfo_t *info, complete_cb callback, void *userdata);
+
 #ifdef __cplusplus
 }
 #endif
@@ -18,11 +18,15 @@
  *
  */
 
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <inttypes.h>
 #include <locale.h>
+#include <time.h>
 #include <libgen.h>
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -34,6 +38,8 @@ void quit(struct state *s);
 void help(struct state *s);
 void connect(struct state *s);
 void disconnect(struct state *s);
+void devices(struct state *s);
+void watch(struct state *s);
 void set(struct state *s);
 void model(struct state *s);
 void capacity(struct state *s);
@@ -42,6 +48,9 @@ void list(struct state *s);
 void delete(struct state *s);
 void send(struct state *s);
 void get(struct state *s);
+void calibrate(struct state *s);
+void stats(struct state *s);
+void trace(struct state *s);
 void setpath(struct state *s);
 void content(struct state *s);
 
@@ -55,6 +64,12 @@ struct command commands[] = {
 	"library - connect as CASIO Library (default)\n"
 	"text    - connect as Textloader\n"
 	"cd      - connect as CDLoader\n", 0x700},
+{"devices", devices, "devices\t\t\t- list attached dictionaries\n",
+	"Lists the attached dictionaries with their bus, address, port and\n"
+	"serial number. Use 'set device' to choose the one to connect to.\n", 0x700},
+{"watch", watch, "watch [seconds]\t\t- report dictionaries plugged in or out\n",
+	"Reports attached dictionaries, then the ones plugged in or out\n"
+	"during the given number of seconds (default: 10).\n", 0x700},
 {"disconnect", disconnect, "disconnect\t\t- disconnect from dictionary\n",
 	"Disconnects from device.\n", 0x700},
 {"model", model, "model\t\t\t- display model information\n",
@@ -73,6 +88,27 @@ struct command commands[] = {
 	"Uploads a file to dicionary.\n", 0x700},
 {"get", get, "get <filename>\t\t- download a file\n",
 	"Downloads a file from dicionary.\n", 0x700},
+{"calibrate", calibrate, "calibrate <filename>\t- find fastest packet size\n",
+	"Finds the packet size giving the fastest downloads.\n\n"
+	"<filename> is downloaded from the current path once for each size\n"
+	"tried, it should be a few hundred kilobytes large. The device is\n"
+	"reconnected for each size so authentication has to be repeated.\n"
+	"The result is stored for the model and used on later connects.\n", 0x700},
+{"stats", stats, "stats [reset|<request>]\t- display request statistics\n",
+	"Displays counters and times of the requests made so far, for each\n"
+	"kind of request. Times are split into writing packets (usb), waiting\n"
+	"for the sequence echo (seq), waiting for the response (dev) and\n"
+	"assembling and parsing packets (host).\n\n"
+	"reset     - clears the statistics\n"
+	"<request> - displays the latency histogram of one kind of request\n", 0x700},
+{"trace", trace, "trace <sub-function>\t- record protocol events\n",
+	"Records packets, sequence echoes and resends in a ring of the last\n"
+	"events. Recording is cheap enough to leave on during transfers.\n"
+	"Saved traces are displayed with exword-trace.\n\n"
+	"Sub functions:\n"
+	"on [events]     - starts recording (default: 65536 events)\n"
+	"off             - stops recording and drops the events\n"
+	"save <filename> - writes the recorded events to a file\n", 0x700},
 {"setpath", setpath, "setpath <path>\t\t- changes directory on dictionary\n",
 	"Changes to the the specified path.\n\n"
 	"<path> is in the form of <device>://<path>\n"
@@ -106,7 +142,11 @@ struct command commands[] = {
 	"Sets <option> to [value], if no value is specified will display current value.\n\n"
 	"Available options:\n"
 	"debug <level>  - sets debug level (0-5)\n"
-	"mkdir <on|off> - specifies whether setpath should create directories\n", 0x700},
+	"mkdir <on|off> - specifies whether setpath should create directories\n"
+	"mtu <size>     - sets packet size used on next connect (0 = auto)\n"
+	"device <port|serial|any> - sets the dictionary used on next connect\n"
+	"retries <n>    - resend a lost packet up to n times (experimental, 0 = off)\n"
+	"pipeline <on|off> - send packets before the previous answer (experimental)\n", 0x700},
 {"exit", quit, "exit\t\t\t- exits program\n",
 	"Exits program and disconnects from device.\n", 0x700},
 {"help", help, NULL, NULL, 0x700},
@@ -218,6 +258,22 @@ int _setpath(struct state *s, char* device, char *pathname, int mkdir)
 	return rsp;
 }
 
+/* Reconnects with the packet size calibrate stored for this model */
+int _connect_model_mtu(struct state *s, int options)
+{
+	exword_model_t model;
+	uint16_t mtu;
+	if (s->mtu != 0)
+		return EXWORD_SUCCESS;
+	memset(&model, 0, sizeof(model));
+	if (exword_get_model(s->device, &model) != EXWORD_SUCCESS ||
+	    !load_model_mtu(&model, &mtu) || mtu == exword_get_mtu(s->device))
+		return EXWORD_SUCCESS;
+	exword_set_mtu(s->device, mtu);
+	exword_disconnect(s->device);
+	return exword_connect_device(s->device, &s->target, options);
+}
+
 void quit(struct state *s)
 {
 	s->running = 0;
@@ -302,7 +358,9 @@ void connect(struct state *s)
 	}
 	if (!error) {
 		printf("connecting to device...");
-		if (exword_connect(s->device, options) != EXWORD_SUCCESS) {
+		exword_set_mtu(s->device, s->mtu);
+		if (exword_connect_device(s->device, &s->target, options) != EXWORD_SUCCESS ||
+		    _connect_model_mtu(s, options) != EXWORD_SUCCESS) {
 			printf("device not found\n");
 		} else {
 			if (exword_setpath(s->device, "", 0) == EXWORD_SUCCESS) {
@@ -320,6 +378,52 @@ void connect(struct state *s)
 	}
 }
 
+void devices(struct state *s)
+{
+	exword_device_t *list;
+	uint16_t count;
+	int i;
+	if (exword_list_devices(&list, &count) != EXWORD_SUCCESS) {
+		printf("Failed to list devices\n");
+		return;
+	}
+	for (i = 0; i < count; i++)
+		printf("bus %03u address %03u port %-12s serial %s\n", list[i].bus,
+		       list[i].address, list[i].port, list[i].serial);
+	if (count == 0)
+		printf("No devices found\n");
+	exword_free_devices(list);
+}
+
+void watch_notify(const exword_device_t *device, int arrived, void *data)
+{
+	printf("%s bus %03u address %03u port %-12s serial %s\n",
+	       arrived ? "attached" : "removed ", device->bus, device->address,
+	       device->port, device->serial);
+}
+
+void watch(struct state *s)
+{
+	unsigned int seconds = 10;
+	time_t end;
+	char *arg;
+	arg = peek_arg(&(s->cmd_list));
+	if (arg != NULL && sscanf(arg, "%u", &seconds) < 1) {
+		printf("Invalid value\n");
+		return;
+	}
+	if (exword_register_hotplug_callback(watch_notify, NULL) != EXWORD_SUCCESS) {
+		printf("Hotplug not supported\n");
+		return;
+	}
+	end = time(NULL) + seconds;
+	do {
+		if (exword_poll_hotplug(500) != EXWORD_SUCCESS)
+			break;
+	} while (time(NULL) < end);
+	exword_register_hotplug_callback(NULL, NULL);
+}
+
 void disconnect(struct state *s)
 {
 	int i;
@@ -327,8 +431,6 @@ void disconnect(struct state *s)
 		return;
 	if (!s->disconnect_event)
 		printf("disconnecting...done\n");
-	else
-		rl_stuff_char('\n');
 	exword_disconnect(s->device);
 	free(s->cwd);
 	s->cwd = NULL;
@@ -393,7 +495,7 @@ void format(struct state *s)
 void send(struct state *s)
 {
 	int rsp, len;
-	char *buffer;
+	struct file_stream fs;
 	char *filename;
 	char *name = NULL;
 	if (!s->connected)
@@ -405,11 +507,12 @@ void send(struct state *s)
 		name = xmalloc(strlen(filename) + 1);
 		strcpy(name, filename);
 		printf("uploading...");
-		rsp = read_file(name, &buffer, &len);
-		if (rsp == 0)
-			rsp = exword_send_file(s->device, basename(name), buffer, len);
+		rsp = open_read_stream(&fs, name, NULL, &len);
+		if (rsp == 0) {
+			rsp = exword_send_stream(s->device, basename(name), len, read_stream, &fs);
+			close_stream(&fs);
+		}
 		free(name);
-		free(buffer);
 		printf("%s\n", exword_error_to_string(rsp));
 	}
 }
@@ -417,7 +520,8 @@ void send(struct state *s)
 void get(struct state *s)
 {
 	int rsp, len;
-	char *buffer = NULL, *name = NULL;
+	struct file_stream fs;
+	char *name = NULL;
 	char *filename;
 	if (!s->connected)
 		return;
@@ -428,15 +532,128 @@ void get(struct state *s)
 		name = xmalloc(strlen(filename) + 1);
 		strcpy(name, filename);
 		printf("downloading...");
-		rsp = exword_get_file(s->device, basename(name), &buffer, &len);
-		if (rsp == EXWORD_SUCCESS)
-			rsp = write_file(filename, buffer, len);
+		rsp = open_write_stream(&fs, filename, NULL);
+		if (rsp == 0) {
+			rsp = exword_get_stream(s->device, basename(name), write_stream, &fs, &len);
+			if (rsp == EXWORD_SUCCESS && commit_stream(&fs) != 0)
+				rsp = EXWORD_ERROR_OTHER;
+			close_stream(&fs);
+		}
 		free(name);
-		free(buffer);
 		printf("%s\n", exword_error_to_string(rsp));
 	}
 }
 
+void calibrate(struct state *s)
+{
+	int rsp;
+	uint16_t mtu;
+	exword_model_t model;
+	char *filename;
+	if (!s->connected)
+		return;
+	filename = peek_arg(&(s->cmd_list));
+	if (filename == NULL) {
+		printf("No file specified\n");
+		return;
+	}
+	printf("calibrating...");
+	rsp = exword_calibrate(s->device, (uint8_t *)s->cwd, filename, &mtu);
+	s->authenticated = 0;
+	if (rsp == EXWORD_SUCCESS) {
+		printf("done\nPacket size: %u\n", mtu);
+		s->mtu = 0;
+		memset(&model, 0, sizeof(model));
+		if (exword_get_model(s->device, &model) != EXWORD_SUCCESS ||
+		    !save_model_mtu(&model, mtu))
+			printf("Failed to store packet size\n");
+	} else {
+		printf("%s\n", exword_error_to_string(rsp));
+	}
+	if (!exword_is_connected(s->device))
+		disconnect(s);
+}
+
+void stats(struct state *s)
+{
+	exword_stat_t stat;
+	char *arg;
+	int i, cls;
+	arg = peek_arg(&(s->cmd_list));
+	if (arg != NULL && strcmp(arg, "reset") == 0) {
+		exword_reset_stats(s->device);
+		return;
+	}
+	if (arg != NULL) {
+		for (cls = 0; cls < EXWORD_STAT_MAX; cls++) {
+			if (strcmp(arg, exword_stat_name(cls)) == 0)
+				break;
+		}
+		if (exword_get_stats(s->device, cls, &stat) != EXWORD_SUCCESS) {
+			printf("Unknown request class %s\n", arg);
+			return;
+		}
+		for (i = 0; i < EXWORD_STAT_BUCKETS; i++) {
+			if (stat.histogram[i] == 0)
+				continue;
+			if (i < EXWORD_STAT_BUCKETS - 1)
+				printf("< %8u us: %u\n", 128 << i, stat.histogram[i]);
+			else
+				printf(">= %7u us: %u\n", 128 << (i - 1), stat.histogram[i]);
+		}
+		return;
+	}
+	printf("%-14s %5s %4s %6s %6s %10s %10s %5s %8s %8s %8s %8s %8s\n",
+	       "request", "count", "err", "tx", "rx", "tx bytes", "rx bytes",
+	       "retry", "usb ms", "seq ms", "dev ms", "host ms", "total ms");
+	for (cls = 0; cls < EXWORD_STAT_MAX; cls++) {
+		exword_get_stats(s->device, cls, &stat);
+		if (stat.requests == 0)
+			continue;
+		printf("%-14s %5u %4u %6u %6u %10"PRIu64" %10"PRIu64" %5u %8"PRIu64" %8"PRIu64" %8"PRIu64" %8"PRIu64" %8"PRIu64"\n",
+		       exword_stat_name(cls), stat.requests, stat.errors,
+		       stat.packets_tx, stat.packets_rx, stat.bytes_tx, stat.bytes_rx,
+		       stat.retries, stat.usb_time / 1000, stat.seq_wait / 1000,
+		       stat.device_time / 1000, stat.host_time / 1000,
+		       stat.total_time / 1000);
+	}
+}
+
+void trace(struct state *s)
+{
+	unsigned int records = 65536;
+	char *arg;
+	int rsp;
+	arg = peek_arg(&(s->cmd_list));
+	if (arg == NULL) {
+		printf("No sub-function specified\n");
+	} else if (strcmp(arg, "on") == 0) {
+		dequeue_arg(&(s->cmd_list));
+		arg = peek_arg(&(s->cmd_list));
+		if (arg != NULL && (sscanf(arg, "%u", &records) < 1 || records == 0)) {
+			printf("Invalid value\n");
+			return;
+		}
+		rsp = exword_set_trace(s->device, records);
+		if (rsp != EXWORD_SUCCESS)
+			printf("%s\n", exword_error_to_string(rsp));
+	} else if (strcmp(arg, "off") == 0) {
+		exword_set_trace(s->device, 0);
+	} else if (strcmp(arg, "save") == 0) {
+		dequeue_arg(&(s->cmd_list));
+		arg = peek_arg(&(s->cmd_list));
+		if (arg == NULL) {
+			printf("No filename specified\n");
+			return;
+		}
+		rsp = exword_write_trace(s->device, arg);
+		if (rsp != EXWORD_SUCCESS)
+			printf("Failed to save trace to %s\n", arg);
+	} else {
+		printf("Unknown sub-function %s\n", arg);
+	}
+}
+
 void delete(struct state *s)
 {
 	int rsp;
@@ -693,6 +910,76 @@ void set(struct state *s)
 				printf("Invalid value\n");
 			}
 		}
+	} else if (strcmp(opt, "mtu") == 0) {
+		uint16_t mtu;
+		dequeue_arg(&(s->cmd_list));
+		arg = peek_arg(&(s->cmd_list));
+		if (arg == NULL) {
+			printf("MTU: %u\n", exword_get_mtu(s->device));
+		} else {
+			if (sscanf(arg, "%hu", &mtu) < 1) {
+				printf("Invalid value\n");
+			} else if (exword_set_mtu(s->device, mtu) != EXWORD_SUCCESS) {
+				printf("Value should be 0 or between 255 and 65535\n");
+			} else {
+				s->mtu = mtu;
+			}
+		}
+	} else if (strcmp(opt, "device") == 0) {
+		exword_device_t *list;
+		uint16_t count;
+		int i;
+		dequeue_arg(&(s->cmd_list));
+		arg = peek_arg(&(s->cmd_list));
+		if (arg == NULL) {
+			if (s->target.port[0] == '\0')
+				printf("Device: any\n");
+			else
+				printf("Device: %s %s\n", s->target.port, s->target.serial);
+		} else if (strcmp(arg, "any") == 0) {
+			memset(&s->target, 0, sizeof(s->target));
+		} else if (exword_list_devices(&list, &count) == EXWORD_SUCCESS) {
+			for (i = 0; i < count; i++) {
+				if (strcmp(arg, list[i].port) == 0 ||
+				    strcmp(arg, list[i].serial) == 0)
+					break;
+			}
+			if (i < count)
+				s->target = list[i];
+			else
+				printf("Device %s not found\n", arg);
+			exword_free_devices(list);
+		}
+	} else if (strcmp(opt, "retries") == 0) {
+		int retries;
+		dequeue_arg(&(s->cmd_list));
+		arg = peek_arg(&(s->cmd_list));
+		if (arg == NULL) {
+			printf("Retries: %d\n", exword_get_retries(s->device));
+		} else {
+			if (sscanf(arg, "%d", &retries) < 1 ||
+			    exword_set_retries(s->device, retries) != EXWORD_SUCCESS) {
+				printf("Invalid value\n");
+			}
+		}
+	} else if (strcmp(opt, "pipeline") == 0) {
+		dequeue_arg(&(s->cmd_list));
+		arg = peek_arg(&(s->cmd_list));
+		if (arg == NULL) {
+			printf("Pipeline: %u\n", exword_get_pipelining(s->device));
+		} else {
+			if (strcmp(arg, "on") == 0 ||
+			    strcmp(arg, "yes") == 0 ||
+			    strcmp(arg, "true") == 0) {
+				exword_set_pipelining(s->device, 1);
+			} else if (strcmp(arg, "off") == 0 ||
+				   strcmp(arg, "no") == 0 ||
+				   strcmp(arg, "false") == 0) {
+				exword_set_pipelining(s->device, 0);
+			} else {
+				printf("Invalid value\n");
+			}
+		}
 	} else {
 		printf("Unknown option %s\n", opt);
 	}
@@ -730,18 +1017,73 @@ char * create_prompt(char *cwd) {
 	return p;
 }
 
-int do_events()
+void update_prompt(struct state *s)
+{
+	char *prompt = create_prompt(s->cwd);
+	rl_set_prompt(prompt);
+	free(prompt);
+}
+
+void handle_line(char *line)
 {
-	if (st->device) {
-		exword_poll_disconnect(st->device);
-		if (st->disconnect_event)
-			disconnect(st);
+	if (line != NULL && *line != '\0') {
+		add_history(line);
+		fill_arg_list(&(st->cmd_list), line);
+		process_command(st);
+		clear_arg_list(&(st->cmd_list));
 	}
+	free(line);
+	/* Keeps readline from showing the prompt again */
+	if (!st->running)
+		rl_callback_handler_remove();
+	else
+		update_prompt(st);
+}
+
+void do_events(struct state *s)
+{
+	exword_handle_events(s->device, 0);
+	if (s->disconnect_event) {
+		disconnect(s);
+		update_prompt(s);
+		rl_on_new_line();
+		rl_redisplay();
+	}
+}
+
+/* Waits for input and for events of the device, which only wakes us up
+   once a transfer completes or the device is unplugged */
+int wait_events(struct state *s)
+{
+	struct pollfd fds[16];
+	exword_pollfd_t *list;
+	uint16_t count = 0;
+	int i, n = 1, timeout = -1, ret;
+
+	fds[0].fd = fileno(rl_instream ? rl_instream : stdin);
+	fds[0].events = POLLIN;
+	if (exword_get_pollfds(s->device, &list, &count) == EXWORD_SUCCESS) {
+		for (i = 0; i < count && n < 16; i++, n++) {
+			fds[n].fd = list[i].fd;
+			fds[n].events = list[i].events;
+		}
+		exword_free_pollfds(list);
+	}
+	exword_get_timeout(s->device, &timeout);
+	ret = poll(fds, n, timeout);
+	if (ret < 0)
+		return errno == EINTR ? 0 : -1;
+	if (fds[0].revents)
+		rl_callback_read_char();
+	for (i = 1; i < n && fds[i].revents == 0; i++)
+		;
+	if (s->running && (ret == 0 || i < n))
+		do_events(s);
+	return 0;
 }
 
 void interactive(struct state *s)
 {
-	char * line = NULL;
 	char * prompt = NULL;
 	printf("Exword dictionary tool.\n"
 	       "Type 'help' for a list of commands.\n");
@@ -752,23 +1094,16 @@ void interactive(struct state *s)
 	s->device = exword_init();
 	exword_register_disconnect_callback(s->device, disconnect_notify, s);
 	exword_set_debug(s->device, s->debug);
-	rl_set_keyboard_input_timeout(10000);
-	rl_event_hook = do_events;
 	st = s;
+	prompt = create_prompt(s->cwd);
+	rl_callback_handler_install(prompt, handle_line);
+	free(prompt);
 	while (s->running) {
-		free(line);
-		free(prompt);
-		prompt = create_prompt(s->cwd);
-		line = readline(prompt);
-		if (line == NULL || *line == '\0')
-			continue;
-		add_history(line);
-		fill_arg_list(&(s->cmd_list), line);
-		process_command(s);
-		clear_arg_list(&(s->cmd_list));
+		if (wait_events(s) < 0) {
+			rl_callback_handler_remove();
+			break;
+		}
 	}
-	free(line);
-	free(prompt);
 	store_history();
 	exword_deinit(s->device);
 }
@@ -32,6 +32,8 @@ struct state {
 	int connected;
 	int debug;
 	int mkdir;
+	uint16_t mtu;
+	exword_device_t target;	/* Device to connect to, empty for any */
 	int authenticated;
 	int disconnect_event;
 	char *cwd;
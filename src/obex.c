@@ -29,115 +29,379 @@
 #include <string.h>
 
 #include "obex.h"
+#include "probes.h"
 
-static int obex_bulk_read(obex_t *self, buf_t *msg)
+static uint64_t obex_time(void)
 {
-	int retval, actual_length;
-	int expected_length;
-	char * buffer;
-	DEBUG(self, 4, "Read from endpoint %d\n", self->read_endpoint_address);
-	if (msg->data_size > 0 && ntohs(*((uint16_t*)(msg->data + 1))) == msg->data_size)
-		return msg->data_size;
-	do {
-		buffer = buf_reserve_end(msg, self->mtu_rx);
-		retval = libusb_bulk_transfer(self->usb_dev, self->read_endpoint_address, buffer, self->mtu_rx, &actual_length, 1245);
-		buf_remove_end(msg, self->mtu_rx - actual_length);
-		expected_length = ntohs(*((uint16_t*)(msg->data + 1)));
-	} while ((expected_length != msg->data_size && retval == 0) ||
-		 (actual_length == 0 && retval == 0));
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Deadline of a response read starting now */
+static uint64_t obex_deadline(void)
+{
+	return obex_time() + OBEX_TIMEOUT * 1000;
+}
+
+static int obex_transfer_write(obex_t *self, uint8_t *buffer, int length)
+{
+	if (self->trans.link_lost)
+		return OBEX_XFER_NO_DEVICE;
+	pthread_mutex_lock(&self->capture_lock);
+	self->capture_seq = buffer[0];
+	pthread_mutex_unlock(&self->capture_lock);
+	self->tx_xfer.buffer = buffer;
+	self->tx_xfer.length = length;
+	self->stats.packets_tx++;
+	self->stats.bytes_tx += length;
+	return self->trans.ops->write(&self->trans, &self->tx_xfer);
+}
+
+static void obex_capture_stop(obex_t *self)
+{
+	if (self->capture)
+		fclose(self->capture);
+	self->capture = NULL;
+}
+
+/* Completion callback of all transfers, it may run on any thread that
+   handles libusb events */
+static void obex_capture_xfer(struct obex_xfer *xfer)
+{
+	obex_t *self = xfer->user_data;
+	struct obex_capture_rec rec;
+	struct timeval now;
+	pthread_mutex_lock(&self->capture_lock);
+	if (self->capture == NULL) {
+		pthread_mutex_unlock(&self->capture_lock);
+		return;
+	}
+	gettimeofday(&now, NULL);
+	rec.dir = xfer == &self->tx_xfer ? OBEX_CAPTURE_TX : OBEX_CAPTURE_RX;
+	rec.seq = self->capture_seq;
+	rec.status = xfer->status;
+	rec.reserved = 0;
+	rec.delta = htonl((now.tv_sec - self->capture_time.tv_sec) * 1000000 +
+			  now.tv_usec - self->capture_time.tv_usec);
+	rec.len = htonl(xfer->actual_length);
+	self->capture_time = now;
+	if (fwrite(&rec, sizeof(rec), 1, self->capture) != 1 ||
+	    fwrite(xfer->buffer, 1, xfer->actual_length, self->capture) != xfer->actual_length) {
+		DEBUG(self, 1, "Error writing capture file, capture stopped\n");
+		obex_capture_stop(self);
+	}
+	pthread_mutex_unlock(&self->capture_lock);
+}
+
+/* Waits for xfer to complete, or until deadline (obex_time) unless it is
+ * 0. Returns OBEX_XFER_TIMEOUT with xfer still submitted if the deadline
+ * passed. When handling events fails the transfer is cancelled, when it
+ * keeps failing the transport is considered dead: the link is marked lost
+ * and the wait gives up with xfer still submitted. */
+static int obex_transfer_wait_until(obex_t *self, struct obex_xfer *xfer, uint64_t deadline)
+{
+	struct timeval tv, *tvp = NULL;
+	uint64_t now;
+	int retval, errors = 0;
+	while (!xfer->completed) {
+		if (deadline) {
+			now = obex_time();
+			if (now >= deadline)
+				return OBEX_XFER_TIMEOUT;
+			tv.tv_sec = (deadline - now) / 1000000;
+			tv.tv_usec = (deadline - now) % 1000000;
+			tvp = &tv;
+		}
+		retval = self->trans.ops->handle_events(&self->trans, tvp, &xfer->completed);
+		if (retval == 0)
+			continue;
+		DEBUG(self, 1, "Error handling events (%d)\n", retval);
+		if (++errors >= OBEX_EVENT_ERRORS) {
+			DEBUG(self, 1, "Transport failed, giving up\n");
+			self->trans.link_lost = 1;
+			return OBEX_XFER_ERROR;
+		}
+		if (errors == 1)
+			self->trans.ops->cancel(&self->trans, xfer);
+	}
+	return 0;
+}
+
+static int obex_transfer_wait(obex_t *self, struct obex_xfer *xfer, int *actual_length)
+{
+	int retval;
+	retval = obex_transfer_wait_until(self, xfer, 0);
+	if (retval < 0) {
+		*actual_length = 0;
+		return retval;
+	}
+	*actual_length = xfer->actual_length;
+	return xfer->status;
+}
+
+static void obex_transfer_cancel(obex_t *self, struct obex_xfer *xfer)
+{
+	int actual_length;
+	if (xfer->completed)
+		return;
+	self->trans.ops->cancel(&self->trans, xfer);
+	obex_transfer_wait(self, xfer, &actual_length);
+}
+
+/* The receive ring: IN transfers stay posted and complete in the order
+ * they were submitted (rx_order). Their data forms the byte stream in
+ * rx_msg, so the sequence echo and the response following it do not each
+ * cost a transfer round trip. A transfer completing while rx_msg is empty
+ * hands its buffer over to rx_msg instead of being copied, only data
+ * continuing a response is appended. Ring transfers have no timeout of
+ * their own, one posted long before a request must not expire in the
+ * middle of it. Readers pass obex_rx_fill the deadline of the whole
+ * response, however many transfers it takes. */
+static int obex_rx_submit(obex_t *self, int slot)
+{
+	struct obex_xfer *xfer = &self->rx_xfer[slot];
+	uint8_t *buffer;
+	int ret;
+	/* A transfer abandoned by obex_transfer_wait may still be submitted */
+	if (self->trans.link_lost)
+		return OBEX_XFER_NO_DEVICE;
+	if (self->rx_size[slot] < self->mtu_rx) {
+		buffer = realloc(xfer->buffer, self->mtu_rx);
+		if (buffer == NULL)
+			return -1;
+		xfer->buffer = buffer;
+		self->rx_size[slot] = self->mtu_rx;
+	}
+	xfer->length = self->mtu_rx;
+	ret = self->trans.ops->read(&self->trans, xfer);
+	if (ret < 0)
+		return ret;
+	self->rx_order[self->rx_posted++] = slot;
+	return 0;
+}
+
+static void obex_rx_pop(obex_t *self)
+{
+	self->rx_posted--;
+	memmove(self->rx_order, self->rx_order + 1, self->rx_posted * sizeof(self->rx_order[0]));
+}
+
+static int obex_rx_idle(obex_t *self, int slot)
+{
+	int i;
+	for (i = 0; i < self->rx_posted; i++) {
+		if (self->rx_order[i] == slot)
+			return 0;
+	}
+	return 1;
+}
+
+/* Posts every slot of the ring. Transfers that completed while no
+ * request was outstanding only hold errors or stale data. */
+static int obex_rx_post(obex_t *self)
+{
+	struct obex_xfer *xfer;
+	int i, n, slot, ret;
+	n = self->rx_posted;
+	for (i = 0; i < n && self->rx_xfer[self->rx_order[0]].completed; i++) {
+		slot = self->rx_order[0];
+		xfer = &self->rx_xfer[slot];
+		if (xfer->actual_length > 0)
+			DEBUG(self, 3, "Dropping %d stale bytes\n", xfer->actual_length);
+		obex_rx_pop(self);
+		ret = obex_rx_submit(self, slot);
+		if (ret < 0)
+			return ret;
+	}
+	for (slot = 0; slot < OBEX_RX_RING; slot++) {
+		if (!obex_rx_idle(self, slot))
+			continue;
+		ret = obex_rx_submit(self, slot);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/* Cancelling one of several queued IN transfers may lose data or let
+ * the next transfer receive it (see the libusb documentation on
+ * transfer cancellation), so the stream cannot be trusted any more.
+ * Every posted transfer is cancelled, newest first so that none of them
+ * picks up data behind an older one, and what was received is dropped.
+ * The sequence check resynchronises with the device. */
+static void obex_rx_reset(obex_t *self)
+{
+	while (self->rx_posted > 0) {
+		obex_transfer_cancel(self, &self->rx_xfer[self->rx_order[self->rx_posted - 1]]);
+		self->rx_posted--;
+	}
+	buf_reuse(self->rx_msg);
+}
+
+/* Reads from the ring until rx_msg holds at least size bytes. A transfer
+ * still pending at deadline stays posted and keeps its place. */
+static int obex_rx_fill(obex_t *self, size_t size, uint64_t deadline)
+{
+	struct obex_xfer *xfer;
+	int slot, ret, empty = 0;
+	uint8_t *buffer;
+	size_t room;
+	while (self->rx_msg->data_size < size) {
+		if (self->rx_posted == 0)
+			return -1;
+		slot = self->rx_order[0];
+		xfer = &self->rx_xfer[slot];
+		DEBUG(self, 4, "Read %d bytes\n", xfer->length);
+		ret = obex_transfer_wait_until(self, xfer, deadline);
+		if (ret < 0)
+			return ret;
+		obex_rx_pop(self);
+		if (xfer->status == OBEX_XFER_CANCELLED) {
+			obex_rx_reset(self);
+			return OBEX_XFER_CANCELLED;
+		}
+		/* Data of a transfer ending in an error is still part of
+		   the stream */
+		if (xfer->actual_length > 0 && self->rx_msg->data_size == 0) {
+			/* The old storage of rx_msg is posted in its place */
+			room = self->rx_size[slot];
+			buf_exchange(self->rx_msg, &xfer->buffer, &room, xfer->actual_length);
+			self->rx_size[slot] = room;
+		} else if (xfer->actual_length > 0) {
+			buffer = buf_reserve_end(self->rx_msg, xfer->actual_length);
+			if (buffer == NULL)
+				return -1;
+			memcpy(buffer, xfer->buffer, xfer->actual_length);
+		} else if (xfer->status == OBEX_XFER_OK && ++empty >= 100) {
+			return -1;
+		}
+		ret = xfer->status;
+		if (ret != OBEX_XFER_NO_DEVICE && obex_rx_submit(self, slot) < 0)
+			return -1;
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/* Length of the response at the start of msg, it may be unaligned */
+static size_t obex_rsp_length(buf_t *msg)
+{
+	return (msg->data[1] << 8) | msg->data[2];
+}
+
+static int obex_bulk_read(obex_t *self, buf_t *msg, uint64_t deadline)
+{
+	int retval;
+	retval = obex_rx_fill(self, sizeof(struct obex_rsp_hdr), deadline);
+	if (retval == 0)
+		retval = obex_rx_fill(self, obex_rsp_length(msg), deadline);
 	if (retval == 0)
 		retval = msg->data_size;
 	return retval;
 }
 
-static int obex_bulk_write(obex_t *self, buf_t *msg)
+/* Skips a complete response at the start of rx_msg */
+static int obex_skip_response(obex_t *self, uint64_t deadline)
 {
-	int actual_length, retval;
-	DEBUG(self, 4, "Write to endpoint %d\n", self->write_endpoint_address);
-	retval = libusb_bulk_transfer(self->usb_dev, self->write_endpoint_address, msg->data, msg->data_size, &actual_length, 1245);
+	int retval;
+	retval = obex_rx_fill(self, sizeof(struct obex_rsp_hdr), deadline);
 	if (retval == 0)
-		retval = actual_length;
-	return retval;
+		retval = obex_rx_fill(self, obex_rsp_length(self->rx_msg), deadline);
+	if (retval < 0)
+		return retval;
+	buf_remove_begin(self->rx_msg, obex_rsp_length(self->rx_msg));
+	return 0;
 }
 
-static int obex_verify_seq(obex_t *self, uint8_t seq) {
-	int retval, actual_length = 0, count = 0;
-	char * buffer;
-	buffer = buf_reserve_end(self->rx_msg, self->mtu_rx);
-	do {
-		retval = libusb_bulk_transfer(self->usb_dev, self->read_endpoint_address, buffer, self->mtu_rx, &actual_length, 1245);
-		if (retval < 0)
-			break;
-		count++;
-	} while (count < 100 && actual_length == 0);
-	buf_remove_end(self->rx_msg, self->mtu_rx - actual_length);
-	if (retval < 0 || actual_length == 0) {
-		DEBUG(self, 4, "Error reading seq number (%d)\n",
-		      retval);
-		return 0;
-	}
-	if ((uint8_t)buffer[0] != seq) {
-		DEBUG(self, 4, "Sequence mismatch %u != %u\n",
-		      (uint8_t)buffer[0], seq);
+/* The answer to seq got lost but the device already answers the packet
+ * sent ahead, so it took seq. Packets are only sent ahead of one without
+ * the final bit, the lost answer was CONTINUE. */
+static int obex_answer_lost(obex_t *self, uint8_t seq)
+{
+	uint8_t *rsp;
+	DEBUG(self, 3, "Answer to %u lost, device is at %u\n", seq, seq + 1);
+	TRACE(self->trace, 1, OBEX_TRACE_ANSWER_LOST, seq, 0, 0, 0);
+	rsp = buf_reserve_begin(self->rx_msg, sizeof(struct obex_rsp_hdr));
+	if (rsp == NULL)
 		return 0;
+	rsp[0] = OBEX_RSP_CONTINUE | OBEX_FINAL;
+	rsp[1] = 0;
+	rsp[2] = sizeof(struct obex_rsp_hdr);
+	self->seq_check = seq;
+	return 1;
+}
+
+/* Reads the echo of seq. Repeated answers to the previous packet are
+ * skipped on the way, all within deadline. */
+static int obex_verify_seq(obex_t *self, uint8_t seq, uint64_t deadline) {
+	int retval;
+	for (;;) {
+		retval = obex_rx_fill(self, 1, deadline);
+		if (retval < 0) {
+			DEBUG(self, 4, "Error reading seq number (%d)\n",
+			      retval);
+			/* The answer may still arrive, it is skipped then */
+			self->seq_check = seq;
+			PROBE3(seq_verify, seq, retval, 0);
+			TRACE(self->trace, 3, OBEX_TRACE_SEQ_ERROR, seq, 0, 0, retval);
+			return 0;
+		}
+		if (self->rx_msg->data[0] == seq)
+			break;
+		if (self->tx_ahead && self->rx_msg->data[0] == (uint8_t)(seq + 1))
+			return obex_answer_lost(self, seq);
+		if (self->seq_check < 0 || self->rx_msg->data[0] != self->seq_check) {
+			DEBUG(self, 4, "Sequence mismatch %u != %u\n",
+			      self->rx_msg->data[0], seq);
+			PROBE3(seq_verify, seq, self->rx_msg->data[0], 0);
+			TRACE(self->trace, 3, OBEX_TRACE_SEQ_MISMATCH, seq, self->rx_msg->data[0], 0, 0);
+			buf_reuse(self->rx_msg);
+			return 0;
+		}
+		/* The previous packet was sent twice and this is the
+		   device answering it again */
+		DEBUG(self, 3, "Skipping repeated answer %u\n", self->seq_check);
+		buf_remove_begin(self->rx_msg, 1);
+		if (obex_skip_response(self, deadline) < 0)
+			return 0;
 	}
 	buf_remove_begin(self->rx_msg, 1);
+	self->seq_check = seq;
+	PROBE3(seq_verify, seq, seq, 1);
+	TRACE(self->trace, 3, OBEX_TRACE_SEQ_OK, seq, 0, 0, 0);
 	return 1;
 }
 
-static int obex_claim_interface(obex_t *ctx)
+static struct obex_header_element * obex_element_new(obex_t *self)
 {
-	struct libusb_config_descriptor *config = NULL;
-	const struct libusb_interface *intf;
-	const struct libusb_interface_descriptor *intf_desc;
-	const struct libusb_endpoint_descriptor *ep_desc;
-	int ret = 0;
-	int i, j, k;
-	ret = libusb_get_active_config_descriptor(libusb_get_device(ctx->usb_dev), &config);
-	if (ret < 0)
-		goto done;
-	for (i = 0; i < config->bNumInterfaces; i++) {
-		intf = &config->interface[i];
-		for (j = 0; j < intf->num_altsetting; j++) {
-			intf_desc = &intf->altsetting[j];
-			ctx->read_endpoint_address = 0;
-			ctx->write_endpoint_address = 0;
-			for (k = 0; k < intf_desc->bNumEndpoints; k++) {
-				ep_desc = &intf_desc->endpoint[k];
-				if ((ep_desc->bmAttributes & 3) == LIBUSB_TRANSFER_TYPE_BULK) {
-					if (!ctx->read_endpoint_address &&
-					    (ep_desc->bEndpointAddress & 0x80) == LIBUSB_ENDPOINT_IN)
-						ctx->read_endpoint_address = ep_desc->bEndpointAddress;
-					else if (!ctx->write_endpoint_address &&
-						 (ep_desc->bEndpointAddress & 0x80) == LIBUSB_ENDPOINT_OUT)
-						ctx->write_endpoint_address = ep_desc->bEndpointAddress;
-				} else if ((ep_desc->bmAttributes & 3) == LIBUSB_TRANSFER_TYPE_INTERRUPT) {
-					if (!ctx->interrupt_endpoint_address &&
-					    (ep_desc->bEndpointAddress & 0x80) == LIBUSB_ENDPOINT_IN)
-						ctx->interrupt_endpoint_address = ep_desc->bEndpointAddress;
-				}
-			}
-			if (ctx->read_endpoint_address && ctx->write_endpoint_address)
-				goto done;
-		}
-	}
-	ret = LIBUSB_ERROR_NOT_FOUND;
-done:
-	if (ret == 0) {
-		ctx->intf_num = intf_desc->bInterfaceNumber;
-		ret = libusb_claim_interface(ctx->usb_dev, ctx->intf_num);
-		if (ret == 0) {
-			ret = libusb_set_interface_alt_setting(ctx->usb_dev, ctx->intf_num, intf_desc->bAlternateSetting);
-			if (ret < 0)
-				libusb_release_interface(ctx->usb_dev, ctx->intf_num);
-		}
+	struct obex_header_element *element;
+
+	if (!list_empty(&self->free_elements)) {
+		element = list_entry(self->free_elements.next, struct obex_header_element, link);
+		list_del(&element->link);
+		self->free_element_count--;
+	} else {
+		element = malloc(sizeof(struct obex_header_element));
+		if (element == NULL)
+			return NULL;
 	}
-	if (config != NULL)
-		libusb_free_config_descriptor(config);
-	return ret;
+	memset(element, 0, sizeof(struct obex_header_element));
+	return element;
+}
+
+static void obex_element_free(obex_t *self, struct obex_header_element *element)
+{
+	buf_free(element->buf);
+	if (self->free_element_count < OBEX_FREE_ELEMENTS_MAX) {
+		list_add(&element->link, &self->free_elements);
+		self->free_element_count++;
+	} else
+		free(element);
 }
 
-static void free_headerq(struct list_head *list)
+static void free_headerq(obex_t *self, struct list_head *list)
 {
 	struct obex_header_element *h;
 	struct list_head *pos, *q;
@@ -145,63 +409,169 @@ static void free_headerq(struct list_head *list)
 	list_for_each_safe(pos, q, list){
 		h = list_entry(pos, struct obex_header_element, link);
 		list_del(pos);
-		buf_free(h->buf);
-		free(h);
+		obex_element_free(self, h);
 	}
 }
 
+static void free_pools(obex_t *self)
+{
+	struct list_head *pos, *q;
+
+	list_for_each_safe(pos, q, &self->free_objects){
+		list_del(pos);
+		free(list_entry(pos, obex_object_t, link));
+	}
+	list_for_each_safe(pos, q, &self->free_elements){
+		list_del(pos);
+		free(list_entry(pos, struct obex_header_element, link));
+	}
+	buf_free(self->spare_body);
+}
+
 static int send_body(obex_object_t *object,
 		     struct obex_header_element *h,
 		     buf_t *txmsg, unsigned int tx_left)
 {
 	struct obex_byte_stream_hdr *body_txh;
-	unsigned int actual;
+	const uint8_t *data = NULL;
+	unsigned int actual, remaining, fragment;
 
 	body_txh = (struct obex_byte_stream_hdr*) buf_reserve_end(txmsg, sizeof(struct obex_byte_stream_hdr));
 
-	if (!h->body_touched) {
-		/* This is the first time we try to send this header
-		   obex_object_addheaders has added a struct_byte_stream_hdr
-		   before the actual body-data. We shall send this in every fragment
-		   so we just remove it for now.*/
-
-		buf_remove_begin(h->buf,  sizeof(struct obex_byte_stream_hdr) );
-		h->body_touched = 1;
+	if (h->reader || (h->flags & OBEX_FL_NOCOPY)) {
+		/* Body is not held in h->buf, offset tracks
+		   how much of it has been sent already. */
+		if (h->data)
+			data = h->data + h->offset;
+		remaining = h->length - sizeof(struct obex_byte_stream_hdr) - h->offset;
+	} else {
+		if (!h->body_touched) {
+			/* This is the first time we try to send this header
+			   obex_object_addheaders has added a struct_byte_stream_hdr
+			   before the actual body-data. We shall send this in every fragment
+			   so we just remove it for now.*/
+
+			buf_remove_begin(h->buf,  sizeof(struct obex_byte_stream_hdr) );
+			h->body_touched = 1;
+		}
+		data = h->buf->data;
+		remaining = h->buf->data_size;
 	}
 
-	if (tx_left < ( h->buf->data_size +
+	if (tx_left < ( remaining +
 			sizeof(struct obex_byte_stream_hdr) ) )	{
 		DEBUG(object->context, 4, "Add BODY header\n");
 		body_txh->hi = OBEX_HDR_BODY;
-		body_txh->hl = htons((uint16_t)tx_left);
-
-		buf_insert_end(txmsg, h->buf->data, tx_left
-				- sizeof(struct obex_byte_stream_hdr) );
-
-		buf_remove_begin(h->buf, tx_left
-				- sizeof(struct obex_byte_stream_hdr) );
+		fragment = tx_left - sizeof(struct obex_byte_stream_hdr);
 		/* We have completely filled the tx-buffer */
 		actual = tx_left;
 	} else {
 		DEBUG(object->context, 4, "Add BODY_END header\n");
-
 		body_txh->hi = OBEX_HDR_BODY_END;
-		body_txh->hl = htons((uint16_t) (h->buf->data_size + sizeof(struct obex_byte_stream_hdr)));
-		buf_insert_end(txmsg, h->buf->data, h->buf->data_size);
-		actual = h->buf->data_size;
+		fragment = remaining;
+		actual = remaining;
+	}
+	body_txh->hl = htons((uint16_t) (fragment + sizeof(struct obex_byte_stream_hdr)));
+
+	if (h->reader) {
+		if (h->reader(buf_reserve_end(txmsg, fragment), fragment, h->reader_data) != (int)fragment) {
+			DEBUG(object->context, 1, "Body reader failed\n");
+			return -1;
+		}
+	} else {
+		buf_insert_end(txmsg, data, fragment);
+	}
 
+	if (fragment < remaining) {
+		if (h->buf)
+			buf_remove_begin(h->buf, fragment);
+		else
+			h->offset += fragment;
+	} else {
 		list_del(&h->link);
-		buf_free(h->buf);
-		free(h);
+		obex_element_free(object->context, h);
 	}
 
 	return actual;
 }
 
+static struct obex_header_view * obex_object_view(obex_object_t *object, int i)
+{
+	if (i < OBEX_MAX_RX_HEADERS)
+		return &object->rx_hdr[i];
+	return &object->rx_hdr_extra[i - OBEX_MAX_RX_HEADERS];
+}
+
+static struct obex_header_view * obex_object_new_view(obex_object_t *object)
+{
+	struct obex_header_view *view;
+	int size;
+
+	/* Rarely more headers arrive than fit the object */
+	if (object->rx_hdr_count >= OBEX_MAX_RX_HEADERS + object->rx_hdr_extra_size) {
+		size = object->rx_hdr_extra_size ? object->rx_hdr_extra_size * 2 : OBEX_MAX_RX_HEADERS;
+		DEBUG(object->context, 4, "Growing header views to %d\n", OBEX_MAX_RX_HEADERS + size);
+		view = realloc(object->rx_hdr_extra, size * sizeof(struct obex_header_view));
+		if (view == NULL)
+			return NULL;
+		object->rx_hdr_extra = view;
+		object->rx_hdr_extra_size = size;
+	}
+	view = obex_object_view(object, object->rx_hdr_count++);
+	memset(view, 0, sizeof(struct obex_header_view));
+	return view;
+}
+
+/* Copy a body fragment straight into the buffer set by
+   obex_object_set_body_buffer */
+static int obex_object_receive_direct(obex_object_t *object,
+				      uint8_t *source, unsigned int len)
+{
+	uint8_t *p;
+	unsigned int size;
+
+	if (!object->rx_body_buf) {
+		size = object->hinted_body_len;
+		if (size < len || size == 0)
+			size = len + OBEX_OBJECT_ALLOCATIONTRESHOLD;
+
+		DEBUG(object->context, 4, "Allocating body destination. Len=%d\n", size);
+		if (!(object->rx_body_buf = malloc(size)))
+			return -1;
+		object->rx_body_size = size;
+		object->rx_body_owned = 1;
+	}
+
+	if (object->rx_body_len + len > object->rx_body_size) {
+		if (!object->rx_body_owned) {
+			/* Keep draining the object so we stay in step with the
+			   device, rx_body_len ends up as the size needed. */
+			DEBUG(object->context, 1, "Body does not fit destination. Size=%d\n",
+			      object->rx_body_size);
+			object->rx_body_dropped = 1;
+			object->rx_body_len += len;
+			return 1;
+		}
+		/* Grow geometrically, the hint was missing or wrong */
+		size = object->rx_body_len + len;
+		if (size < object->rx_body_size * 2)
+			size = object->rx_body_size * 2;
+		DEBUG(object->context, 4, "Body destination too small. Go realloc\n");
+		if (!(p = realloc(object->rx_body_buf, size)))
+			return -1;
+		object->rx_body_buf = p;
+		object->rx_body_size = size;
+	}
+
+	memcpy(object->rx_body_buf + object->rx_body_len, source, len);
+	object->rx_body_len += len;
+	return 1;
+}
+
 static int obex_object_receive_body(obex_object_t *object, buf_t *msg, uint8_t hi,
 				uint8_t *source, unsigned int len)
 {
-	struct obex_header_element *element;
+	struct obex_header_view *view;
 
 	DEBUG(object->context, 4, "This is a body-header. Len=%d\n", len);
 
@@ -211,44 +581,60 @@ static int obex_object_receive_body(obex_object_t *object, buf_t *msg, uint8_t h
 		return -1;
 	}
 
+	if (object->rx_body_writer) {
+		/* Hand the fragment to the sink, after a failure the rest
+		   of the object is drained so we stay in step. */
+		if (!object->rx_body_dropped &&
+		    object->rx_body_writer(source, len, object->rx_body_data) < 0) {
+			DEBUG(object->context, 1, "Body writer failed\n");
+			object->rx_body_dropped = 1;
+		}
+		object->rx_body_len += len;
+		return 1;
+	}
+
+	if (object->rx_body_direct)
+		return obex_object_receive_direct(object, source, len);
+
+	object->rx_body_len += len;
+
 	if (!object->rx_body) {
 		int alloclen = OBEX_OBJECT_ALLOCATIONTRESHOLD + len;
 
 		if (object->hinted_body_len)
 			alloclen = object->hinted_body_len;
 
-		DEBUG(object->context, 4, "Allocating new body-buffer. Len=%d\n", alloclen);
-		if (!(object->rx_body = buf_new(alloclen)))
-			return -1;
+		if (object->context->spare_body) {
+			DEBUG(object->context, 4, "Reusing body-buffer. Len=%d\n", alloclen);
+			object->rx_body = buf_reuse(object->context->spare_body);
+			object->context->spare_body = NULL;
+		} else {
+			DEBUG(object->context, 4, "Allocating new body-buffer. Len=%d\n", alloclen);
+			if (!(object->rx_body = buf_new(alloclen)))
+				return -1;
+		}
 	}
 
 	/* Reallocate body buffer if needed */
-	if (object->rx_body->data_avail + object->rx_body->tail_avail < (int) len) {
-		int t;
-		DEBUG(object->context, 4, "Buffer too small. Go realloc\n");
-		t = buf_total_size(object->rx_body);
-		buf_resize(object->rx_body, t + OBEX_OBJECT_ALLOCATIONTRESHOLD + len);
-		if (buf_total_size(object->rx_body) != t + OBEX_OBJECT_ALLOCATIONTRESHOLD + len) {
-			DEBUG(object->context, 1, "Can't realloc rx_body\n");
-			return -1;
-		}
+	if (buf_grow(object->rx_body, len) < 0) {
+		DEBUG(object->context, 1, "Can't realloc rx_body\n");
+		return -1;
 	}
 
 	buf_insert_end(object->rx_body, source, len);
 
 	if (hi == OBEX_HDR_BODY_END) {
 		DEBUG(object->context, 4, "Body receive done\n");
-		if ( (element = malloc(sizeof(struct obex_header_element)) ) ) {
-			memset(element, 0, sizeof(struct obex_header_element));
-			element->length = object->rx_body->data_size;
-			element->hi = OBEX_HDR_BODY;
-			element->buf = object->rx_body;
-
-			/* Add element to rx-list */
-			list_add_tail(&element->link, &object->rx_headerq);
-		} else
-			buf_free(object->rx_body);
+		view = obex_object_new_view(object);
+		if (view == NULL)
+			return -1;
+		view->hi = OBEX_HDR_BODY;
+		view->length = object->rx_body->data_size;
+		view->data = object->rx_body->data;
 
+		/* Keep the buffer for the view, further bodies start over */
+		buf_free(object->rx_body_hdr);
+		object->rx_body_hdr = object->rx_body;
 		object->rx_body = NULL;
 	} else
 		DEBUG(object->context, 4, "Normal body fragment...\n");
@@ -256,20 +642,22 @@ static int obex_object_receive_body(obex_object_t *object, buf_t *msg, uint8_t h
 	return 1;
 }
 
-static int obex_object_send(obex_t *self, obex_object_t *object)
+/* Assemble the next packet of object into tx_next. */
+static int obex_object_prepare(obex_t *self, obex_object_t *object)
 {
 	struct obex_header_element *h;
 	struct obex_common_hdr *hdr;
 	buf_t *txmsg;
-	int actual, finished = 0;
+	int finished = 0;
 	uint16_t tx_left;
 	int addmore = 1;
 	int real_opcode;
-	char check[1];
+	int ret;
+	uint64_t start = obex_time();
 
 	tx_left = self->mtu_tx - sizeof(struct obex_common_hdr);
-	/* Reuse transmit buffer */
-	txmsg = buf_reuse(self->tx_msg);
+	/* Reuse transmit buffer, leaving room for the common header */
+	txmsg = buf_reuse_headroom(self->tx_next, sizeof(struct obex_common_hdr));
 
 	/* Add nonheader-data first if any (SETPATH, CONNECT)*/
 	if (object->tx_nonhdr_data) {
@@ -280,6 +668,18 @@ static int obex_object_send(obex_t *self, obex_object_t *object)
 		object->tx_nonhdr_data = NULL;
 	}
 
+	/* Then everything that was serialized when it was added */
+	if (object->tx_hdr_len) {
+		if (object->tx_hdr_len > tx_left) {
+			DEBUG(self, 0, "ERROR! staged headers to big for MTU\n");
+			return -1;
+		}
+		DEBUG(self, 4, "Adding %d bytes of staged headers\n", object->tx_hdr_len);
+		buf_insert_end(txmsg, object->tx_hdr, object->tx_hdr_len);
+		tx_left -= object->tx_hdr_len;
+		object->tx_hdr_len = 0;
+	}
+
 	/* Take headers from the tx queue and try to stuff as
 	   many as possible into the tx-msg */
 	while (addmore == 1 && !list_empty(&object->tx_headerq)) {
@@ -289,10 +689,13 @@ static int obex_object_send(obex_t *self, obex_object_t *object)
 
 		if (h->hi == OBEX_HDR_BODY) {
 			/* The body may be fragmented over several packets. */
-			tx_left -= send_body(object, h, txmsg, tx_left);
+			ret = send_body(object, h, txmsg, tx_left);
+			if (ret < 0)
+				return ret;
+			tx_left -= ret;
 		} else if(h->hi == OBEX_HDR_EMPTY) {
 			list_del(&h->link);
-			free(h);
+			obex_element_free(self, h);
 		} else if (h->length <= tx_left) {
 			/* There is room for more data in tx msg */
 			DEBUG(self, 4, "Adding non-body header\n");
@@ -300,8 +703,7 @@ static int obex_object_send(obex_t *self, obex_object_t *object)
 			tx_left -= h->length;
 			/* Remove from tx-queue */
 			list_del(&h->link);
-			buf_free(h->buf);
-			free(h);
+			obex_element_free(self, h);
 		} else if (h->length > self->mtu_tx) {
 			/* Header is bigger than MTU. This should not happen,
 			   because OBEX_ObjectAddHeader() rejects headers
@@ -327,34 +729,206 @@ static int obex_object_send(obex_t *self, obex_object_t *object)
 		finished = 1;
 	}
 
-	DEBUG(self, 4, "Sending package with opcode %d\n", real_opcode);
+	DEBUG(self, 4, "Prepared package with opcode %d\n", real_opcode);
 
 
-	/* Insert common header */
+	/* Insert common header, the sequence number is filled in when sent */
 	hdr = (struct obex_common_hdr *) buf_reserve_begin(txmsg, sizeof(struct obex_common_hdr));
 
-	hdr->seq = self->seq_num++;
+	hdr->seq = 0;
 	hdr->opcode = real_opcode;
 	hdr->len = htons((uint16_t)txmsg->data_size - 1);
 
+	self->tx_ready = 1;
+	self->stats.host_time += obex_time() - start;
+	return finished;
+}
+
+/* Writes txmsg with the receive ring posted, if prepare_next is set the
+   next packet of object is assembled while it is on the bus */
+static int obex_object_transmit(obex_t *self, obex_object_t *object, buf_t *txmsg,
+				int prepare_next)
+{
+	int ret, actual;
+	uint64_t start;
+
+	/* Bytes left over from an earlier attempt, such as part of a
+	   response that timed out, would fail the sequence check */
+	if (self->rx_msg->data_size > 0)
+		DEBUG(self, 3, "Dropping %zd unread bytes\n", self->rx_msg->data_size);
+	buf_reuse(self->rx_msg);
+
+	/* The ring is posted before the request goes out so reads are
+	   already queued when the device answers. */
+	ret = obex_rx_post(self);
+	if (ret < 0)
+		return ret;
+
+	DEBUG(self, 4, "Write %zd bytes\n", txmsg->data_size);
+	start = obex_time();
+	ret = obex_transfer_write(self, txmsg->data, txmsg->data_size);
+	if (ret < 0)
+		return ret;
+
+	/* Assemble the next packet while this one is on the bus. A failure
+	   is reported once the response to this packet has been read. */
+	if (prepare_next) {
+		ret = obex_object_prepare(self, object);
+		if (ret < 0)
+			self->tx_ready = ret;
+	}
+
+	ret = obex_transfer_wait(self, &self->tx_xfer, &actual);
+	self->stats.usb_time += obex_time() - start;
+	return ret;
+}
+
+/* Pipelining: the prepared next packet is written before the answer to
+ * the current one has been read. Only packets following one without the
+ * final bit are sent ahead, the answer to those is always CONTINUE. */
+static void obex_object_send_ahead(obex_t *self)
+{
+	struct obex_common_hdr *hdr = (struct obex_common_hdr *) self->tx_next->data;
+	hdr->seq = self->seq_num;
+	if (obex_transfer_write(self, self->tx_next->data, self->tx_next->data_size) < 0)
+		return;
+	DEBUG(self, 4, "Sent packet %u ahead\n", hdr->seq);
+	PROBE4(packet_send, hdr->opcode, hdr->seq, self->tx_next->data_size, 0);
+	TRACE(self->trace, 2, OBEX_TRACE_PACKET_AHEAD, hdr->seq, hdr->opcode, 0, self->tx_next->data_size);
+	self->seq_num++;
+	self->tx_ahead = 1;
+}
+
+/* Waits for the packet sent ahead once reading the answer to the current
+ * packet seq finished with result ret. A device that does not take the
+ * early packet or leaves the current one unanswered makes us fall back to
+ * lock-step. If the device took the early packet it also took seq, so a
+ * missing answer is replaced instead of sending seq again. */
+static int obex_object_wait_ahead(obex_t *self, uint8_t seq, int ret)
+{
+	int status, actual;
+	if (ret < 0)
+		self->trans.ops->cancel(&self->trans, &self->tx_xfer);
+	status = obex_transfer_wait(self, &self->tx_xfer, &actual);
+	if (status == 0 && ret >= 0)
+		return ret;
+	DEBUG(self, 1, "Pipelining failed (%d/%d), using lock-step\n", ret, status);
+	TRACE(self->trace, 1, OBEX_TRACE_PIPELINE_OFF, seq, 0, 0, ret < 0 ? ret : status);
+	self->pipeline = 0;
+	if (status < 0) {
+		/* It is sent again with the same number */
+		self->tx_ahead = 0;
+		self->seq_num--;
+		return ret;
+	}
+	buf_reuse(self->rx_msg);
+	if (!obex_answer_lost(self, seq))
+		return -1;
+	return obex_bulk_read(self, self->rx_msg, obex_deadline());
+}
+
+/* Reads the answer to a packet sent ahead of a failed one */
+static void obex_object_drain_ahead(obex_t *self)
+{
+	uint8_t seq = self->seq_num - 1;
+	uint64_t deadline;
+	int actual;
+	self->tx_ahead = 0;
+	if (obex_transfer_wait(self, &self->tx_xfer, &actual) < 0)
+		return;
+	DEBUG(self, 3, "Dropping answer to packet %u\n", seq);
+	deadline = obex_deadline();
+	if (obex_verify_seq(self, seq, deadline))
+		obex_skip_response(self, deadline);
+}
+
+static int obex_object_send(obex_t *self, obex_object_t *object)
+{
+	struct obex_common_hdr *hdr;
+	buf_t *txmsg;
+	int ret, finished, attempt, early;
+	uint64_t start;
+
+	/* The packet may already be on the bus */
+	early = self->tx_ahead;
+	if (!early) {
+		/* Assembling this packet ahead of time failed */
+		if (self->tx_ready < 0)
+			return self->tx_ready;
+
+		if (!self->tx_ready) {
+			ret = obex_object_prepare(self, object);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	/* The prepared packet becomes the one on the bus, the old one
+	   is free to hold the next packet. */
+	txmsg = self->tx_next;
+	self->tx_next = self->tx_msg;
+	self->tx_msg = txmsg;
+	self->tx_ready = 0;
+	self->tx_ahead = 0;
+	self->tx_early = early;
+
+	hdr = (struct obex_common_hdr *) txmsg->data;
+	if (!early)
+		hdr->seq = self->seq_num++;
+	finished = (hdr->opcode & OBEX_FINAL) != 0;
+
+	DEBUG(self, 4, "Sending package with opcode %d\n", hdr->opcode);
 	DUMPBUFFER(self, "Tx", txmsg);
 	DEBUG(self, 1, "len = %zd bytes\n", txmsg->data_size);
 
-	actual = obex_bulk_write(self, txmsg);
-	if (actual < 0) {
-		return actual;
-	} else {
-		if (!obex_verify_seq(self, hdr->seq))
-			return -1;
-		return finished;
+	/* Headers of the last response may still point into rx_msg */
+	if (self->rx_owner && obex_object_retain_headers(self->rx_owner) < 0)
+		return -1;
 
+	/* A lost packet, echo or response is recovered by sending the
+	   packet again with the same sequence number. Whether the device
+	   then skips executing it twice is not known, so retries are off
+	   unless enabled with obex_set_retries. */
+	for (attempt = 0; ; attempt++) {
+		if (attempt > 0 || !early) {
+			PROBE4(packet_send, hdr->opcode, hdr->seq, txmsg->data_size, attempt);
+			TRACE(self->trace, 2, OBEX_TRACE_PACKET_SEND, hdr->seq, hdr->opcode, attempt, txmsg->data_size);
+			ret = obex_object_transmit(self, object, txmsg, attempt == 0 && !finished);
+		} else {
+			/* Sent ahead, only the next packet is assembled */
+			if (!finished && (ret = obex_object_prepare(self, object)) < 0)
+				self->tx_ready = ret;
+			ret = 0;
+		}
+		if (ret == 0 && attempt == 0 && self->pipeline && !finished &&
+		    self->tx_ready > 0)
+			obex_object_send_ahead(self);
+		start = obex_time();
+		if (ret == 0 && !obex_verify_seq(self, hdr->seq, obex_deadline()))
+			ret = -1;
+		self->stats.seq_wait += obex_time() - start;
+		start = obex_time();
+		if (ret == 0)
+			ret = obex_bulk_read(self, self->rx_msg, obex_deadline());
+		self->stats.device_time += obex_time() - start;
+		if (self->tx_ahead)
+			ret = obex_object_wait_ahead(self, hdr->seq, ret);
+		if (ret >= 0)
+			break;
+		if (attempt >= self->retries || self->trans.link_lost ||
+		    ret == OBEX_XFER_NO_DEVICE)
+			return ret;
+		DEBUG(self, 1, "Sending packet %u again (%d)\n", hdr->seq, ret);
+		TRACE(self->trace, 1, OBEX_TRACE_RETRY, hdr->seq, 0, 0, ret);
+		self->stats.retries++;
 	}
+	return finished;
 }
 
 int obex_object_receive(obex_t *self, obex_object_t *object)
 {
 	struct obex_rsp_hdr *hdr;
-	struct obex_header_element *element;
+	struct obex_header_view *view;
 	struct obex_connect_hdr *conn_hdr;
 	struct obex_unicode_hdr *unicode;
 	struct obex_uint_hdr *uint;
@@ -364,14 +938,17 @@ int obex_object_receive(obex_t *self, obex_object_t *object)
 	int version, mtu;
 	uint8_t *source = NULL;
 	unsigned int len, hlen;
+	size_t rest;
 	uint8_t hi;
 	int err = 0;
+	uint64_t start;
 
 	msg = self->rx_msg;
-	ret = obex_bulk_read(self, msg);
+	ret = obex_bulk_read(self, msg, obex_deadline());
 	if (ret < 0) {
 		return ret;
 	}
+	start = obex_time();
 
 	hdr = (struct obex_rsp_hdr *) msg->data;
 	/* New data has been inserted at the end of message */
@@ -388,6 +965,16 @@ int obex_object_receive(obex_t *self, obex_object_t *object)
 		DEBUG(self, 3, "Need more data, size=%d, len=%zd!\n", length, msg->data_size);
 		return msg->data_size;
 	}
+	if (length < sizeof(struct obex_rsp_hdr)) {
+		DEBUG(self, 1, "Malformed response received\n");
+		return -1;
+	}
+	/* Bytes of the stream following this response */
+	rest = msg->data_size - length;
+	self->stats.packets_rx++;
+	self->stats.bytes_rx += length;
+	PROBE2(packet_receive, hdr->rsp, length);
+	TRACE(self->trace, 2, OBEX_TRACE_PACKET_RECEIVE, 0, hdr->rsp, 0, length);
 	DUMPBUFFER(self, "Rx", msg);
 	/* Response of a CMD_CONNECT needs some special treatment.*/
 	if (object->opcode == OBEX_CMD_CONNECT) {
@@ -400,9 +987,11 @@ int obex_object_receive(obex_t *self, obex_object_t *object)
 
 				DEBUG(self, 1, "version=%02x\n", version);
 
-				/* Limit to some reasonable value (usually OBEX_DEFAULT_MTU) */
-				self->mtu_rx = OBEX_DEFAULT_MTU;
-				self->mtu_tx = 0x4006;
+				/* The device sends packets up to the mtu_rx we
+				   asked for and accepts packets up to mtu */
+				if (mtu < OBEX_MINIMUM_MTU)
+					mtu = OBEX_MINIMUM_MTU;
+				self->mtu_tx = mtu < self->mtu_tx_max ? mtu : self->mtu_tx_max;
 
 				DEBUG(self, 1, "requested MTU=%02x, used MTU=%02x\n", mtu, self->mtu_tx);
 			} else {
@@ -423,16 +1012,17 @@ int obex_object_receive(obex_t *self, obex_object_t *object)
 
 	/* Copy any non-header data (like in CONNECT and SETPATH) */
 	if (object->headeroffset) {
-		object->rx_nonhdr_data = buf_new(object->headeroffset);
-		if (!object->rx_nonhdr_data)
+		if (object->headeroffset > sizeof(object->rx_nonhdr_data) ||
+		    object->headeroffset > msg->data_size - rest)
 			return -1;
-		buf_insert_end(object->rx_nonhdr_data, msg->data, object->headeroffset);
-		DEBUG(self, 4, "Command has %zd bytes non-headerdata\n", object->rx_nonhdr_data->data_size);
+		memcpy(object->rx_nonhdr_data, msg->data, object->headeroffset);
+		object->rx_nonhdr_len = object->headeroffset;
+		DEBUG(self, 4, "Command has %d bytes non-headerdata\n", object->rx_nonhdr_len);
 		buf_remove_begin(msg, object->headeroffset);
 		object->headeroffset = 0;
 	}
 
-	while ((msg->data_size > 0) && (!err)) {
+	while ((msg->data_size > rest) && (!err)) {
 		hi = msg->data[0];
 		DEBUG(self, 4, "Header: %02x\n", hi);
 		switch (hi & OBEX_HDR_TYPE_MASK) {
@@ -442,6 +1032,14 @@ int obex_object_receive(obex_t *self, obex_object_t *object)
 			source = &msg->data[3];
 			hlen = ntohs(unicode->hl);
 			len = hlen - 3;
+			if (hlen < 3 || hlen > msg->data_size - rest) {
+				DEBUG(self, 1, "Header %d to big. HSize=%d Buffer=%zd\n",
+				      hi, hlen, msg->data_size - rest);
+				source = NULL;
+				len = 0;
+				err = -1;
+				break;
+			}
 			if (hi == OBEX_HDR_BODY || hi == OBEX_HDR_BODY_END) {
 				/* The body-header need special treatment */
 				if (obex_object_receive_body(object, msg, hi, source, len) < 0)
@@ -472,9 +1070,9 @@ int obex_object_receive(obex_t *self, obex_object_t *object)
 		}
 
 		/* Make sure that the msg is big enough for header */
-		if (len > msg->data_size) {
+		if (len > msg->data_size - rest) {
 			DEBUG(self, 1, "Header %d to big. HSize=%d Buffer=%zd\n",
-					hi, len, msg->data_size);
+					hi, len, msg->data_size - rest);
 			source = NULL;
 			err = -1;
 		}
@@ -488,34 +1086,26 @@ int obex_object_receive(obex_t *self, obex_object_t *object)
 							object->hinted_body_len);
 			}
 
-			if ( (element = malloc(sizeof(struct obex_header_element)) ) ) {
-				memset(element, 0, sizeof(struct obex_header_element));
-				element->length = len;
-				element->hi = hi;
-
-				/* If we get an emtpy we have to deal with it...
-				 * This might not be an optimal way, but it works. */
-				if (len == 0) {
-					DEBUG(self, 4, "Got empty header. Allocating dummy buffer anyway\n");
-					element->buf = buf_new(1);
-				} else {
-					element->buf = buf_new(len);
-					if (element->buf) {
-						DEBUG(self, 4, "Copying %d bytes\n", len);
-						buf_insert_end(element->buf, source, len);
-					}
-				}
-
-				if (element->buf) {
-					/* Add element to rx-list */
-					list_add_tail(&element->link, &object->rx_headerq);
-				} else{
-					DEBUG(self, 1, "Cannot allocate memory\n");
-					free(element);
-					err = -1;
+			/* Record where the header is, values are read in place */
+			view = obex_object_new_view(object);
+			if (view) {
+				view->hi = hi;
+				view->length = len;
+				switch (hi & OBEX_HDR_TYPE_MASK) {
+				case OBEX_HDR_TYPE_UINT32:
+					uint = (struct obex_uint_hdr *) msg->data;
+					view->value = ntohl(uint->hv);
+					break;
+				case OBEX_HDR_TYPE_UINT8:
+					view->value = source[0];
+					break;
+				default:
+					view->data = source;
+					view->in_rx_msg = 1;
+					self->rx_owner = object;
+					break;
 				}
 			} else {
-				DEBUG(self, 1, "Cannot allocate memory\n");
 				err = -1;
 			}
 		}
@@ -526,46 +1116,33 @@ int obex_object_receive(obex_t *self, obex_object_t *object)
 		DEBUG(self, 4, "Pulling %d bytes\n", hlen);
 		buf_remove_begin(msg, hlen);
 	}
+	self->stats.host_time += obex_time() - start;
 	return hdr->rsp & ~OBEX_FINAL;
 }
 
-obex_t * obex_init(uint16_t vid, uint16_t pid)
+obex_t * obex_init(const struct obex_transport_ops *ops, void *args)
 {
 	obex_t *self;
-	libusb_device **list;
-	int i, size = 0;
+	int i;
 	self = malloc(sizeof(obex_t));
 	if (self == NULL)
 		return NULL;
 	memset(self, 0, sizeof(obex_t));
+	pthread_mutex_init(&self->capture_lock, NULL);
+	INIT_LIST_HEAD(&self->free_objects);
+	INIT_LIST_HEAD(&self->free_elements);
 
-	if (libusb_init(&self->usb_ctx) < 0)
-		goto out_err;
-
-	size = libusb_get_device_list(self->usb_ctx, &list);
-	if (size < 0)
-		goto out_err;
-
-	for (i = 0; i < size; i++) {
-		struct libusb_device_descriptor desc;
-		libusb_device *device = list[i];
-		if (libusb_get_device_descriptor(device, &desc) < 0)
-			continue;
-		if (desc.idVendor != vid || desc.idProduct != pid)
-			continue;
-		if (libusb_open(device, &self->usb_dev) < 0)
-			continue;
-		if (obex_claim_interface(self) == 0)
-			break;
-		libusb_close(self->usb_dev);
-		self->usb_dev = NULL;
-	}
-
-	libusb_free_device_list(list, 1);
-	if (i >= size)
+	self->trans.ops = ops;
+	if (ops->open(&self->trans, args) < 0)
 		goto out_err;
 
 	self->seq_num = 0;
+	self->seq_check = -1;
+	self->tx_xfer.timeout = OBEX_TIMEOUT;
+	self->retries = OBEX_DEFAULT_RETRIES;
+	self->pipeline = 0;
+	self->tx_ahead = 0;
+	self->tx_early = 0;
 	self->debug = 0;
 	self->version = OBEX_VERSION;
 	self->locale = 0x00;
@@ -575,49 +1152,151 @@ obex_t * obex_init(uint16_t vid, uint16_t pid)
 
 	self->rx_msg = buf_new(self->mtu_rx);
 	if (self->rx_msg == NULL)
-		goto out_err;
+		goto out_close;
 
 	self->tx_msg = buf_new(self->mtu_tx_max);
 	if (self->tx_msg == NULL)
-		goto out_err;
-		
-  size = libusb_control_transfer(self->usb_dev,
-                     LIBUSB_REQUEST_TYPE_VENDOR + LIBUSB_RECIPIENT_INTERFACE,
-                     0x0000001, 0x0000000, 0x0000000, NULL, 0x0000000, 1000);
-  if (size < 0)
-    goto out_err;
-
+		goto out_close;
+
+	self->tx_next = buf_new(self->mtu_tx_max);
+	if (self->tx_next == NULL)
+		goto out_close;
+
+	/* The callback stays installed, changing it could race with
+	   a completion on another thread */
+	self->tx_xfer.completed = 1;
+	self->tx_xfer.callback = obex_capture_xfer;
+	self->tx_xfer.user_data = self;
+	for (i = 0; i < OBEX_RX_RING; i++) {
+		self->rx_xfer[i].completed = 1;
+		self->rx_xfer[i].callback = obex_capture_xfer;
+		self->rx_xfer[i].user_data = self;
+	}
 	return self;
 
-out_err:
+out_close:
+	ops->close(&self->trans);
+	if (self->tx_next != NULL)
+		buf_free(self->tx_next);
 	if (self->tx_msg != NULL)
 		buf_free(self->tx_msg);
 	if (self->rx_msg != NULL)
 		buf_free(self->rx_msg);
-	if (self->usb_dev)
-		libusb_close(self->usb_dev);
-	if (self->usb_ctx)
-		libusb_exit(self->usb_ctx);
+out_err:
+	pthread_mutex_destroy(&self->capture_lock);
 	free(self);
 	return NULL;
 }
 
 void obex_cleanup(obex_t *self)
 {
+	int i;
 	if (self) {
+		obex_capture_close(self);
+
+		obex_transfer_cancel(self, &self->tx_xfer);
 		if (self->tx_msg)
 			buf_free(self->tx_msg);
 
+		if (self->tx_next)
+			buf_free(self->tx_next);
+
+		obex_rx_reset(self);
+		self->trans.ops->release(&self->trans, &self->tx_xfer);
+		for (i = 0; i < OBEX_RX_RING; i++) {
+			self->trans.ops->release(&self->trans, &self->rx_xfer[i]);
+			free(self->rx_xfer[i].buffer);
+		}
+
 		if (self->rx_msg)
 			buf_free(self->rx_msg);
 
-		libusb_release_interface(self->usb_dev, self->intf_num);
-		libusb_close(self->usb_dev);
-		libusb_exit(self->usb_ctx);
+		free_pools(self);
+
+		self->trans.ops->close(&self->trans);
+		pthread_mutex_destroy(&self->capture_lock);
 		free(self);
 	}
 }
 
+/* Process pending transport events, waits at most tv */
+int obex_handle_events(obex_t *self, struct timeval *tv)
+{
+	return self->trans.ops->handle_events(&self->trans, tv, NULL);
+}
+
+/* Stores up to nfds descriptors the transport waits on, returns the
+   number available */
+int obex_get_pollfds(obex_t *self, struct obex_pollfd *fds, int nfds)
+{
+	return self->trans.ops->get_pollfds(&self->trans, fds, nfds);
+}
+
+/* Stores in tv when events must be handled even if no descriptor became
+   ready, returns 0 if there is no such time */
+int obex_get_timeout(obex_t *self, struct timeval *tv)
+{
+	return self->trans.ops->get_timeout(&self->trans, tv);
+}
+
+/* Returns 1 if the transport noticed the device went away */
+int obex_link_lost(obex_t *self)
+{
+	return self->trans.link_lost;
+}
+
+/* Records every completed transfer to the file path */
+int obex_capture_open(obex_t *self, const char *path)
+{
+	struct obex_capture_hdr hdr;
+	int ret = 0;
+	pthread_mutex_lock(&self->capture_lock);
+	obex_capture_stop(self);
+	self->capture = fopen(path, "wb");
+	if (self->capture == NULL) {
+		ret = -1;
+		goto out;
+	}
+	memcpy(hdr.magic, OBEX_CAPTURE_MAGIC, sizeof(hdr.magic));
+	hdr.version = htons(OBEX_CAPTURE_VERSION);
+	if (fwrite(&hdr, sizeof(hdr), 1, self->capture) != 1) {
+		obex_capture_stop(self);
+		ret = -1;
+		goto out;
+	}
+	gettimeofday(&self->capture_time, NULL);
+out:
+	pthread_mutex_unlock(&self->capture_lock);
+	return ret;
+}
+
+void obex_capture_close(obex_t *self)
+{
+	pthread_mutex_lock(&self->capture_lock);
+	obex_capture_stop(self);
+	pthread_mutex_unlock(&self->capture_lock);
+}
+
+/* Sets how often a packet is sent again after it or its answer got lost */
+void obex_set_retries(obex_t *self, int retries)
+{
+	self->retries = retries < 0 ? 0 : retries;
+}
+
+/* Enables sending a packet before the answer to the previous one */
+void obex_set_pipelining(obex_t *self, int enable)
+{
+	self->pipeline = enable != 0;
+}
+
+/* Sets the largest packet the device may send, used by the next CONNECT */
+void obex_set_mtu(obex_t *self, uint16_t mtu_rx)
+{
+	if (mtu_rx < OBEX_MINIMUM_MTU)
+		mtu_rx = OBEX_MINIMUM_MTU;
+	self->mtu_rx = mtu_rx;
+}
+
 void obex_set_connect_info(obex_t *self, uint8_t ver, uint8_t locale)
 {
 	self->version = ver;
@@ -634,17 +1313,22 @@ obex_object_t * obex_object_new(obex_t *self, uint8_t cmd)
 {
 	obex_object_t *object;
 
-	object =  malloc(sizeof(obex_object_t));
-	if (object == NULL)
-		return NULL;
+	/* Recycle an object from an earlier request if we can */
+	if (!list_empty(&self->free_objects)) {
+		object = list_entry(self->free_objects.next, obex_object_t, link);
+		list_del(&object->link);
+		self->free_object_count--;
+	} else {
+		object =  malloc(sizeof(obex_object_t));
+		if (object == NULL)
+			return NULL;
+	}
 
 	memset(object, 0, sizeof(obex_object_t));
 
 	object->context = self;
 
 	INIT_LIST_HEAD(&object->tx_headerq);
-	INIT_LIST_HEAD(&object->rx_headerq);
-	INIT_LIST_HEAD(&object->rx_headerq_rm);
 
 	object->cmd = cmd;
 	object->opcode = cmd;
@@ -654,50 +1338,113 @@ obex_object_t * obex_object_new(obex_t *self, uint8_t cmd)
 	if (cmd == OBEX_CMD_CONNECT) {
 		struct obex_connect_hdr *conn_hdr;
 
-		object->tx_nonhdr_data = buf_new(7);
-		if (!object->tx_nonhdr_data) {
-			obex_object_delete(self, object);
-			object = NULL;
-		} else {
-			conn_hdr = (struct obex_connect_hdr *) buf_reserve_end(object->tx_nonhdr_data, 7);
-			conn_hdr->version = self->version;
-			conn_hdr->flags = 0x40;              /* Flags */
-			conn_hdr->mtu = htons(self->mtu_rx); /* Max packet size */
-			memcpy(conn_hdr->unknown, "\x40\x00", 2); //unkown data sent during connect
-			conn_hdr->locale = self->locale;
-		}
+		conn_hdr = (struct obex_connect_hdr *) object->tx_hdr;
+		conn_hdr->version = self->version;
+		conn_hdr->flags = 0x40;              /* Flags */
+		conn_hdr->mtu = htons(self->mtu_rx); /* Max packet size */
+		memcpy(conn_hdr->unknown, "\x40\x00", 2); //unkown data sent during connect
+		conn_hdr->locale = self->locale;
+		object->tx_hdr_len = object->tx_nonhdr_len = sizeof(struct obex_connect_hdr);
 	}
 	return object;
 }
 
 int obex_object_delete(obex_t *self, obex_object_t *object)
 {
+	struct obex_header_view *h;
+	int i;
+
 	/* Free the headerqueues */
-	free_headerq(&object->tx_headerq);
-	free_headerq(&object->rx_headerq);
-	free_headerq(&object->rx_headerq_rm);
+	free_headerq(self, &object->tx_headerq);
+	if (self->rx_owner == object)
+		self->rx_owner = NULL;
+
+	for (i = 0; i < object->rx_hdr_count; i++) {
+		h = obex_object_view(object, i);
+		if (h->on_heap)
+			free((uint8_t *)h->data);
+	}
+	free(object->rx_hdr_extra);
+	object->rx_hdr_extra = NULL;
 
 	/* Free tx and rx msgs */
 	buf_free(object->tx_nonhdr_data);
 	object->tx_nonhdr_data = NULL;
 
-	buf_free(object->rx_nonhdr_data);
-	object->rx_nonhdr_data = NULL;
+	/* Keep one modest body buffer around for the next response */
+	if (object->rx_body_hdr && !self->spare_body &&
+	    buf_total_size(object->rx_body_hdr) <= OBEX_SPARE_BODY_MAX) {
+		self->spare_body = object->rx_body_hdr;
+		object->rx_body_hdr = NULL;
+	}
 
 	buf_free(object->rx_body);
 	object->rx_body = NULL;
 
-	free(object);
+	buf_free(object->rx_body_hdr);
+	object->rx_body_hdr = NULL;
+
+	if (object->rx_body_owned)
+		free(object->rx_body_buf);
+
+	if (self->free_object_count < OBEX_FREE_OBJECTS_MAX) {
+		list_add(&object->link, &self->free_objects);
+		self->free_object_count++;
+	} else
+		free(object);
 
 	return 0;
 }
 
+/* Serialize a header straight into the object's staging area. This is
+   only possible while no header is queued ahead of it and the result still
+   fits in the first packet. Returns 0 if the header has to be queued. */
+static int obex_object_stage_header(obex_t *self, obex_object_t *object, uint8_t hi,
+				    obex_headerdata_t hv, uint32_t hv_size, unsigned int length)
+{
+	struct obex_uint_hdr *uint_hdr;
+	struct obex_ubyte_hdr *ubyte_hdr;
+	struct obex_unicode_hdr *unicode_hdr;
+
+	if (!list_empty(&object->tx_headerq))
+		return 0;
+
+	if (object->tx_hdr_len + length > sizeof(object->tx_hdr) ||
+	    object->tx_hdr_len + length > self->mtu_tx - sizeof(struct obex_common_hdr))
+		return 0;
+
+	switch (hi & OBEX_HDR_TYPE_MASK) {
+	case OBEX_HDR_TYPE_UINT32:
+		DEBUG(self, 2, "Staged 4BQ header %d\n", hv.bq4);
+		uint_hdr = (struct obex_uint_hdr *) (object->tx_hdr + object->tx_hdr_len);
+		uint_hdr->hi = hi;
+		uint_hdr->hv = htonl(hv.bq4);
+		break;
+	case OBEX_HDR_TYPE_UINT8:
+		DEBUG(self, 2, "Staged 1BQ header %d\n", hv.bq1);
+		ubyte_hdr = (struct obex_ubyte_hdr *) (object->tx_hdr + object->tx_hdr_len);
+		ubyte_hdr->hi = hi;
+		ubyte_hdr->hv = hv.bq1;
+		break;
+	default:
+		DEBUG(self, 2, "Staged BS/Unicode header size %d\n", hv_size);
+		unicode_hdr = (struct obex_unicode_hdr *) (object->tx_hdr + object->tx_hdr_len);
+		/* A body that fits here is sent whole */
+		unicode_hdr->hi = (hi == OBEX_HDR_BODY) ? OBEX_HDR_BODY_END : hi;
+		unicode_hdr->hl = htons((uint16_t)length);
+		memcpy(unicode_hdr->hv, hv.bs, hv_size);
+		break;
+	}
+	object->tx_hdr_len += length;
+	return 1;
+}
+
 int obex_object_addheader(obex_t *self, obex_object_t *object, uint8_t hi,
 	obex_headerdata_t hv, uint32_t hv_size, unsigned int flags)
 {
 	int ret = -1;
 	struct obex_header_element *element;
-	unsigned int maxlen;
+	unsigned int maxlen, length;
 
 	if (flags & OBEX_FL_FIT_ONE_PACKET) {
 		/* In this command all headers must fit in one packet! */
@@ -707,12 +1454,30 @@ int obex_object_addheader(obex_t *self, obex_object_t *object, uint8_t hi,
 		maxlen = self->mtu_tx - sizeof(struct obex_common_hdr);
 	}
 
-	element = malloc(sizeof(struct obex_header_element));
+	if (hi != OBEX_HDR_EMPTY) {
+		switch (hi & OBEX_HDR_TYPE_MASK) {
+		case OBEX_HDR_TYPE_UINT32:
+			length = sizeof(struct obex_uint_hdr);
+			break;
+		case OBEX_HDR_TYPE_UINT8:
+			length = sizeof(struct obex_ubyte_hdr);
+			break;
+		default:
+			length = hv_size + sizeof(struct obex_unicode_hdr);
+			break;
+		}
+		if ((hi == OBEX_HDR_BODY && !(flags & OBEX_FL_FIT_ONE_PACKET)) || length <= maxlen) {
+			if (obex_object_stage_header(self, object, hi, hv, hv_size, length)) {
+				object->totallen += length;
+				return 1;
+			}
+		}
+	}
+
+	element = obex_element_new(self);
 	if (element == NULL)
 		return -1;
 
-	memset(element, 0, sizeof(struct obex_header_element));
-
 	element->hi = hi;
 	element->flags = flags;
 
@@ -753,6 +1518,15 @@ int obex_object_addheader(obex_t *self, obex_object_t *object, uint8_t hi,
 	case OBEX_HDR_TYPE_UNICODE:
 		DEBUG(self, 2, "BS/Unicode header size %d\n", hv_size);
 
+		if (hi == OBEX_HDR_BODY && (flags & OBEX_FL_NOCOPY)) {
+			/* Fragments are copied straight from the caller's
+			   buffer into the outgoing packets */
+			element->data = hv.bs;
+			ret = element->length = hv_size + sizeof(struct obex_unicode_hdr);
+			break;
+		}
+		element->flags &= ~OBEX_FL_NOCOPY;
+
 		element->buf = buf_new(hv_size + sizeof(struct obex_unicode_hdr));
 		if (element->buf) {
 			struct obex_unicode_hdr *hdr;
@@ -784,29 +1558,42 @@ int obex_object_addheader(obex_t *self, obex_object_t *object, uint8_t hi,
 		list_add_tail(&element->link, &object->tx_headerq);
 		ret = 1;
 	} else {
-		buf_free(element->buf);
-		free(element);
+		obex_element_free(self, element);
 	}
 
 	return ret;
 }
 
+int obex_object_add_body_reader(obex_t *self, obex_object_t *object, uint32_t len,
+				obex_body_reader reader, void *userdata)
+{
+	struct obex_header_element *element;
+
+	element = obex_element_new(self);
+	if (element == NULL)
+		return -1;
+
+	DEBUG(self, 2, "Streamed body size %d\n", len);
+	element->hi = OBEX_HDR_BODY;
+	element->length = len + sizeof(struct obex_byte_stream_hdr);
+	element->reader = reader;
+	element->reader_data = userdata;
+
+	object->totallen += element->length;
+	list_add_tail(&element->link, &object->tx_headerq);
+	return 1;
+}
+
 int obex_object_getnextheader(obex_t *self, obex_object_t *object, uint8_t *hi,
 			      obex_headerdata_t *hv, uint32_t *hv_size)
 {
-	uint32_t *bq4;
-	struct obex_header_element *h;
+	struct obex_header_view *h;
 
 	/* No more headers */
-	if (list_empty(&object->rx_headerq))
+	if (object->rx_hdr_next >= object->rx_hdr_count)
 		return 0;
 
-	/* New headers are appended at the end of the list while receiving, so
-	   we pull them from the front.
-	   Since we cannot free the mem used just yet just put the header in
-	   another list so we can free it when the object is deleted. */
-	h = list_entry(object->rx_headerq.next, struct obex_header_element, link);
-	list_move_tail(object->rx_headerq.next, &(object->rx_headerq_rm));
+	h = obex_object_view(object, object->rx_hdr_next++);
 
 	*hi = h->hi;
 	*hv_size= h->length;
@@ -814,29 +1601,68 @@ int obex_object_getnextheader(obex_t *self, obex_object_t *object, uint8_t *hi,
 	switch (h->hi & OBEX_HDR_TYPE_MASK) {
 		case OBEX_HDR_TYPE_BYTES:
 		case OBEX_HDR_TYPE_UNICODE:
-			hv->bs = &h->buf->data[0];
+			hv->bs = h->data;
 			break;
 
 		case OBEX_HDR_TYPE_UINT32:
-			bq4 = (uint32_t*) h->buf->data;
-			hv->bq4 = ntohl(*bq4);
+			hv->bq4 = h->value;
 			break;
 
 		case OBEX_HDR_TYPE_UINT8:
-			hv->bq1 = h->buf->data[0];
+			hv->bq1 = h->value;
 			break;
 	}
 
 	return 1;
 }
 
+/* Copy header values still pointing into rx_msg into the object so they
+   survive the receive buffer being reused. */
+int obex_object_retain_headers(obex_object_t *object)
+{
+	struct obex_header_view *h;
+	uint8_t *data;
+	int i;
+
+	for (i = 0; i < object->rx_hdr_count; i++) {
+		h = obex_object_view(object, i);
+		if (!h->in_rx_msg)
+			continue;
+		if (object->rx_hdr_store_len + h->length <= sizeof(object->rx_hdr_store)) {
+			data = object->rx_hdr_store + object->rx_hdr_store_len;
+			object->rx_hdr_store_len += h->length;
+		} else {
+			DEBUG(object->context, 4, "Retaining header %02x on the heap\n", h->hi);
+			data = malloc(h->length ? h->length : 1);
+			if (data == NULL)
+				return -1;
+			h->on_heap = 1;
+		}
+		memcpy(data, h->data, h->length);
+		h->data = data;
+		h->in_rx_msg = 0;
+	}
+	if (object->context->rx_owner == object)
+		object->context->rx_owner = NULL;
+	return 0;
+}
+
 int obex_object_set_nonhdr_data(obex_object_t *object, const uint8_t *buffer, unsigned int len)
 {
 	/* TODO: Check that we actually can send len bytes without violating MTU */
 
-	if (object->tx_nonhdr_data)
+	if (object->tx_nonhdr_data || object->tx_nonhdr_len)
 		return -1;
 
+	/* Non-header data goes in front of any staged headers */
+	if (object->tx_hdr_len + len <= sizeof(object->tx_hdr)) {
+		memmove(object->tx_hdr + len, object->tx_hdr, object->tx_hdr_len);
+		memcpy(object->tx_hdr, buffer, len);
+		object->tx_hdr_len += len;
+		object->tx_nonhdr_len = len;
+		return 1;
+	}
+
 	object->tx_nonhdr_data = buf_new(len);
 	if (object->tx_nonhdr_data == NULL)
 		return -1;
@@ -846,16 +1672,75 @@ int obex_object_set_nonhdr_data(obex_object_t *object, const uint8_t *buffer, un
 	return 1;
 }
 
+int obex_object_set_body_buffer(obex_object_t *object, uint8_t *buffer, unsigned int size)
+{
+	if (object->rx_body_direct || object->rx_body_writer)
+		return -1;
+
+	object->rx_body_direct = 1;
+	object->rx_body_buf = buffer;
+	object->rx_body_size = buffer ? size : 0;
+	return 1;
+}
+
+/* Received body fragments are passed to writer as they are parsed
+   instead of being collected. */
+int obex_object_set_body_writer(obex_object_t *object, obex_body_writer writer, void *userdata)
+{
+	if (object->rx_body_direct)
+		return -1;
+
+	object->rx_body_writer = writer;
+	object->rx_body_data = userdata;
+	return 1;
+}
+
+uint8_t * obex_object_take_body(obex_object_t *object, unsigned int *len)
+{
+	uint8_t *buffer = object->rx_body_buf;
+	*len = object->rx_body_len;
+	object->rx_body_buf = NULL;
+	object->rx_body_owned = 0;
+	return buffer;
+}
+
 int obex_request(obex_t *self, obex_object_t *object)
 {
 	int ret, rsp;
+	uint64_t start = obex_time();
+	memset(&self->stats, 0, sizeof(self->stats));
+	PROBE1(request_start, object->opcode);
+	TRACE(self->trace, 1, OBEX_TRACE_REQUEST_START, self->seq_num, object->opcode, 0, 0);
+	/* Drop any packet prepared ahead for an earlier request */
+	self->tx_ready = 0;
 	do {
 		ret = obex_object_send(self, object);
-		if (ret < 0)
+		if (ret < 0) {
+			self->stats.total = obex_time() - start;
+			PROBE3(request_done, object->opcode, ret, self->stats.total);
+			TRACE(self->trace, 1, OBEX_TRACE_REQUEST_DONE, self->seq_num, object->opcode, 0, ret);
 			return ret;
+		}
 		rsp = obex_object_receive(self, object);
 		if (self->callback)
 			self->callback(self, object, self->cb_userdata);
 	} while (rsp == OBEX_RSP_CONTINUE);
+	if (self->tx_ahead) {
+		/* Draining reads into rx_msg which the headers of the final
+		   response still point into */
+		if (obex_object_retain_headers(object) < 0)
+			rsp = -1;
+		obex_object_drain_ahead(self);
+	}
+	/* A device refusing a packet that was sent early may not support
+	   pipelining at all */
+	if (self->tx_early && rsp != OBEX_RSP_SUCCESS && self->pipeline) {
+		DEBUG(self, 1, "Packet sent ahead refused, using lock-step\n");
+		TRACE(self->trace, 1, OBEX_TRACE_PIPELINE_OFF, self->seq_num - 1, 0, 0, rsp);
+		self->pipeline = 0;
+	}
+	self->stats.total = obex_time() - start;
+	PROBE3(request_done, object->opcode, rsp, self->stats.total);
+	TRACE(self->trace, 1, OBEX_TRACE_REQUEST_DONE, self->seq_num, object->opcode, 0, rsp);
 	return rsp;
 }
@@ -26,28 +26,49 @@
 #ifndef OBEX_H
 #define OBEX_H
 
-#include <libusb.h>
 #include <inttypes.h>
 #include <stdio.h>
+#include <pthread.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
 
 #include "list.h"
 #include "databuffer.h"
+#include "transport.h"
+#include "trace.h"
 
 #define log_debug(format, ...) fprintf(stderr, format, ## __VA_ARGS__)
 #define log_debug_prefix ""
 
+/* Highest debug level compiled in, messages above it cost nothing */
+#ifndef OBEX_DEBUG_LEVEL
+#define OBEX_DEBUG_LEVEL	5
+#endif
+
 #  define DEBUG(obex, n, format, ...) \
-          if (obex->debug >= (n)) \
+          if ((n) <= OBEX_DEBUG_LEVEL && obex->debug >= (n)) \
             log_debug("%s%s(): " format, log_debug_prefix, __FUNCTION__, ## __VA_ARGS__)
 
 #define DUMPBUFFER(obex, label, msg) \
-        if (obex->debug >= 5) buf_dump(msg, label);
+        if (5 <= OBEX_DEBUG_LEVEL && obex->debug >= 5) buf_dump(msg, label);
 
 #define OBEX_OBJECT_ALLOCATIONTRESHOLD 10240
+#define OBEX_STAGED_SIZE	512	/* Headers of small commands are built in the object */
+#define OBEX_MAX_RX_HEADERS	16	/* Headers kept in the object, more go to the heap */
+#define OBEX_FREE_OBJECTS_MAX	4	/* Objects kept for reuse per context */
+#define OBEX_FREE_ELEMENTS_MAX	16	/* Header elements kept for reuse per context */
+#define OBEX_SPARE_BODY_MAX	65536	/* Largest body buffer kept for reuse */
+#define OBEX_RX_RING		4	/* IN transfers kept posted */
+#define OBEX_EVENT_ERRORS	10	/* Failed event rounds before a wait gives up */
+#define OBEX_TIMEOUT		1245	/* Milliseconds to send a packet or receive a response */
+#define OBEX_DEFAULT_RETRIES	0	/* Resends of a lost packet, off unless enabled */
 
 #define OBEX_VERSION		0x11
 
 #define OBEX_FL_FIT_ONE_PACKET	0x01	/* This header must fit in one packet */
+#define OBEX_FL_NOCOPY		0x02	/* Reference body data, it must stay valid until the request completes */
 
 #define OBEX_HDR_TYPE_UNICODE	(0 << 6)  /* zero terminated unicode string (network byte order) */
 #define OBEX_HDR_TYPE_BYTES	(1 << 6)  /* byte array */
@@ -153,6 +174,22 @@
 struct _obex_object;
 struct _obex;
 typedef void (*obex_callback)(struct _obex *, struct _obex_object *, void *);
+typedef int (*obex_body_reader)(uint8_t *buffer, unsigned int len, void *userdata);
+typedef int (*obex_body_writer)(const uint8_t *buffer, unsigned int len, void *userdata);
+
+/* Counters of the last obex_request, times in microseconds */
+struct obex_stats {
+	uint32_t packets_tx;		/* Packets written, resends included */
+	uint32_t packets_rx;		/* Responses parsed */
+	uint32_t bytes_tx;
+	uint32_t bytes_rx;
+	uint32_t retries;		/* Packets sent again */
+	uint64_t usb_time;		/* Writing packets */
+	uint64_t seq_wait;		/* Written packet to its sequence echo */
+	uint64_t device_time;		/* Sequence echo to the whole response */
+	uint64_t host_time;		/* Assembling packets and parsing responses */
+	uint64_t total;			/* Whole request */
+};
 
 typedef union {
 	uint32_t bq4;
@@ -161,26 +198,71 @@ typedef union {
 } obex_headerdata_t;
 
 typedef struct _obex {
-	struct libusb_context *usb_ctx;
-	struct libusb_device_handle *usb_dev;
-	uint8_t intf_num;
-	uint8_t read_endpoint_address;
-	uint8_t write_endpoint_address;
-	uint8_t interrupt_endpoint_address;
+	struct obex_transport trans;
 	uint8_t version;
 	uint8_t locale;
 	uint16_t mtu_rx;
 	uint16_t mtu_tx;
 	uint16_t mtu_tx_max;
-	buf_t *tx_msg;
-	buf_t *rx_msg;
+	buf_t *tx_msg;		/* Packet currently (or last) on the bus */
+	buf_t *tx_next;		/* Next packet, assembled while tx_msg is sent */
+	int tx_ready;		/* tx_next holds a prepared packet, < 0 if that failed */
+	int tx_ahead;		/* tx_next was written before its turn */
+	int tx_early;		/* tx_msg was written before its turn */
+	buf_t *rx_msg;			/* Received byte stream */
+	struct obex_xfer tx_xfer;
+	struct obex_xfer rx_xfer[OBEX_RX_RING];	/* IN transfers kept posted */
+	size_t rx_size[OBEX_RX_RING];	/* Allocated size of each ring buffer */
+	int rx_order[OBEX_RX_RING];	/* Posted slots, oldest first */
+	int rx_posted;
 	int debug;
 	uint8_t seq_num;
-	int16_t seq_check;
+	int16_t seq_check;		/* Last sequence number echoed, -1 if none */
+	int retries;			/* Resends of a packet before giving up */
+	int pipeline;			/* Send packets ahead, see obex_object_send_ahead */
 	obex_callback callback;
 	void * cb_userdata;
+	struct _obex_object *rx_owner;	/* Object with headers pointing into rx_msg */
+	struct list_head free_objects;	/* Objects kept for reuse */
+	int free_object_count;
+	struct list_head free_elements;	/* Header elements kept for reuse */
+	int free_element_count;
+	buf_t *spare_body;		/* Body buffer kept for reuse */
+	/* Transfers of all usb sessions share one libusb context, their
+	   completions may be processed by another session's thread. */
+	pthread_mutex_t capture_lock;	/* Guards the capture fields */
+	FILE *capture;			/* Completed transfers are recorded here */
+	struct timeval capture_time;	/* Time of the last recorded transfer */
+	uint8_t capture_seq;		/* Sequence number of the last packet written */
+	struct obex_stats stats;	/* Counters of the last request */
+	struct obex_trace *trace;	/* Event ring owned by the caller, may be NULL */
 } obex_t;
 
+/* Capture file: a obex_capture_hdr followed by one obex_capture_rec and
+   its data for each completed transfer. Fields are in network byte order. */
+#define OBEX_CAPTURE_MAGIC	"EXWCAP"
+#define OBEX_CAPTURE_VERSION	1
+#define OBEX_CAPTURE_TX		0
+#define OBEX_CAPTURE_RX		1
+
+#pragma pack(1)
+struct obex_capture_hdr {
+	uint8_t  magic[6];
+	uint16_t version;
+};
+#pragma pack()
+
+#pragma pack(1)
+struct obex_capture_rec {
+	uint8_t  dir;		/* OBEX_CAPTURE_TX or OBEX_CAPTURE_RX */
+	uint8_t  seq;		/* Sequence number of the current request */
+	int8_t   status;	/* Transfer status */
+	uint8_t  reserved;
+	uint32_t delta;		/* Microseconds since the previous record */
+	uint32_t len;		/* Length of the transferred data */
+};
+#pragma pack()
+
 #pragma pack(1)
 struct obex_common_hdr {
 	uint8_t  seq;
@@ -232,6 +314,9 @@ struct obex_unicode_hdr {
 
 struct obex_header_element {
 	buf_t *buf;
+	const uint8_t *data;	/* Caller memory of a OBEX_FL_NOCOPY body */
+	obex_body_reader reader;	/* Pulls streamed body data */
+	void *reader_data;
 	uint8_t hi;
 	unsigned int flags;
 	unsigned int length;
@@ -240,17 +325,47 @@ struct obex_header_element {
 	struct list_head link;
 };
 
+/* A received header. Byte and unicode values point into rx_msg until
+   retained, integer values are decoded when parsed. */
+struct obex_header_view {
+	uint8_t hi;
+	uint8_t in_rx_msg;
+	uint8_t on_heap;		/* data is malloced */
+	uint32_t length;
+	uint32_t value;
+	const uint8_t *data;
+};
+
 typedef struct _obex_object {
 	obex_t *context;
+	struct list_head link;		/* Entry in the free list of the context */
 
 	time_t time;
 
 	struct list_head tx_headerq;		/* List of headers to transmit*/
-	struct list_head rx_headerq;		/* List of received headers */
-	struct list_head rx_headerq_rm;		/* List of recieved header already read by the app */
+	struct obex_header_view rx_hdr[OBEX_MAX_RX_HEADERS];	/* Received headers */
+	struct obex_header_view *rx_hdr_extra;	/* Headers beyond rx_hdr */
+	int rx_hdr_extra_size;
+	int rx_hdr_count;
+	int rx_hdr_next;			/* Next header returned to the app */
+	uint8_t rx_hdr_store[OBEX_STAGED_SIZE];	/* Retained header values */
+	unsigned int rx_hdr_store_len;
 	buf_t *rx_body;		/* The rx body header need some extra help */
+	buf_t *rx_body_hdr;	/* Completed body, viewed by rx_hdr */
+	uint8_t *rx_body_buf;	/* Body destination if rx_body_direct is set */
+	unsigned int rx_body_size;	/* Size of rx_body_buf */
+	unsigned int rx_body_len;	/* Body bytes received so far */
+	int rx_body_direct;		/* Receive body into rx_body_buf */
+	int rx_body_owned;		/* rx_body_buf was allocated by us */
+	int rx_body_dropped;		/* Body did not fit rx_body_buf or writer failed */
+	obex_body_writer rx_body_writer;	/* Sink for received body fragments */
+	void *rx_body_data;
 	buf_t *tx_nonhdr_data;	/* Data before of headers (like CONNECT and SETPATH) */
-	buf_t *rx_nonhdr_data;	/* -||- */
+	uint8_t tx_hdr[OBEX_STAGED_SIZE];	/* Non-header data and headers serialized when added */
+	unsigned int tx_hdr_len;
+	unsigned int tx_nonhdr_len;	/* Part of tx_hdr that is non-header data */
+	uint8_t rx_nonhdr_data[8];	/* -||- */
+	unsigned int rx_nonhdr_len;
 
 	uint8_t cmd;			/* The command of this object */
 
@@ -269,8 +384,17 @@ typedef struct _obex_object {
 
 } obex_object_t;
 
-obex_t * obex_init(uint16_t vid, uint16_t pid);
+obex_t * obex_init(const struct obex_transport_ops *ops, void *args);
 void obex_cleanup(obex_t *self);
+int obex_handle_events(obex_t *self, struct timeval *tv);
+int obex_get_pollfds(obex_t *self, struct obex_pollfd *fds, int nfds);
+int obex_get_timeout(obex_t *self, struct timeval *tv);
+int obex_link_lost(obex_t *self);
+int obex_capture_open(obex_t *self, const char *path);
+void obex_capture_close(obex_t *self);
+void obex_set_mtu(obex_t *self, uint16_t mtu_rx);
+void obex_set_retries(obex_t *self, int retries);
+void obex_set_pipelining(obex_t *self, int enable);
 void obex_set_connect_info(obex_t *self, uint8_t ver, uint8_t locale);
 void obex_register_callback(obex_t *self, obex_callback cb, void * userdata);
 obex_object_t * obex_object_new(obex_t *self, uint8_t cmd);
@@ -278,9 +402,17 @@ int obex_object_delete(obex_t *self, obex_object_t *object);
 int obex_object_addheader(obex_t *self, obex_object_t *object,
 			  uint8_t hi, obex_headerdata_t hv, uint32_t hv_size,
 			  unsigned int flags);
+int obex_object_add_body_reader(obex_t *self, obex_object_t *object, uint32_t len,
+				obex_body_reader reader, void *userdata);
 int obex_object_getnextheader(obex_t *self, obex_object_t *object,
 			      uint8_t *hi, obex_headerdata_t *hv, uint32_t *hv_size);
+/* Values returned by obex_object_getnextheader point into the receive
+   buffer until retained, this happens when the next request is sent. */
+int obex_object_retain_headers(obex_object_t *object);
 int obex_object_set_nonhdr_data(obex_object_t *object, const uint8_t *buffer, unsigned int len);
+int obex_object_set_body_buffer(obex_object_t *object, uint8_t *buffer, unsigned int size);
+int obex_object_set_body_writer(obex_object_t *object, obex_body_writer writer, void *userdata);
+uint8_t * obex_object_take_body(obex_object_t *object, unsigned int *len);
 int obex_request(obex_t *self, obex_object_t *object);
 
 #endif
@@ -0,0 +1,53 @@
+/* probes.h - static tracepoints
+ *
+ * Copyright (C) 2010-2018 - Brian Johnson <brijohn@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ */
+#ifndef PROBES_H
+#define PROBES_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* USDT probes of provider libexword, usable from perf, bpftrace or
+ * systemtap. A disabled probe is a single nop. Without sys/sdt.h the
+ * probes compile to nothing.
+ *
+ * command_start	name, class
+ * command_done		name, class, response, microseconds
+ * request_start	opcode
+ * request_done		opcode, response, microseconds
+ * packet_send		opcode, seq, length, attempt
+ * packet_receive	response, length
+ * seq_verify		expected seq, received seq, ok
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PROBE1(name, a)			DTRACE_PROBE1(libexword, name, a)
+#define PROBE2(name, a, b)		DTRACE_PROBE2(libexword, name, a, b)
+#define PROBE3(name, a, b, c)		DTRACE_PROBE3(libexword, name, a, b, c)
+#define PROBE4(name, a, b, c, d)	DTRACE_PROBE4(libexword, name, a, b, c, d)
+#else
+#define PROBE1(name, a)			do {} while (0)
+#define PROBE2(name, a, b)		do {} while (0)
+#define PROBE3(name, a, b, c)		do {} while (0)
+#define PROBE4(name, a, b, c, d)	do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,300 @@
+/* replay.c - OBEX transport replaying a captured session
+ *
+ * Copyright (C) 2010-2018 - Brian Johnson <brijohn@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ */
+
+/* Plays back a file written by obex_capture_open. Received transfers
+ * complete with the recorded data, written transfers must match the
+ * recorded data or they fail, so a host that no longer sends the same
+ * requests is noticed. Reads past the end of the capture report the
+ * device as gone. Reads that timed out without data are not replayed,
+ * they depend on how long the host was idle.
+ *
+ * If the environment variable EXWORD_REPLAY_TIMING is set the time
+ * between two completions is at least the one recorded.
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "obex.h"
+
+#define REPLAY_MAX_READS	8
+
+struct replay {
+	uint8_t *data;		/* Whole capture file */
+	size_t size;
+	size_t next[2];		/* Offset of the next record of each direction */
+	struct obex_xfer *tx;	/* Submitted transfers */
+	struct obex_xfer *rx[REPLAY_MAX_READS];	/* Reads, oldest first */
+	int rx_count;
+	int timing;
+	struct timeval last;	/* Time of the last completion */
+};
+
+static int replay_load(struct replay *rp, const char *path)
+{
+	struct obex_capture_hdr *hdr;
+	FILE *fp;
+	long size;
+	int ret = -1;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return -1;
+	if (fseek(fp, 0, SEEK_END) < 0 || (size = ftell(fp)) < (long)sizeof(*hdr) ||
+	    fseek(fp, 0, SEEK_SET) < 0)
+		goto out;
+	rp->data = malloc(size);
+	if (rp->data == NULL)
+		goto out;
+	if (fread(rp->data, 1, size, fp) != (size_t)size)
+		goto out;
+	hdr = (struct obex_capture_hdr *)rp->data;
+	if (memcmp(hdr->magic, OBEX_CAPTURE_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    ntohs(hdr->version) != OBEX_CAPTURE_VERSION)
+		goto out;
+	rp->size = size;
+	ret = 0;
+out:
+	fclose(fp);
+	return ret;
+}
+
+/* Returns the record of direction dir at or after offset, or NULL */
+static struct obex_capture_rec * replay_find(struct replay *rp, int dir, size_t *offset)
+{
+	struct obex_capture_rec *rec;
+	while (*offset + sizeof(*rec) <= rp->size) {
+		rec = (struct obex_capture_rec *)(rp->data + *offset);
+		if (*offset + sizeof(*rec) + ntohl(rec->len) > rp->size)
+			break;
+		if (rec->dir == dir && (dir == OBEX_CAPTURE_TX ||
+		    rec->status != OBEX_XFER_TIMEOUT || rec->len != 0))
+			return rec;
+		*offset += sizeof(*rec) + ntohl(rec->len);
+	}
+	*offset = rp->size;
+	return NULL;
+}
+
+static void replay_wait(struct replay *rp, uint32_t delta)
+{
+	struct timeval now;
+	long elapsed;
+	gettimeofday(&now, NULL);
+	elapsed = (now.tv_sec - rp->last.tv_sec) * 1000000 +
+		  now.tv_usec - rp->last.tv_usec;
+	if (elapsed >= 0 && elapsed < delta) {
+		usleep(delta - elapsed);
+		gettimeofday(&now, NULL);
+	}
+	rp->last = now;
+}
+
+static void replay_complete(struct obex_xfer *xfer, int status, int length)
+{
+	xfer->status = status;
+	xfer->actual_length = length;
+	xfer->completed = 1;
+	if (xfer->callback)
+		xfer->callback(xfer);
+}
+
+static struct obex_xfer * replay_pop_read(struct replay *rp)
+{
+	struct obex_xfer *xfer = rp->rx[0];
+	rp->rx_count--;
+	memmove(rp->rx, rp->rx + 1, rp->rx_count * sizeof(rp->rx[0]));
+	return xfer;
+}
+
+/* Completes xfer of direction dir from its record */
+static void replay_next(struct obex_transport *trans, struct obex_xfer *xfer, int dir)
+{
+	struct replay *rp = trans->data;
+	struct obex_capture_rec *rec;
+	uint32_t len;
+	int status;
+
+	rec = replay_find(rp, dir, &rp->next[dir]);
+	if (rec == NULL) {
+		trans->link_lost = 1;
+		replay_complete(xfer, OBEX_XFER_NO_DEVICE, 0);
+		return;
+	}
+	rp->next[dir] += sizeof(*rec) + ntohl(rec->len);
+	if (rp->timing)
+		replay_wait(rp, ntohl(rec->delta));
+
+	len = ntohl(rec->len);
+	status = rec->status;
+	if (dir == OBEX_CAPTURE_TX) {
+		if (len != xfer->length || memcmp(rec + 1, xfer->buffer, len) != 0)
+			status = OBEX_XFER_ERROR;
+	} else {
+		if (len > xfer->length) {
+			len = xfer->length;
+			status = OBEX_XFER_OVERFLOW;
+		}
+		memcpy(xfer->buffer, rec + 1, len);
+	}
+	replay_complete(xfer, status, len);
+}
+
+static int replay_open(struct obex_transport *trans, void *args)
+{
+	struct replay *rp;
+
+	if (args == NULL)
+		return OBEX_XFER_NO_DEVICE;
+	rp = malloc(sizeof(struct replay));
+	if (rp == NULL)
+		return OBEX_XFER_ERROR;
+	memset(rp, 0, sizeof(struct replay));
+	if (replay_load(rp, args) < 0) {
+		free(rp->data);
+		free(rp);
+		return OBEX_XFER_NO_DEVICE;
+	}
+	rp->next[OBEX_CAPTURE_TX] = sizeof(struct obex_capture_hdr);
+	rp->next[OBEX_CAPTURE_RX] = sizeof(struct obex_capture_hdr);
+	rp->timing = getenv("EXWORD_REPLAY_TIMING") != NULL;
+	gettimeofday(&rp->last, NULL);
+	trans->data = rp;
+	trans->link_lost = 0;
+	return 0;
+}
+
+static void replay_close(struct obex_transport *trans)
+{
+	struct replay *rp = trans->data;
+	if (rp == NULL)
+		return;
+	free(rp->data);
+	free(rp);
+	trans->data = NULL;
+}
+
+static int replay_submit(struct obex_transport *trans, struct obex_xfer *xfer)
+{
+	if (trans->link_lost)
+		return OBEX_XFER_NO_DEVICE;
+	xfer->completed = 0;
+	xfer->actual_length = 0;
+	xfer->status = OBEX_XFER_OK;
+	return 0;
+}
+
+static int replay_write(struct obex_transport *trans, struct obex_xfer *xfer)
+{
+	struct replay *rp = trans->data;
+	int ret;
+	if (rp->tx != NULL)
+		return OBEX_XFER_ERROR;
+	ret = replay_submit(trans, xfer);
+	if (ret == 0)
+		rp->tx = xfer;
+	return ret;
+}
+
+static int replay_read(struct obex_transport *trans, struct obex_xfer *xfer)
+{
+	struct replay *rp = trans->data;
+	int ret;
+	if (rp->rx_count >= REPLAY_MAX_READS)
+		return OBEX_XFER_ERROR;
+	ret = replay_submit(trans, xfer);
+	if (ret == 0)
+		rp->rx[rp->rx_count++] = xfer;
+	return ret;
+}
+
+static int replay_cancel(struct obex_transport *trans, struct obex_xfer *xfer)
+{
+	struct replay *rp = trans->data;
+	struct obex_capture_rec *rec;
+	int i, dir;
+
+	if (rp->tx == xfer) {
+		rp->tx = NULL;
+		dir = OBEX_CAPTURE_TX;
+	} else {
+		for (i = 0; i < rp->rx_count && rp->rx[i] != xfer; i++)
+			;
+		if (i == rp->rx_count)
+			return 0;
+		rp->rx_count--;
+		memmove(rp->rx + i, rp->rx + i + 1, (rp->rx_count - i) * sizeof(rp->rx[0]));
+		dir = OBEX_CAPTURE_RX;
+	}
+	/* Skip the record of the cancelled transfer if there is one */
+	rec = replay_find(rp, dir, &rp->next[dir]);
+	if (rec != NULL && rec->status == OBEX_XFER_CANCELLED)
+		rp->next[dir] += sizeof(*rec) + ntohl(rec->len);
+	replay_complete(xfer, OBEX_XFER_CANCELLED, 0);
+	return 0;
+}
+
+static void replay_release(struct obex_transport *trans, struct obex_xfer *xfer)
+{
+}
+
+static int replay_handle_events(struct obex_transport *trans, struct timeval *tv, int *completed)
+{
+	struct replay *rp = trans->data;
+	struct obex_xfer *xfer;
+	/* Nobody waits, so no time passes for the device either */
+	if (completed == NULL)
+		return 0;
+	/* The host waits for the write before it waits for the answer */
+	if (rp->tx != NULL) {
+		xfer = rp->tx;
+		rp->tx = NULL;
+		replay_next(trans, xfer, OBEX_CAPTURE_TX);
+	} else if (rp->rx_count > 0) {
+		replay_next(trans, replay_pop_read(rp), OBEX_CAPTURE_RX);
+	}
+	return 0;
+}
+
+static int replay_get_pollfds(struct obex_transport *trans, struct obex_pollfd *fds, int nfds)
+{
+	return 0;
+}
+
+static int replay_get_timeout(struct obex_transport *trans, struct timeval *tv)
+{
+	return 0;
+}
+
+const struct obex_transport_ops replay_transport_ops = {
+	.open = replay_open,
+	.close = replay_close,
+	.write = replay_write,
+	.read = replay_read,
+	.cancel = replay_cancel,
+	.release = replay_release,
+	.handle_events = replay_handle_events,
+	.get_pollfds = replay_get_pollfds,
+	.get_timeout = replay_get_timeout,
+};
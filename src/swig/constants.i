@@ -23,3 +23,21 @@
 %constant CAPABILITY_C3  = CAP_C3;
 %constant CAPABILITY_EXT = CAP_EXT;
 
+%constant STAT_CONNECT       = EXWORD_STAT_CONNECT;
+%constant STAT_DISCONNECT    = EXWORD_STAT_DISCONNECT;
+%constant STAT_SETPATH       = EXWORD_STAT_SETPATH;
+%constant STAT_GET           = EXWORD_STAT_GET;
+%constant STAT_PUT           = EXWORD_STAT_PUT;
+%constant STAT_REMOVE        = EXWORD_STAT_REMOVE;
+%constant STAT_MODEL         = EXWORD_STAT_MODEL;
+%constant STAT_CAPACITY      = EXWORD_STAT_CAPACITY;
+%constant STAT_LIST          = EXWORD_STAT_LIST;
+%constant STAT_SDFORMAT      = EXWORD_STAT_SDFORMAT;
+%constant STAT_USERID        = EXWORD_STAT_USERID;
+%constant STAT_CRYPTKEY      = EXWORD_STAT_CRYPTKEY;
+%constant STAT_CNAME         = EXWORD_STAT_CNAME;
+%constant STAT_UNLOCK        = EXWORD_STAT_UNLOCK;
+%constant STAT_LOCK          = EXWORD_STAT_LOCK;
+%constant STAT_AUTHCHALLENGE = EXWORD_STAT_AUTHCHALLENGE;
+%constant STAT_AUTHINFO      = EXWORD_STAT_AUTHINFO;
+
@@ -75,6 +75,24 @@ PyModule_AddObject(m, "PyExc_ExwordOther", PyExc_ExwordOther);
 	}
 }
 
+%exception Exword::ConnectDevice {
+	int err;
+	$action
+	if((err = check_error())) {
+		throw_exword_exception(err);
+		SWIG_fail;
+	}
+}
+
+%exception ListDevices {
+	int err;
+	$action
+	if((err = check_error())) {
+		throw_exword_exception(err);
+		SWIG_fail;
+	}
+}
+
 %exception Exword::Connect {
 	int err;
 	$action
@@ -111,6 +129,60 @@ PyModule_AddObject(m, "PyExc_ExwordOther", PyExc_ExwordOther);
 	}
 }
 
+%exception Exword::Calibrate {
+	int err;
+	$action
+	if((err = check_error())) {
+		throw_exword_exception(err);
+		SWIG_fail;
+	}
+}
+
+%exception Exword::mtu {
+	int err;
+	$action
+	if((err = check_error())) {
+		throw_exword_exception(err);
+		SWIG_fail;
+	}
+}
+
+%exception Exword::GetStats {
+	int err;
+	$action
+	if((err = check_error())) {
+		throw_exword_exception(err);
+		SWIG_fail;
+	}
+}
+
+%exception Exword::SetTrace {
+	int err;
+	$action
+	if((err = check_error())) {
+		throw_exword_exception(err);
+		SWIG_fail;
+	}
+}
+
+%exception Exword::WriteTrace {
+	int err;
+	$action
+	if((err = check_error())) {
+		throw_exword_exception(err);
+		SWIG_fail;
+	}
+}
+
+%exception Exword::retries {
+	int err;
+	$action
+	if((err = check_error())) {
+		throw_exword_exception(err);
+		SWIG_fail;
+	}
+}
+
 %exception Exword::SendFile {
 	int err;
 	$action
@@ -208,6 +280,13 @@ PyModule_AddObject(m, "PyExc_ExwordOther", PyExc_ExwordOther);
 	}
 }
 
+%exception exword_device_list_t::__getitem__ {
+	$action
+	if(check_error()) {
+		SWIG_exception_fail(SWIG_IndexError, "Index out of bounds");
+	}
+}
+
 %pythoncode {
 PyExc_ExwordForbidden = _exword.PyExc_ExwordForbidden
 PyExc_ExwordNotFound = _exword.PyExc_ExwordNotFound
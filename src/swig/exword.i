@@ -19,6 +19,30 @@ void Exword_debug_set(Exword *e, int debug) {
 	exword_set_debug(e->device, debug);
 }
 
+int Exword_mtu_get(Exword *e) {
+	return exword_get_mtu(e->device);
+}
+
+void Exword_mtu_set(Exword *e, int mtu) {
+	err_no = exword_set_mtu(e->device, mtu);
+}
+
+int Exword_retries_get(Exword *e) {
+	return exword_get_retries(e->device);
+}
+
+void Exword_retries_set(Exword *e, int retries) {
+	err_no = exword_set_retries(e->device, retries);
+}
+
+int Exword_pipelining_get(Exword *e) {
+	return exword_get_pipelining(e->device);
+}
+
+void Exword_pipelining_set(Exword *e, int enable) {
+	exword_set_pipelining(e->device, enable);
+}
+
 exword_model_t * Exword_model_get(Exword *e) {
 	exword_model_t *model;
 	model = malloc(sizeof(exword_model_t));
@@ -67,6 +91,58 @@ typedef struct {
 %mutable;
 } exword_capacity_t;
 
+typedef struct {
+%immutable;
+	uint32_t requests;
+	uint32_t errors;
+	uint32_t packets_tx;
+	uint32_t packets_rx;
+	uint64_t bytes_tx;
+	uint64_t bytes_rx;
+	uint32_t retries;
+	uint64_t usb_time;
+	uint64_t seq_wait;
+	uint64_t device_time;
+	uint64_t host_time;
+	uint64_t total_time;
+%mutable;
+} exword_stat_t;
+
+typedef struct {
+%immutable;
+	uint8_t bus;
+	uint8_t address;
+	char port[32];
+	char serial[64];
+%mutable;
+} exword_device_t;
+
+%ignore exword_device_list_t::devices;
+%ignore exword_device_list_t::len;
+%inline {
+	typedef struct exword_device_list_t {
+		exword_device_t *devices;
+		int len;
+	} exword_device_list_t;
+}
+
+%extend exword_device_list_t {
+	~exword_device_list_t() {
+		exword_free_devices($self->devices);
+		free($self);
+	}
+	int __len__() {
+		return $self->len;
+	}
+	exword_device_t * __getitem__(size_t i) {
+		if (i >= $self->len) {
+			err_no = 20;
+			return NULL;
+		}
+		return &($self->devices[i]);
+	}
+}
+
 
 typedef struct {
 %immutable;
@@ -114,6 +190,9 @@ typedef struct {
 
 %extend Exword {
 	int debug;
+	int mtu;
+	int retries;
+	int pipelining;
 	const uint8_t connected;
 	const exword_model_t model;
 	const exword_capacity_t capacity;
@@ -133,6 +212,10 @@ typedef struct {
 		$self->options = mode | region;
 		err_no = exword_connect($self->device, $self->options);
 	}
+	void ConnectDevice(exword_device_t *device, uint16_t mode, uint8_t region) {
+		$self->options = mode | region;
+		err_no = exword_connect_device($self->device, device, $self->options);
+	}
 	void Disconnect() {
 		exword_disconnect($self->device);
 	}
@@ -151,6 +234,27 @@ typedef struct {
 	void GetFile(char *filename, char **buffer, int *len) {
 		err_no = exword_get_file($self->device, filename, buffer, len);
 	}
+	exword_stat_t * GetStats(int cls) {
+		exword_stat_t *stat;
+		stat = malloc(sizeof(exword_stat_t));
+		if (stat)
+			err_no = exword_get_stats($self->device, cls, stat);
+		return stat;
+	}
+	void ResetStats() {
+		exword_reset_stats($self->device);
+	}
+	void SetTrace(unsigned int records) {
+		err_no = exword_set_trace($self->device, records);
+	}
+	void WriteTrace(char *filename) {
+		err_no = exword_write_trace($self->device, filename);
+	}
+	uint16_t Calibrate(char *path, char *filename) {
+		uint16_t mtu = 0;
+		err_no = exword_calibrate($self->device, path, filename, &mtu);
+		return mtu;
+	}
 	void RemoveFile(char * filename) {
 		int longname = 0;
 		exword_model_t model;
@@ -208,6 +312,17 @@ typedef struct {
 
 %inline %{
 
+exword_device_list_t * ListDevices() {
+	exword_device_list_t *list;
+	uint16_t count;
+	list = calloc(1, sizeof(exword_device_list_t));
+	if (list == NULL)
+		return NULL;
+	err_no = exword_list_devices(&list->devices, &count);
+	list->len = count;
+	return list;
+}
+
 char * CryptData(char *data, int len, char key[16]) {
 	crypt_data(data, len, key);
 	return data;
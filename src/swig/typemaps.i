@@ -36,6 +36,8 @@
 
 %apply SWIGTYPE * SUBOBJECT { exword_model_t * model };
 %apply SWIGTYPE * SUBOBJECT { exword_capacity_t * capacity };
+%apply SWIGTYPE * SUBOBJECT { exword_stat_t * GetStats };
+%apply SWIGTYPE * SUBOBJECT { exword_device_list_t * ListDevices };
 
 
 %cstring_output_allocate_size(char **buffer, int *len, free(*$1));
@@ -0,0 +1,93 @@
+/* trace.c - binary trace ring of the OBEX code
+ *
+ * Copyright (C) 2010-2018 - Brian Johnson <brijohn@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ */
+
+/* Events are stored unformatted in a ring of fixed size records, so
+ * tracing can stay enabled during transfers. The ring is written to a
+ * file on request and rendered by exword-trace. */
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "trace.h"
+
+static uint64_t trace_time(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+struct obex_trace * obex_trace_new(unsigned int records)
+{
+	struct obex_trace *trace;
+	uint32_t size = 1;
+	if (records == 0 || records > (1 << 24))
+		return NULL;
+	while (size < records)
+		size <<= 1;
+	trace = malloc(sizeof(struct obex_trace) + size * sizeof(struct obex_trace_rec));
+	if (trace == NULL)
+		return NULL;
+	trace->size = size;
+	trace->count = 0;
+	trace->start = trace_time();
+	return trace;
+}
+
+void obex_trace_add(struct obex_trace *trace, uint8_t event, uint8_t seq,
+		    uint8_t code, uint8_t flags, uint32_t value)
+{
+	struct obex_trace_rec *rec = &trace->rec[trace->count++ & (trace->size - 1)];
+	rec->time = trace_time() - trace->start;
+	rec->event = event;
+	rec->seq = seq;
+	rec->code = code;
+	rec->flags = flags;
+	rec->value = value;
+}
+
+int obex_trace_write(struct obex_trace *trace, FILE *fp)
+{
+	struct obex_trace_hdr hdr;
+	struct obex_trace_rec rec;
+	uint8_t *stamp = (uint8_t *)&rec.time;
+	uint32_t i, n;
+	int j;
+
+	n = trace->count < trace->size ? trace->count : trace->size;
+	memcpy(hdr.magic, OBEX_TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = htons(OBEX_TRACE_VERSION);
+	hdr.records = htonl(n);
+	hdr.lost = htonl(trace->count - n);
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		return -1;
+	for (i = trace->count - n; i != trace->count; i++) {
+		rec = trace->rec[i & (trace->size - 1)];
+		for (j = 0; j < 8; j++)
+			stamp[j] = trace->rec[i & (trace->size - 1)].time >> (56 - j * 8);
+		rec.value = htonl(rec.value);
+		if (fwrite(&rec, sizeof(rec), 1, fp) != 1)
+			return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,91 @@
+/* trace.h - binary trace ring of the OBEX code
+ *
+ * Copyright (C) 2010-2018 - Brian Johnson <brijohn@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* Highest trace level compiled in, records above it cost nothing */
+#ifndef OBEX_TRACE_LEVEL
+#define OBEX_TRACE_LEVEL	3
+#endif
+
+/* Trace events, the level each is recorded at is given in brackets */
+#define OBEX_TRACE_REQUEST_START	1	/* [1] code: opcode */
+#define OBEX_TRACE_REQUEST_DONE		2	/* [1] code: opcode, value: response or error */
+#define OBEX_TRACE_RETRY		3	/* [1] seq, value: error */
+#define OBEX_TRACE_PIPELINE_OFF		4	/* [1] seq, value: error */
+#define OBEX_TRACE_ANSWER_LOST		5	/* [1] seq */
+#define OBEX_TRACE_PACKET_SEND		6	/* [2] seq, code: opcode, flags: attempt, value: length */
+#define OBEX_TRACE_PACKET_AHEAD		7	/* [2] seq, code: opcode, value: length */
+#define OBEX_TRACE_PACKET_RECEIVE	8	/* [2] code: response, value: length */
+#define OBEX_TRACE_SEQ_OK		9	/* [3] seq */
+#define OBEX_TRACE_SEQ_MISMATCH		10	/* [3] seq, code: received */
+#define OBEX_TRACE_SEQ_ERROR		11	/* [3] seq, value: error */
+
+/* Fixed size record, times are microseconds since tracing started */
+struct obex_trace_rec {
+	uint64_t time;
+	uint8_t event;
+	uint8_t seq;
+	uint8_t code;
+	uint8_t flags;
+	uint32_t value;
+};
+
+struct obex_trace {
+	uint32_t size;		/* Records held, a power of two */
+	uint32_t count;		/* Records written since tracing started */
+	uint64_t start;
+	struct obex_trace_rec rec[];
+};
+
+/* Trace file: a obex_trace_hdr followed by the records, oldest first.
+   Fields are in network byte order. */
+#define OBEX_TRACE_MAGIC	"EXWTRC"
+#define OBEX_TRACE_VERSION	1
+
+#pragma pack(1)
+struct obex_trace_hdr {
+	char magic[6];
+	uint16_t version;
+	uint32_t records;	/* Records following */
+	uint32_t lost;		/* Older records overwritten in the ring */
+};
+#pragma pack()
+
+#define TRACE(trace, level, event, seq, code, flags, value) \
+	do { \
+		if ((level) <= OBEX_TRACE_LEVEL && (trace) != NULL) \
+			obex_trace_add(trace, event, seq, code, flags, value); \
+	} while (0)
+
+struct obex_trace * obex_trace_new(unsigned int records);
+void obex_trace_add(struct obex_trace *trace, uint8_t event, uint8_t seq,
+		    uint8_t code, uint8_t flags, uint32_t value);
+int obex_trace_write(struct obex_trace *trace, FILE *fp);
+
+#endif
@@ -0,0 +1,122 @@
+/* transport.h - link layer interface used by the OBEX code
+ *
+ * Copyright (C) 2010-2018 - Brian Johnson <brijohn@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ */
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <inttypes.h>
+#include <sys/time.h>
+
+/* Transfer status */
+#define OBEX_XFER_OK		0
+#define OBEX_XFER_ERROR		-1
+#define OBEX_XFER_TIMEOUT	-2
+#define OBEX_XFER_NO_DEVICE	-3
+#define OBEX_XFER_CANCELLED	-4
+#define OBEX_XFER_OVERFLOW	-5
+
+struct obex_transport;
+struct obex_xfer;
+
+typedef void (*obex_xfer_cb)(struct obex_xfer *xfer);
+
+/* A bulk transfer submitted to a transport. The transport sets
+ * actual_length, status and completed before calling callback. */
+struct obex_xfer {
+	uint8_t *buffer;
+	int length;
+	int actual_length;
+	int status;
+	int completed;
+	unsigned int timeout;	/* Milliseconds, 0 waits until cancelled */
+	obex_xfer_cb callback;
+	void *user_data;
+	void *priv;		/* Owned by the transport */
+};
+
+struct obex_pollfd {
+	int fd;
+	short events;
+};
+
+struct obex_transport_ops {
+	int (*open)(struct obex_transport *trans, void *args);
+	void (*close)(struct obex_transport *trans);
+	/* Submit a transfer, completion is reported from handle_events */
+	int (*write)(struct obex_transport *trans, struct obex_xfer *xfer);
+	int (*read)(struct obex_transport *trans, struct obex_xfer *xfer);
+	int (*cancel)(struct obex_transport *trans, struct obex_xfer *xfer);
+	/* Free transport resources held by an idle transfer */
+	void (*release)(struct obex_transport *trans, struct obex_xfer *xfer);
+	/* Process completions. Blocks until *completed is set if tv is NULL */
+	int (*handle_events)(struct obex_transport *trans, struct timeval *tv, int *completed);
+	/* Store up to nfds descriptors to poll on, returns number available */
+	int (*get_pollfds)(struct obex_transport *trans, struct obex_pollfd *fds, int nfds);
+	/* Time until handle_events must be called, returns 0 if there is none */
+	int (*get_timeout)(struct obex_transport *trans, struct timeval *tv);
+};
+
+struct obex_transport {
+	const struct obex_transport_ops *ops;
+	void *data;		/* Backend state */
+	int link_lost;		/* Set by the backend when the device went away */
+};
+
+/* USB backend */
+#define USB_PORT_MAX	32
+#define USB_SERIAL_MAX	64
+
+/* Where a device is attached. The port path ("1-4.2", bus and hub ports
+   as in sysfs) stays the same across replugs while the address does not. */
+struct usb_device_id {
+	uint8_t bus;
+	uint8_t address;
+	char port[USB_PORT_MAX];
+	char serial[USB_SERIAL_MAX];	/* Empty if the device has none */
+};
+
+struct usb_transport_args {
+	uint16_t vid;
+	uint16_t pid;
+	const char *port;	/* Open only the device at this port, or NULL */
+	const char *serial;	/* Open only the device with this serial, or NULL */
+};
+
+extern const struct obex_transport_ops usb_transport_ops;
+
+/* Stores a malloced array of the attached devices in list, returns their number */
+int usb_list_devices(uint16_t vid, uint16_t pid, struct usb_device_id **list);
+
+/* Hotplug notification. Devices arriving or leaving, and those attached
+   when it is started, are reported to fn from usb_hotplug_poll. While it
+   runs sessions are opened without scanning the bus. */
+typedef void (*usb_hotplug_fn)(const struct usb_device_id *id, int arrived, void *data);
+
+int usb_hotplug_start(uint16_t vid, uint16_t pid, usb_hotplug_fn fn, void *data);
+void usb_hotplug_stop(void);
+int usb_hotplug_poll(struct timeval *tv);
+
+/* Software device backed by a host directory, args is the path */
+extern const struct obex_transport_ops emulator_transport_ops;
+
+/* Plays back a capture written by obex_capture_open, args is the path */
+extern const struct obex_transport_ops replay_transport_ops;
+
+#endif
@@ -0,0 +1,697 @@
+/* usb.c - libusb transport for the OBEX code
+ *
+ * Copyright (C) 2010-2018 - Brian Johnson <brijohn@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ */
+
+#include <libusb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "transport.h"
+
+#define USB_INTERRUPT_TIMEOUT	3000
+
+struct usb_transport {
+	struct libusb_context *usb_ctx;
+	struct libusb_device_handle *usb_dev;
+	uint8_t intf_num;
+	uint8_t read_endpoint_address;
+	uint8_t write_endpoint_address;
+	uint8_t interrupt_endpoint_address;
+	struct libusb_transfer *int_urb;	/* Watches the device for unplug */
+	int int_done;
+	uint8_t int_buffer[16];
+};
+
+#define USB_KNOWN_ARRIVED	1	/* Arrival not reported yet */
+#define USB_KNOWN_PRESENT	2
+#define USB_KNOWN_LEFT		3	/* Departure not reported yet */
+
+/* Device seen by the hotplug callback */
+struct usb_known {
+	libusb_device *device;
+	struct usb_device_id id;
+	int state;
+	int reported;		/* Arrival was reported */
+	struct usb_known *next;
+};
+
+/* libusb context shared by all sessions of the process. While hotplug is
+   on the attached devices are known and the bus is not scanned again. */
+static struct {
+	pthread_mutex_t lock;
+	struct libusb_context *ctx;
+	int refs;
+	int hotplug;				/* Callback registered */
+	libusb_hotplug_callback_handle handle;
+	usb_hotplug_fn fn;
+	void *data;
+	struct usb_known *known;		/* Attached devices, oldest first */
+} usb_shared = { PTHREAD_MUTEX_INITIALIZER };
+
+static struct libusb_context * usb_ref(void)
+{
+	struct libusb_context *usb_ctx;
+	pthread_mutex_lock(&usb_shared.lock);
+	if (usb_shared.refs == 0 && libusb_init(&usb_shared.ctx) < 0)
+		usb_shared.ctx = NULL;
+	if (usb_shared.ctx)
+		usb_shared.refs++;
+	usb_ctx = usb_shared.ctx;
+	pthread_mutex_unlock(&usb_shared.lock);
+	return usb_ctx;
+}
+
+static void usb_unref(void)
+{
+	pthread_mutex_lock(&usb_shared.lock);
+	if (--usb_shared.refs == 0) {
+		libusb_exit(usb_shared.ctx);
+		usb_shared.ctx = NULL;
+	}
+	pthread_mutex_unlock(&usb_shared.lock);
+}
+
+/* Stores a referenced, NULL terminated array of the attached devices in
+   list, from the hotplug cache if there is one. Returns their number. */
+static ssize_t usb_get_devices(struct libusb_context *usb_ctx, libusb_device ***list)
+{
+	libusb_device **devices = NULL, **scanned;
+	struct usb_known *known;
+	ssize_t i, size = 0;
+
+	pthread_mutex_lock(&usb_shared.lock);
+	if (usb_shared.hotplug) {
+		for (known = usb_shared.known; known; known = known->next)
+			size++;
+		devices = calloc(size + 1, sizeof(libusb_device *));
+		size = 0;
+		for (known = usb_shared.known; devices && known; known = known->next) {
+			if (known->state != USB_KNOWN_LEFT)
+				devices[size++] = libusb_ref_device(known->device);
+		}
+		pthread_mutex_unlock(&usb_shared.lock);
+	} else {
+		pthread_mutex_unlock(&usb_shared.lock);
+		size = libusb_get_device_list(usb_ctx, &scanned);
+		if (size < 0)
+			return size;
+		devices = calloc(size + 1, sizeof(libusb_device *));
+		for (i = 0; devices && i < size; i++)
+			devices[i] = libusb_ref_device(scanned[i]);
+		libusb_free_device_list(scanned, 1);
+	}
+	if (devices == NULL)
+		return LIBUSB_ERROR_NO_MEM;
+	*list = devices;
+	return size;
+}
+
+static void usb_free_devices(libusb_device **list)
+{
+	int i;
+	for (i = 0; list[i] != NULL; i++)
+		libusb_unref_device(list[i]);
+	free(list);
+}
+
+static int usb_claim_interface(struct usb_transport *ctx)
+{
+	struct libusb_config_descriptor *config = NULL;
+	const struct libusb_interface *intf;
+	const struct libusb_interface_descriptor *intf_desc;
+	const struct libusb_endpoint_descriptor *ep_desc;
+	int ret = 0;
+	int i, j, k;
+	ret = libusb_get_active_config_descriptor(libusb_get_device(ctx->usb_dev), &config);
+	if (ret < 0)
+		goto done;
+	for (i = 0; i < config->bNumInterfaces; i++) {
+		intf = &config->interface[i];
+		for (j = 0; j < intf->num_altsetting; j++) {
+			intf_desc = &intf->altsetting[j];
+			ctx->read_endpoint_address = 0;
+			ctx->write_endpoint_address = 0;
+			for (k = 0; k < intf_desc->bNumEndpoints; k++) {
+				ep_desc = &intf_desc->endpoint[k];
+				if ((ep_desc->bmAttributes & 3) == LIBUSB_TRANSFER_TYPE_BULK) {
+					if (!ctx->read_endpoint_address &&
+					    (ep_desc->bEndpointAddress & 0x80) == LIBUSB_ENDPOINT_IN)
+						ctx->read_endpoint_address = ep_desc->bEndpointAddress;
+					else if (!ctx->write_endpoint_address &&
+						 (ep_desc->bEndpointAddress & 0x80) == LIBUSB_ENDPOINT_OUT)
+						ctx->write_endpoint_address = ep_desc->bEndpointAddress;
+				} else if ((ep_desc->bmAttributes & 3) == LIBUSB_TRANSFER_TYPE_INTERRUPT) {
+					if (!ctx->interrupt_endpoint_address &&
+					    (ep_desc->bEndpointAddress & 0x80) == LIBUSB_ENDPOINT_IN)
+						ctx->interrupt_endpoint_address = ep_desc->bEndpointAddress;
+				}
+			}
+			if (ctx->read_endpoint_address && ctx->write_endpoint_address)
+				goto done;
+		}
+	}
+	ret = LIBUSB_ERROR_NOT_FOUND;
+done:
+	if (ret == 0) {
+		ctx->intf_num = intf_desc->bInterfaceNumber;
+		ret = libusb_claim_interface(ctx->usb_dev, ctx->intf_num);
+		if (ret == 0) {
+			ret = libusb_set_interface_alt_setting(ctx->usb_dev, ctx->intf_num, intf_desc->bAlternateSetting);
+			if (ret < 0)
+				libusb_release_interface(ctx->usb_dev, ctx->intf_num);
+		}
+	}
+	if (config != NULL)
+		libusb_free_config_descriptor(config);
+	return ret;
+}
+
+/* Fills id for device, the serial is read through handle if not NULL */
+static void usb_get_id(libusb_device *device, libusb_device_handle *handle,
+		       struct usb_device_id *id)
+{
+	struct libusb_device_descriptor desc;
+	uint8_t ports[7];
+	int i, n, len;
+
+	memset(id, 0, sizeof(struct usb_device_id));
+	id->bus = libusb_get_bus_number(device);
+	id->address = libusb_get_device_address(device);
+	len = snprintf(id->port, sizeof(id->port), "%u", id->bus);
+	n = libusb_get_port_numbers(device, ports, sizeof(ports));
+	for (i = 0; i < n && len < sizeof(id->port); i++)
+		len += snprintf(id->port + len, sizeof(id->port) - len,
+				"%c%u", i == 0 ? '-' : '.', ports[i]);
+	if (handle == NULL || libusb_get_device_descriptor(device, &desc) < 0 ||
+	    desc.iSerialNumber == 0)
+		return;
+	if (libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber,
+					       (unsigned char *)id->serial,
+					       sizeof(id->serial)) < 0)
+		id->serial[0] = '\0';
+}
+
+/* Checks the device against the port and serial asked for */
+static int usb_match(struct usb_transport_args *args, libusb_device *device,
+		     libusb_device_handle *handle)
+{
+	struct usb_device_id id;
+	if (args->port == NULL && args->serial == NULL)
+		return 1;
+	usb_get_id(device, args->serial ? handle : NULL, &id);
+	if (args->port && strcmp(args->port, id.port) != 0)
+		return 0;
+	if (args->serial && strcmp(args->serial, id.serial) != 0)
+		return 0;
+	return 1;
+}
+
+int usb_list_devices(uint16_t vid, uint16_t pid, struct usb_device_id **list)
+{
+	struct libusb_context *usb_ctx;
+	struct libusb_device_descriptor desc;
+	libusb_device_handle *handle;
+	libusb_device **devices;
+	struct usb_device_id *ids;
+	int i, size, count = 0;
+
+	usb_ctx = usb_ref();
+	if (usb_ctx == NULL)
+		return -1;
+	size = usb_get_devices(usb_ctx, &devices);
+	if (size < 0) {
+		usb_unref();
+		return -1;
+	}
+	ids = malloc((size + 1) * sizeof(struct usb_device_id));
+	if (ids == NULL)
+		goto out;
+	for (i = 0; i < size; i++) {
+		if (libusb_get_device_descriptor(devices[i], &desc) < 0)
+			continue;
+		if (desc.idVendor != vid || desc.idProduct != pid)
+			continue;
+		/* Without access to the device the serial stays empty */
+		if (libusb_open(devices[i], &handle) < 0)
+			handle = NULL;
+		usb_get_id(devices[i], handle, &ids[count++]);
+		if (handle)
+			libusb_close(handle);
+	}
+out:
+	usb_free_devices(devices);
+	usb_unref();
+	*list = ids;
+	return ids ? count : -1;
+}
+
+/* Runs inside libusb event handling, where no I/O may be done. The events
+   are only recorded and reported from usb_hotplug_poll. */
+static int LIBUSB_CALL usb_hotplug_cb(struct libusb_context *usb_ctx, libusb_device *device,
+				      libusb_hotplug_event event, void *user_data)
+{
+	struct usb_known *known, **p;
+	pthread_mutex_lock(&usb_shared.lock);
+	if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+		known = calloc(1, sizeof(struct usb_known));
+		if (known != NULL) {
+			known->device = libusb_ref_device(device);
+			usb_get_id(device, NULL, &known->id);
+			known->state = USB_KNOWN_ARRIVED;
+			for (p = &usb_shared.known; *p != NULL; p = &(*p)->next)
+				;
+			*p = known;
+		}
+	} else {
+		for (known = usb_shared.known; known != NULL; known = known->next) {
+			if (known->device == device && known->state != USB_KNOWN_LEFT) {
+				known->state = USB_KNOWN_LEFT;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&usb_shared.lock);
+	return 0;
+}
+
+static void usb_forget_known(void)
+{
+	struct usb_known *known;
+	pthread_mutex_lock(&usb_shared.lock);
+	while ((known = usb_shared.known) != NULL) {
+		usb_shared.known = known->next;
+		libusb_unref_device(known->device);
+		free(known);
+	}
+	pthread_mutex_unlock(&usb_shared.lock);
+}
+
+int usb_hotplug_start(uint16_t vid, uint16_t pid, usb_hotplug_fn fn, void *data)
+{
+	struct libusb_context *usb_ctx;
+	libusb_hotplug_callback_handle handle;
+	int ret;
+
+	if (fn == NULL || !libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+		return -1;
+	usb_ctx = usb_ref();
+	if (usb_ctx == NULL)
+		return -1;
+	pthread_mutex_lock(&usb_shared.lock);
+	if (usb_shared.fn != NULL) {
+		pthread_mutex_unlock(&usb_shared.lock);
+		usb_unref();
+		return -1;
+	}
+	usb_shared.fn = fn;
+	usb_shared.data = data;
+	pthread_mutex_unlock(&usb_shared.lock);
+
+	/* Devices already attached are reported from within this call */
+	ret = libusb_hotplug_register_callback(usb_ctx,
+					       LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED |
+					       LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+					       LIBUSB_HOTPLUG_ENUMERATE, vid, pid,
+					       LIBUSB_HOTPLUG_MATCH_ANY, usb_hotplug_cb,
+					       NULL, &handle);
+	if (ret != LIBUSB_SUCCESS) {
+		usb_forget_known();
+		pthread_mutex_lock(&usb_shared.lock);
+		usb_shared.fn = NULL;
+		pthread_mutex_unlock(&usb_shared.lock);
+		usb_unref();
+		return -1;
+	}
+	pthread_mutex_lock(&usb_shared.lock);
+	usb_shared.handle = handle;
+	usb_shared.hotplug = 1;
+	pthread_mutex_unlock(&usb_shared.lock);
+	return 0;
+}
+
+void usb_hotplug_stop(void)
+{
+	struct libusb_context *usb_ctx;
+	libusb_hotplug_callback_handle handle;
+	pthread_mutex_lock(&usb_shared.lock);
+	if (!usb_shared.hotplug) {
+		pthread_mutex_unlock(&usb_shared.lock);
+		return;
+	}
+	usb_shared.hotplug = 0;
+	usb_shared.fn = NULL;
+	usb_ctx = usb_shared.ctx;
+	handle = usb_shared.handle;
+	pthread_mutex_unlock(&usb_shared.lock);
+	/* The reference taken by usb_hotplug_start keeps usb_ctx alive, the
+	   lock is not held as the callback takes it */
+	libusb_hotplug_deregister_callback(usb_ctx, handle);
+	usb_forget_known();
+	usb_unref();
+}
+
+int usb_hotplug_poll(struct timeval *tv)
+{
+	struct usb_known *known, **p;
+	struct usb_device_id id;
+	libusb_device_handle *handle;
+	libusb_device *device;
+	struct libusb_context *usb_ctx;
+	usb_hotplug_fn fn;
+	void *data;
+	int ret, arrived;
+
+	/* Hold a reference so a concurrent usb_hotplug_stop cannot free the
+	   context while events are handled */
+	pthread_mutex_lock(&usb_shared.lock);
+	if (!usb_shared.hotplug) {
+		pthread_mutex_unlock(&usb_shared.lock);
+		return -1;
+	}
+	usb_shared.refs++;
+	usb_ctx = usb_shared.ctx;
+	pthread_mutex_unlock(&usb_shared.lock);
+	ret = libusb_handle_events_timeout_completed(usb_ctx, tv, NULL);
+	if (ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED) {
+		usb_unref();
+		return -1;
+	}
+	for (;;) {
+		pthread_mutex_lock(&usb_shared.lock);
+		for (p = &usb_shared.known; *p != NULL; p = &(*p)->next) {
+			if ((*p)->state != USB_KNOWN_PRESENT)
+				break;
+		}
+		known = *p;
+		fn = usb_shared.fn;
+		data = usb_shared.data;
+		if (known == NULL || fn == NULL) {
+			pthread_mutex_unlock(&usb_shared.lock);
+			break;
+		}
+		if (known->state == USB_KNOWN_LEFT) {
+			*p = known->next;
+			pthread_mutex_unlock(&usb_shared.lock);
+			id = known->id;
+			arrived = known->reported ? 0 : -1;
+			libusb_unref_device(known->device);
+			free(known);
+			/* Gone before anyone heard of it */
+			if (arrived < 0)
+				continue;
+		} else {
+			known->state = USB_KNOWN_PRESENT;
+			known->reported = 1;
+			device = libusb_ref_device(known->device);
+			pthread_mutex_unlock(&usb_shared.lock);
+			/* Reading the serial needs I/O, so it is done here */
+			if (libusb_open(device, &handle) == 0) {
+				usb_get_id(device, handle, &id);
+				libusb_close(handle);
+			} else {
+				usb_get_id(device, NULL, &id);
+			}
+			/* known may have been freed by usb_hotplug_stop
+			   meanwhile, find it again by its device */
+			pthread_mutex_lock(&usb_shared.lock);
+			for (known = usb_shared.known; known != NULL; known = known->next) {
+				if (known->device == device) {
+					known->id = id;
+					break;
+				}
+			}
+			pthread_mutex_unlock(&usb_shared.lock);
+			libusb_unref_device(device);
+			arrived = 1;
+		}
+		fn(&id, arrived, data);
+	}
+	usb_unref();
+	return 0;
+}
+
+static void usb_interrupt_cb(struct libusb_transfer *transfer)
+{
+	struct obex_transport *trans = (struct obex_transport *)transfer->user_data;
+	struct usb_transport *ctx = trans->data;
+	switch(transfer->status) {
+	case LIBUSB_TRANSFER_TIMED_OUT:
+	case LIBUSB_TRANSFER_COMPLETED:
+		if (libusb_submit_transfer(transfer) == 0)
+			return;
+		break;
+	case LIBUSB_TRANSFER_NO_DEVICE:
+	case LIBUSB_TRANSFER_ERROR:
+		trans->link_lost = 1;
+		break;
+	default:
+		break;
+	}
+	ctx->int_done = 1;
+}
+
+static void usb_transfer_cb(struct libusb_transfer *transfer)
+{
+	struct obex_xfer *xfer = (struct obex_xfer *)transfer->user_data;
+	xfer->actual_length = transfer->actual_length;
+	switch (transfer->status) {
+	case LIBUSB_TRANSFER_COMPLETED:
+		xfer->status = OBEX_XFER_OK;
+		break;
+	case LIBUSB_TRANSFER_TIMED_OUT:
+		xfer->status = OBEX_XFER_TIMEOUT;
+		break;
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		xfer->status = OBEX_XFER_NO_DEVICE;
+		break;
+	case LIBUSB_TRANSFER_CANCELLED:
+		xfer->status = OBEX_XFER_CANCELLED;
+		break;
+	case LIBUSB_TRANSFER_OVERFLOW:
+		xfer->status = OBEX_XFER_OVERFLOW;
+		break;
+	default:
+		xfer->status = OBEX_XFER_ERROR;
+		break;
+	}
+	xfer->completed = 1;
+	if (xfer->callback)
+		xfer->callback(xfer);
+}
+
+static int usb_submit(struct obex_transport *trans, struct obex_xfer *xfer, uint8_t endpoint)
+{
+	struct usb_transport *ctx = trans->data;
+	struct libusb_transfer *transfer = xfer->priv;
+	if (transfer == NULL) {
+		transfer = libusb_alloc_transfer(0);
+		if (transfer == NULL)
+			return OBEX_XFER_ERROR;
+		xfer->priv = transfer;
+	}
+	xfer->completed = 0;
+	xfer->actual_length = 0;
+	xfer->status = OBEX_XFER_OK;
+	libusb_fill_bulk_transfer(transfer, ctx->usb_dev, endpoint, xfer->buffer,
+				  xfer->length, usb_transfer_cb, xfer, xfer->timeout);
+	switch (libusb_submit_transfer(transfer)) {
+	case 0:
+		return 0;
+	case LIBUSB_ERROR_NO_DEVICE:
+		trans->link_lost = 1;
+		return OBEX_XFER_NO_DEVICE;
+	default:
+		return OBEX_XFER_ERROR;
+	}
+}
+
+static int usb_open(struct obex_transport *trans, void *args)
+{
+	struct usb_transport_args *usb_args = args;
+	struct usb_transport *ctx;
+	libusb_device **list;
+	int i, size = 0;
+
+	ctx = malloc(sizeof(struct usb_transport));
+	if (ctx == NULL)
+		return OBEX_XFER_ERROR;
+	memset(ctx, 0, sizeof(struct usb_transport));
+
+	ctx->usb_ctx = usb_ref();
+	if (ctx->usb_ctx == NULL)
+		goto out_err;
+
+	size = usb_get_devices(ctx->usb_ctx, &list);
+	if (size < 0)
+		goto out_err;
+
+	for (i = 0; i < size; i++) {
+		struct libusb_device_descriptor desc;
+		libusb_device *device = list[i];
+		if (libusb_get_device_descriptor(device, &desc) < 0)
+			continue;
+		if (desc.idVendor != usb_args->vid || desc.idProduct != usb_args->pid)
+			continue;
+		if (libusb_open(device, &ctx->usb_dev) < 0)
+			continue;
+		/* A device claimed by another session fails here and is skipped */
+		if (usb_match(usb_args, device, ctx->usb_dev) && usb_claim_interface(ctx) == 0)
+			break;
+		libusb_close(ctx->usb_dev);
+		ctx->usb_dev = NULL;
+	}
+
+	usb_free_devices(list);
+	if (i >= size)
+		goto out_err;
+
+	size = libusb_control_transfer(ctx->usb_dev,
+				       LIBUSB_REQUEST_TYPE_VENDOR + LIBUSB_RECIPIENT_INTERFACE,
+				       0x0000001, 0x0000000, 0x0000000, NULL, 0x0000000, 1000);
+	if (size < 0)
+		goto out_release;
+
+	trans->data = ctx;
+	trans->link_lost = 0;
+
+	ctx->int_done = 1;
+	if (ctx->interrupt_endpoint_address) {
+		ctx->int_urb = libusb_alloc_transfer(0);
+		if (ctx->int_urb == NULL)
+			goto out_release;
+		libusb_fill_interrupt_transfer(ctx->int_urb, ctx->usb_dev,
+					       ctx->interrupt_endpoint_address,
+					       ctx->int_buffer, sizeof(ctx->int_buffer),
+					       usb_interrupt_cb, trans, USB_INTERRUPT_TIMEOUT);
+		if (libusb_submit_transfer(ctx->int_urb) == 0)
+			ctx->int_done = 0;
+	}
+	return 0;
+
+out_release:
+	libusb_release_interface(ctx->usb_dev, ctx->intf_num);
+out_err:
+	if (ctx->usb_dev)
+		libusb_close(ctx->usb_dev);
+	if (ctx->usb_ctx)
+		usb_unref();
+	free(ctx);
+	trans->data = NULL;
+	return OBEX_XFER_NO_DEVICE;
+}
+
+static void usb_close(struct obex_transport *trans)
+{
+	struct usb_transport *ctx = trans->data;
+	if (ctx == NULL)
+		return;
+	if (ctx->int_urb) {
+		if (!ctx->int_done && libusb_cancel_transfer(ctx->int_urb) == 0) {
+			while (!ctx->int_done) {
+				if (libusb_handle_events_completed(ctx->usb_ctx, &ctx->int_done) < 0)
+					break;
+			}
+		}
+		libusb_free_transfer(ctx->int_urb);
+	}
+	libusb_release_interface(ctx->usb_dev, ctx->intf_num);
+	libusb_close(ctx->usb_dev);
+	usb_unref();
+	free(ctx);
+	trans->data = NULL;
+}
+
+static int usb_write(struct obex_transport *trans, struct obex_xfer *xfer)
+{
+	struct usb_transport *ctx = trans->data;
+	return usb_submit(trans, xfer, ctx->write_endpoint_address);
+}
+
+static int usb_read(struct obex_transport *trans, struct obex_xfer *xfer)
+{
+	struct usb_transport *ctx = trans->data;
+	return usb_submit(trans, xfer, ctx->read_endpoint_address);
+}
+
+static int usb_cancel(struct obex_transport *trans, struct obex_xfer *xfer)
+{
+	if (xfer->priv == NULL || xfer->completed)
+		return 0;
+	return libusb_cancel_transfer(xfer->priv) < 0 ? OBEX_XFER_ERROR : 0;
+}
+
+static void usb_release(struct obex_transport *trans, struct obex_xfer *xfer)
+{
+	if (xfer->priv)
+		libusb_free_transfer(xfer->priv);
+	xfer->priv = NULL;
+}
+
+static int usb_handle_events(struct obex_transport *trans, struct timeval *tv, int *completed)
+{
+	struct usb_transport *ctx = trans->data;
+	int ret;
+	if (tv == NULL)
+		ret = libusb_handle_events_completed(ctx->usb_ctx, completed);
+	else
+		ret = libusb_handle_events_timeout_completed(ctx->usb_ctx, tv, completed);
+	if (ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED)
+		return OBEX_XFER_ERROR;
+	return 0;
+}
+
+static int usb_get_pollfds(struct obex_transport *trans, struct obex_pollfd *fds, int nfds)
+{
+	struct usb_transport *ctx = trans->data;
+	const struct libusb_pollfd **list;
+	int i;
+	list = libusb_get_pollfds(ctx->usb_ctx);
+	if (list == NULL)
+		return OBEX_XFER_ERROR;
+	for (i = 0; list[i] != NULL; i++) {
+		if (i < nfds) {
+			fds[i].fd = list[i]->fd;
+			fds[i].events = list[i]->events;
+		}
+	}
+	libusb_free_pollfds(list);
+	return i;
+}
+
+static int usb_get_timeout(struct obex_transport *trans, struct timeval *tv)
+{
+	struct usb_transport *ctx = trans->data;
+	int ret = libusb_get_next_timeout(ctx->usb_ctx, tv);
+	return ret < 0 ? OBEX_XFER_ERROR : ret;
+}
+
+const struct obex_transport_ops usb_transport_ops = {
+	.open = usb_open,
+	.close = usb_close,
+	.write = usb_write,
+	.read = usb_read,
+	.cancel = usb_cancel,
+	.release = usb_release,
+	.handle_events = usb_handle_events,
+	.get_pollfds = usb_get_pollfds,
+	.get_timeout = usb_get_timeout,
+};
@@ -323,6 +323,146 @@ int read_file(const char* filename, char **buffer, int *len)
 	return 0;
 }
 
+static void stream_crypt(struct file_stream *fs, char *buffer, int len)
+{
+	char key[16];
+	int i;
+	if (fs->key == NULL)
+		return;
+	/* crypt_data starts at key[0], rotate key to the stream position */
+	for (i = 0; i < 16; i++)
+		key[i] = fs->key[(fs->offset + i) % 16];
+	crypt_data(buffer, len, key);
+}
+
+int open_read_stream(struct file_stream *fs, const char* filename, char *key, int *len)
+{
+	struct stat buf;
+	fs->key = key;
+	fs->offset = 0;
+	fs->path = NULL;
+	fs->temp = NULL;
+	fs->fd = open(filename, O_RDONLY | O_BINARY);
+	if (fs->fd < 0)
+		return -1;
+	if (fstat(fs->fd, &buf) < 0) {
+		close(fs->fd);
+		return -1;
+	}
+	*len = buf.st_size;
+	return 0;
+}
+
+int read_stream(char *buffer, int len, void *user_data)
+{
+	struct file_stream *fs = (struct file_stream *)user_data;
+	int ret, total = 0;
+	while (total < len) {
+		ret = read(fs->fd, buffer + total, len - total);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		total += ret;
+	}
+	stream_crypt(fs, buffer, total);
+	fs->offset += total;
+	return total;
+}
+
+/* The data is written to a temporary file next to filename, which only
+ * replaces filename in commit_stream. Closing the stream without
+ * committing it removes the temporary file and leaves filename alone. */
+int open_write_stream(struct file_stream *fs, const char* filename, char *key)
+{
+	int i;
+	fs->key = key;
+	fs->offset = 0;
+	fs->path = xmalloc(strlen(filename) + 1);
+	strcpy(fs->path, filename);
+	fs->temp = xmalloc(strlen(filename) + 16);
+	for (i = 0; i < 100; i++) {
+		sprintf(fs->temp, "%s.tmp%d", filename, i);
+		fs->fd = open(fs->temp, O_WRONLY | O_CREAT | O_EXCL | O_BINARY, S_IRUSR | S_IWUSR);
+		if (fs->fd >= 0 || errno != EEXIST)
+			break;
+	}
+	if (fs->fd < 0) {
+		free(fs->path);
+		free(fs->temp);
+		fs->path = NULL;
+		fs->temp = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+int write_stream(const char *buffer, int len, void *user_data)
+{
+	struct file_stream *fs = (struct file_stream *)user_data;
+	char chunk[1024];
+	const char *data;
+	int ret, size, written, total = 0;
+	while (total < len) {
+		size = len - total;
+		data = buffer + total;
+		if (fs->key) {
+			/* Decrypt a copy, buffer belongs to the caller */
+			if (size > (int)sizeof(chunk))
+				size = sizeof(chunk);
+			memcpy(chunk, data, size);
+			stream_crypt(fs, chunk, size);
+			data = chunk;
+		}
+		for (written = 0; written < size; written += ret) {
+			ret = write(fs->fd, data + written, size - written);
+			if (ret < 0 && errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			if (ret <= 0)
+				return -1;
+		}
+		fs->offset += size;
+		total += size;
+	}
+	return total;
+}
+
+/* Moves the data of a write stream to its destination */
+int commit_stream(struct file_stream *fs)
+{
+	int ret;
+	if (fs->fd < 0 || fs->temp == NULL)
+		return -1;
+	ret = close(fs->fd);
+	fs->fd = -1;
+	if (ret < 0)
+		return -1;
+#if defined(__MINGW32__)
+	/* rename does not replace an existing file here */
+	remove(fs->path);
+#endif
+	if (rename(fs->temp, fs->path) < 0)
+		return -1;
+	free(fs->temp);
+	fs->temp = NULL;
+	return 0;
+}
+
+void close_stream(struct file_stream *fs)
+{
+	if (fs->fd >= 0)
+		close(fs->fd);
+	fs->fd = -1;
+	if (fs->temp != NULL)
+		unlink(fs->temp);
+	free(fs->temp);
+	free(fs->path);
+	fs->temp = NULL;
+	fs->path = NULL;
+}
+
 int write_file(const char* filename, char *buffer, int len)
 {
 	int fd, ret, err;
@@ -340,3 +480,77 @@ int write_file(const char* filename, char *buffer, int len)
 	close(fd);
 	return 0;
 }
+
+/* Packet sizes found by calibrate are kept in mtu.dat in the data
+ * directory, one "<model> <sub model> <size>" line per model. */
+static char * model_mtu_file()
+{
+	const char *dir = get_data_dir();
+	if (dir == NULL)
+		return NULL;
+	mkdir(dir, 0770);
+	return mkpath(PATH_SEP, dir, "mtu.dat", NULL);
+}
+
+static const char * model_sub(exword_model_t *model)
+{
+	return model->sub_model[0] ? model->sub_model : "-";
+}
+
+int load_model_mtu(exword_model_t *model, uint16_t *mtu)
+{
+	char line[64], name[16], sub[16];
+	unsigned int size;
+	int found = 0;
+	char *file;
+	FILE *fp;
+	file = model_mtu_file();
+	if (file == NULL)
+		return 0;
+	fp = fopen(file, "r");
+	free(file);
+	if (fp == NULL)
+		return 0;
+	while (!found && fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%15s %15s %u", name, sub, &size) != 3)
+			continue;
+		if (strcmp(name, model->model) == 0 &&
+		    strcmp(sub, model_sub(model)) == 0) {
+			*mtu = size;
+			found = 1;
+		}
+	}
+	fclose(fp);
+	return found;
+}
+
+int save_model_mtu(exword_model_t *model, uint16_t mtu)
+{
+	char *file, *buffer = NULL;
+	char line[64], name[16], sub[16];
+	unsigned int size;
+	int len = 0, ret;
+	FILE *fp;
+	file = model_mtu_file();
+	if (file == NULL)
+		return 0;
+	fp = fopen(file, "r");
+	if (fp != NULL) {
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			if (sscanf(line, "%15s %15s %u", name, sub, &size) != 3)
+				continue;
+			if (strcmp(name, model->model) == 0 &&
+			    strcmp(sub, model_sub(model)) == 0)
+				continue;
+			buffer = xrealloc(buffer, len + sizeof(line));
+			len += sprintf(buffer + len, "%s %s %u\n", name, sub, size);
+		}
+		fclose(fp);
+	}
+	buffer = xrealloc(buffer, len + sizeof(line));
+	len += sprintf(buffer + len, "%s %s %u\n", model->model, model_sub(model), mtu);
+	ret = write_file(file, buffer, len);
+	free(buffer);
+	free(file);
+	return (ret == 0);
+}
@@ -31,6 +31,14 @@
 
 #include "list.h"
 
+struct file_stream {
+	int fd;
+	char *key;	/* XOR key applied to the data or NULL */
+	long offset;
+	char *path;	/* Destination of a write stream */
+	char *temp;	/* File written until commit_stream */
+};
+
 struct device_map {
 	char * dev;
 	char * root;
@@ -49,7 +57,15 @@ char * mode_id2str(int id);
 int is_valid_sfn(char * filename);
 int write_file(const char* filename, char *buffer, int len);
 int read_file(const char* filename, char **buffer, int *len);
+int open_read_stream(struct file_stream *fs, const char* filename, char *key, int *len);
+int read_stream(char *buffer, int len, void *user_data);
+int open_write_stream(struct file_stream *fs, const char* filename, char *key);
+int write_stream(const char *buffer, int len, void *user_data);
+int commit_stream(struct file_stream *fs);
+void close_stream(struct file_stream *fs);
 const char * get_data_dir();
+int load_model_mtu(exword_model_t *model, uint16_t *mtu);
+int save_model_mtu(exword_model_t *model, uint16_t mtu);
 char * mkpath(const char* separator, const char *base, ...);
 
 #endif
@@ -0,0 +1,94 @@
+/* async.c - commands sent from several threads
+ *
+ * Copyright (C) 2010-2018 - Brian Johnson <brijohn@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "common.h"
+
+#define THREADS		4
+#define COMMANDS	8
+
+struct sender {
+	pthread_t thread;
+	exword_t *d;
+	int sent;
+	int done;	/* Completions seen, counted by the event loop */
+};
+
+static int completed;
+static int failed;
+
+static void model_done(exword_t *self, exword_completion_t *c, void *user_data)
+{
+	struct sender *s = user_data;
+
+	if (c->result != EXWORD_SUCCESS || strcmp(c->model.model, TEST_MODEL) != 0)
+		failed++;
+	s->done++;
+	completed++;
+}
+
+static void * send_commands(void *arg)
+{
+	struct sender *s = arg;
+	int i;
+
+	for (i = 0; i < COMMANDS; i++) {
+		if (exword_get_model_async(s->d, model_done, s) != EXWORD_SUCCESS)
+			break;
+		s->sent++;
+	}
+	return NULL;
+}
+
+/* Several threads queue commands on one handle, the first of them starts
+ * its worker. The main thread then collects the completions, every command
+ * has to complete exactly once. */
+int main(void)
+{
+	struct sender senders[THREADS];
+	exword_t *d;
+	int i, loops;
+
+	CHECK(test_setup(NULL) != NULL);
+	d = test_connect(0);
+	CHECK(d != NULL);
+	memset(senders, 0, sizeof(senders));
+	for (i = 0; i < THREADS; i++) {
+		senders[i].d = d;
+		CHECK(pthread_create(&senders[i].thread, NULL, send_commands, &senders[i]) == 0);
+	}
+	for (i = 0; i < THREADS; i++) {
+		pthread_join(senders[i].thread, NULL);
+		CHECK(senders[i].sent == COMMANDS);
+	}
+	for (loops = 0; completed < THREADS * COMMANDS && loops < 1000; loops++)
+		exword_handle_events(d, 10);
+	for (i = 0; i < THREADS; i++)
+		CHECK(senders[i].done == COMMANDS);
+	CHECK(completed == THREADS * COMMANDS);
+	CHECK(failed == 0);
+	exword_disconnect(d);
+	exword_deinit(d);
+	test_cleanup();
+	return 0;
+}
@@ -0,0 +1,129 @@
+/* common.c - helpers shared by the emulator tests
+ *
+ * Copyright (C) 2010-2018 - Brian Johnson <brijohn@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+
+static char test_dir[] = "/tmp/exword-test.XXXXXX";
+static int test_created;
+
+static void remove_tree(const char *path)
+{
+	struct dirent *ent;
+	struct stat st;
+	char *sub;
+	DIR *dir;
+
+	dir = opendir(path);
+	if (dir == NULL)
+		return;
+	while ((ent = readdir(dir)) != NULL) {
+		if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+			continue;
+		sub = malloc(strlen(path) + strlen(ent->d_name) + 2);
+		if (sub == NULL)
+			break;
+		sprintf(sub, "%s/%s", path, ent->d_name);
+		if (lstat(sub, &st) == 0 && S_ISDIR(st.st_mode))
+			remove_tree(sub);
+		else
+			unlink(sub);
+		free(sub);
+	}
+	closedir(dir);
+	rmdir(path);
+}
+
+const char * test_setup(const char *faults)
+{
+	char path[sizeof(test_dir) + 16];
+
+	if (mkdtemp(test_dir) == NULL)
+		return NULL;
+	test_created = 1;
+	sprintf(path, "%s/_INTERNAL_00", test_dir);
+	if (mkdir(path, 0755) < 0)
+		return NULL;
+	unsetenv("EXWORD_REPLAY");
+	unsetenv("EXWORD_CAPTURE");
+	setenv("EXWORD_EMULATOR", test_dir, 1);
+	if (faults != NULL)
+		setenv("EXWORD_EMULATOR_FAULTS", faults, 1);
+	else
+		unsetenv("EXWORD_EMULATOR_FAULTS");
+	return test_dir;
+}
+
+void test_cleanup(void)
+{
+	if (test_created)
+		remove_tree(test_dir);
+	test_created = 0;
+}
+
+char * test_make_file(const char *name, int len)
+{
+	char path[sizeof(test_dir) + 64];
+	char *data;
+	FILE *fp;
+	int i;
+
+	data = malloc(len);
+	if (data == NULL)
+		return NULL;
+	for (i = 0; i < len; i++)
+		data[i] = i * 7 + i / 251;
+	snprintf(path, sizeof(path), "%s/_INTERNAL_00/%s", test_dir, name);
+	fp = fopen(path, "wb");
+	if (fp == NULL || fwrite(data, 1, len, fp) != len) {
+		if (fp != NULL)
+			fclose(fp);
+		free(data);
+		return NULL;
+	}
+	fclose(fp);
+	return data;
+}
+
+exword_t * test_connect(int retries)
+{
+	exword_t *d;
+
+	d = exword_init();
+	if (d == NULL)
+		return NULL;
+	if (getenv("EXWORD_TEST_DEBUG"))
+		exword_set_debug(d, atoi(getenv("EXWORD_TEST_DEBUG")));
+	exword_set_retries(d, retries);
+	if (exword_connect(d, TEST_OPTIONS) != EXWORD_SUCCESS ||
+	    exword_setpath(d, (uint8_t *)"\\_INTERNAL_00", 0) != EXWORD_SUCCESS) {
+		exword_deinit(d);
+		return NULL;
+	}
+	return d;
+}
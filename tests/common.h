@@ -0,0 +1,52 @@
+/* common.h - helpers shared by the emulator tests
+ *
+ * Copyright (C) 2010-2018 - Brian Johnson <brijohn@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ */
+
+#ifndef _COMMON_H
+#define _COMMON_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "exword.h"
+
+/* Text mode needs no authentication, the emulator answers every request */
+#define TEST_OPTIONS	(EXWORD_MODE_TEXT | EXWORD_REGION_JA)
+/* Model reported by the emulator by default */
+#define TEST_MODEL	"gy131,ON,0100"
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		test_cleanup(); \
+		exit(1); \
+	} \
+} while (0)
+
+/* Creates the emulator directory and selects it with faults, or NULL */
+const char * test_setup(const char *faults);
+/* Removes the emulator directory */
+void test_cleanup(void);
+/* Stores a file of len pattern bytes in the internal memory */
+char * test_make_file(const char *name, int len);
+/* Connects a new handle and enters the internal memory */
+exword_t * test_connect(int retries);
+
+#endif
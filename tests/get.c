@@ -0,0 +1,100 @@
+/* get.c - downloads over existing files
+ *
+ * Copyright (C) 2010-2018 - Brian Johnson <brijohn@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <string.h>
+
+#include "common.h"
+#include "util.h"
+
+static int count_entries(const char *path)
+{
+	struct dirent *ent;
+	DIR *dir;
+	int n = 0;
+
+	dir = opendir(path);
+	if (dir == NULL)
+		return -1;
+	while ((ent = readdir(dir)) != NULL) {
+		if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+			n++;
+	}
+	closedir(dir);
+	return n;
+}
+
+static int download(exword_t *d, const char *remote, const char *local)
+{
+	struct file_stream fs;
+	int rsp, len;
+
+	rsp = open_write_stream(&fs, local, NULL);
+	if (rsp != 0)
+		return EXWORD_ERROR_OTHER;
+	rsp = exword_get_stream(d, (char *)remote, write_stream, &fs, &len);
+	if (rsp == EXWORD_SUCCESS && commit_stream(&fs) != 0)
+		rsp = EXWORD_ERROR_OTHER;
+	close_stream(&fs);
+	return rsp;
+}
+
+/* A download that fails leaves the file it would have replaced alone and
+ * removes what it wrote, one that succeeds replaces the file. */
+int main(void)
+{
+	const char *dir;
+	char local[64], path[128];
+	exword_t *d;
+	char *data, *buffer;
+	int len;
+
+	dir = test_setup(NULL);
+	CHECK(dir != NULL);
+	data = test_make_file("FILE.TXT", 5000);
+	CHECK(data != NULL);
+	sprintf(local, "%s/local", dir);
+	CHECK(mkdir(local, 0755) == 0);
+	sprintf(path, "%s/KEEP.TXT", local);
+	CHECK(write_file(path, "keep", 4) == 0);
+
+	d = test_connect(0);
+	CHECK(d != NULL);
+	CHECK(download(d, "MISSING.TXT", path) == EXWORD_ERROR_NOT_FOUND);
+	CHECK(read_file(path, &buffer, &len) == 0);
+	CHECK(len == 4 && memcmp(buffer, "keep", 4) == 0);
+	free(buffer);
+	CHECK(count_entries(local) == 1);
+
+	CHECK(download(d, "FILE.TXT", path) == EXWORD_SUCCESS);
+	CHECK(read_file(path, &buffer, &len) == 0);
+	CHECK(len == 5000 && memcmp(buffer, data, len) == 0);
+	free(buffer);
+	CHECK(count_entries(local) == 1);
+
+	free(data);
+	exword_disconnect(d);
+	exword_deinit(d);
+	test_cleanup();
+	return 0;
+}
@@ -0,0 +1,50 @@
+/* headers.c - answers with many headers
+ *
+ * Copyright (C) 2010-2018 - Brian Johnson <brijohn@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ */
+
+#include <string.h>
+
+#include "common.h"
+
+/* Each answer to a GET carries 20 extra description headers, more than
+ * the receive path keeps in place, around the body of the file. */
+int main(void)
+{
+	exword_model_t model;
+	exword_t *d;
+	char *data, *buffer;
+	int len;
+
+	CHECK(test_setup("pad=20") != NULL);
+	data = test_make_file("FILE.TXT", 20000);
+	CHECK(data != NULL);
+	d = test_connect(0);
+	CHECK(d != NULL);
+	CHECK(exword_get_model(d, &model) == EXWORD_SUCCESS);
+	CHECK(strcmp(model.model, TEST_MODEL) == 0);
+	CHECK(exword_get_file(d, "FILE.TXT", &buffer, &len) == EXWORD_SUCCESS);
+	CHECK(len == 20000 && memcmp(buffer, data, len) == 0);
+	free(buffer);
+	free(data);
+	exword_disconnect(d);
+	exword_deinit(d);
+	test_cleanup();
+	return 0;
+}
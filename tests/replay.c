@@ -0,0 +1,70 @@
+/* replay.c - playing back a captured session
+ *
+ * Copyright (C) 2010-2018 - Brian Johnson <brijohn@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ */
+
+#include <string.h>
+
+#include "common.h"
+
+static void session(char **buffer, int *len, exword_model_t *model)
+{
+	exword_t *d;
+
+	d = test_connect(0);
+	CHECK(d != NULL);
+	CHECK(exword_get_model(d, model) == EXWORD_SUCCESS);
+	CHECK(exword_get_file(d, "FILE.TXT", buffer, len) == EXWORD_SUCCESS);
+	CHECK(exword_disconnect(d) == EXWORD_SUCCESS);
+	exword_deinit(d);
+}
+
+/* A session with the emulator is captured and played back, the replay
+ * has to give the same answers without the emulator. */
+int main(void)
+{
+	exword_model_t model, replayed_model;
+	const char *dir;
+	char capture[64];
+	char *data, *buffer, *replayed;
+	int len, replayed_len;
+
+	dir = test_setup(NULL);
+	CHECK(dir != NULL);
+	data = test_make_file("FILE.TXT", 20000);
+	CHECK(data != NULL);
+	sprintf(capture, "%s/capture", dir);
+	setenv("EXWORD_CAPTURE", capture, 1);
+	session(&buffer, &len, &model);
+	unsetenv("EXWORD_CAPTURE");
+	CHECK(len == 20000 && memcmp(buffer, data, len) == 0);
+
+	unsetenv("EXWORD_EMULATOR");
+	setenv("EXWORD_REPLAY", capture, 1);
+	session(&replayed, &replayed_len, &replayed_model);
+	unsetenv("EXWORD_REPLAY");
+	CHECK(memcmp(&model, &replayed_model, sizeof(model)) == 0);
+	CHECK(replayed_len == len && memcmp(replayed, buffer, len) == 0);
+
+	free(replayed);
+	free(buffer);
+	free(data);
+	test_cleanup();
+	return 0;
+}
@@ -0,0 +1,51 @@
+/* retry.c - resend after a partial answer
+ *
+ * Copyright (C) 2010-2018 - Brian Johnson <brijohn@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ */
+
+#include <string.h>
+
+#include "common.h"
+
+/* Every third answer is cut short and has to be fetched again by a resend
+ * with the same sequence number. The first half already received is stale
+ * by then and must be dropped, not prepended to the repeated answer. */
+int main(void)
+{
+	exword_model_t model;
+	exword_t *d;
+	char *data, *buffer;
+	int len;
+
+	CHECK(test_setup("cut=3") != NULL);
+	data = test_make_file("FILE.TXT", 20000);
+	CHECK(data != NULL);
+	d = test_connect(1);
+	CHECK(d != NULL);
+	CHECK(exword_get_model(d, &model) == EXWORD_SUCCESS);
+	CHECK(strcmp(model.model, TEST_MODEL) == 0);
+	CHECK(exword_get_file(d, "FILE.TXT", &buffer, &len) == EXWORD_SUCCESS);
+	CHECK(len == 20000 && memcmp(buffer, data, len) == 0);
+	free(buffer);
+	free(data);
+	exword_disconnect(d);
+	exword_deinit(d);
+	test_cleanup();
+	return 0;
+}